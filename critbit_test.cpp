@@ -1,6 +1,11 @@
 #include "gtest/gtest.h"
 
 #include "critbit_tree.h"
+#include "sb_match.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
 
 TEST(critbit , CRITBIT_ISLEAF)
 {
@@ -317,6 +322,57 @@ TEST(critbit , suffixes)
     critbit_free(cbt);
 }
 
+TEST(critbit , suffixes_limit)
+{
+    critbit_tree_t* cbt = critbit_create();
+    const char* T = "mississippi$";
+    size_t n = strlen(T);
+    uint64_t suffixes[6] = {5,7,6,2,8,0};
+    for (uint64_t i=0; i<6; i++) critbit_insert_suffix(cbt,(const uint8_t*)T,n,suffixes[i]);
+
+    /* sippi$ < ssippi$ < ssissippi$ */
+    uint64_t results[4];
+    EXPECT_EQ(critbit_suffixes_limit(cbt,(const uint8_t*)T,n,(const uint8_t*)"s",1,2,CRITBIT_ORDER_LEX,results) , 2ULL);
+    EXPECT_TRUE(results[0] == 6 && results[1] == 5);
+    EXPECT_EQ(critbit_suffixes_limit(cbt,(const uint8_t*)T,n,(const uint8_t*)"s",1,2,CRITBIT_ORDER_POS,results) , 2ULL);
+    EXPECT_TRUE(results[0] == 2 && results[1] == 5);
+    EXPECT_EQ(critbit_suffixes_limit(cbt,(const uint8_t*)T,n,(const uint8_t*)"s",1,4,CRITBIT_ORDER_POS,results) , 3ULL);
+    EXPECT_TRUE(results[0] == 2 && results[1] == 5 && results[2] == 6);
+    EXPECT_EQ(critbit_suffixes_limit(cbt,(const uint8_t*)T,n,(const uint8_t*)"s",1,0,CRITBIT_ORDER_LEX,results) , 0ULL);
+    EXPECT_EQ(critbit_suffixes_limit(cbt,(const uint8_t*)T,n,(const uint8_t*)"iss",3,4,CRITBIT_ORDER_LEX,results) , 0ULL);
+    critbit_free(cbt);
+
+    /* all suffixes of a random text against the full result sets */
+    uint64_t m = 20000;
+    std::string R(m,'a');
+    srand(4711);
+    for (uint64_t i=0; i<m; i++) R[i] = 'a' + rand()%3;
+    std::vector<uint64_t> all(m);
+    for (uint64_t i=0; i<m; i++) all[i] = i;
+    cbt = critbit_create_from_suffixes((const uint8_t*)R.data(),m,all.data(),m);
+    const char* patterns[] = {"a","ab","cab","abcabc"};
+    std::vector<uint64_t> limited(m);
+    for (uint64_t p=0; p<4; p++) {
+        const uint8_t* P = (const uint8_t*) patterns[p];
+        uint64_t* full;
+        uint64_t nfull = critbit_suffixes(cbt,(const uint8_t*)R.data(),m,P,strlen(patterns[p]),&full);
+        for (uint64_t k=1; k<=nfull+1; k+=nfull/7+1) {
+            uint64_t nlim = critbit_suffixes_limit(cbt,(const uint8_t*)R.data(),m,P,strlen(patterns[p]),k,CRITBIT_ORDER_POS,limited.data());
+            EXPECT_EQ(nlim , std::min(k,nfull));
+            for (uint64_t i=0; i<nlim; i++) EXPECT_EQ(limited[i] , full[i]);
+
+            /* the lexicographically smallest ones are a sorted prefix of the suffix array range */
+            nlim = critbit_suffixes_limit(cbt,(const uint8_t*)R.data(),m,P,strlen(patterns[p]),k,CRITBIT_ORDER_LEX,limited.data());
+            EXPECT_EQ(nlim , std::min(k,nfull));
+            for (uint64_t i=1; i<nlim; i++) {
+                EXPECT_LT(R.compare(limited[i-1],std::string::npos,R,limited[i],std::string::npos) , 0);
+            }
+        }
+        free(full);
+    }
+    critbit_free(cbt);
+}
+
 TEST(critbit , create_from_suffixes)
 {
     const char* T = "mississippi$";
@@ -398,6 +454,434 @@ TEST(critbit , load_save)
     critbit_free(cbtload);
 }
 
+TEST(critbit , mem_search)
+{
+    const char* T = "mississippi$";
+    size_t n = strlen(T);
+
+    uint64_t suffixes[12] = {11,10,7,4,1,0,9,8,6,3,5,2}; /* SA of mississippi$ */
+
+    critbit_tree_t* cbt = critbit_create_from_suffixes((const uint8_t*)T,n,suffixes,12);
+
+    FILE* tf = tmpfile();
+    uint64_t written = critbit_write(cbt,tf);
+    uint64_t* mem = (uint64_t*) malloc(written);
+    fseek(tf,0,SEEK_SET);
+    fread(mem,1,written,tf);
+
+    critbit_mem_t cbm;
+    critbit_mem_init(&cbm,mem);
+    EXPECT_EQ(cbm.g , 12);
+    for (uint64_t i=0; i<12; i++) EXPECT_EQ(critbit_mem_getsuffix(&cbm,i) , suffixes[i]);
+
+    uint64_t lb,rb;
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"s",1,&lb,&rb) , 4);
+    EXPECT_TRUE(lb == 8 && rb == 12);
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"ssi",3,&lb,&rb) , 2);
+    EXPECT_TRUE(lb == 10 && rb == 12);
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"i",1,&lb,&rb) , 4);
+    EXPECT_TRUE(lb == 1 && rb == 5);
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"mississippi$",12,&lb,&rb) , 1);
+    EXPECT_TRUE(lb == 5 && rb == 6);
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"iss",3,&lb,&rb) , 2);
+    EXPECT_TRUE(lb == 3 && rb == 5);
+    /* not contained: lb = rb = number of smaller suffixes */
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"x",1,&lb,&rb) , 0);
+    EXPECT_TRUE(lb == 12 && rb == 12);
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"\x01",1,&lb,&rb) , 0);
+    EXPECT_TRUE(lb == 0 && rb == 0);
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"sleep",5,&lb,&rb) , 0);
+    EXPECT_TRUE(lb == 10 && rb == 10);
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"ississippi$x",12,&lb,&rb) , 0);
+    EXPECT_TRUE(lb == 5 && rb == 5);
+    EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n, (const uint8_t*)"pa",2,&lb,&rb) , 0);
+    EXPECT_TRUE(lb == 6 && rb == 6);
+
+    /* every substring of T is found with the correct count */
+    for (uint64_t i=0; i<n; i++) {
+        for (uint64_t j=i+1; j<=n; j++) {
+            uint64_t cnt = 0;
+            for (uint64_t k=0; k+j-i<=n; k++) if (memcmp(T+k,T+i,j-i)==0) cnt++;
+            EXPECT_EQ(critbit_mem_search(&cbm,(const uint8_t*)T,n,(const uint8_t*)T+i,j-i,&lb,&rb) , cnt);
+            EXPECT_EQ(critbit_contains(cbt,(const uint8_t*)T,n,(const uint8_t*)T+i,j-i) , 1);
+        }
+    }
+
+    fclose(tf);
+    free(mem);
+    critbit_free(cbt);
+}
+
+TEST(critbit , create_from_sorted)
+{
+    /* the bulk loaded tree is identical to the one built by insertion */
+    srand(17);
+    for (uint64_t t=0; t<50; t++) {
+        uint64_t n = 1 + rand()%300;
+        uint64_t sigma = 1 + rand()%4;
+        uint8_t* T = (uint8_t*) malloc(n);
+        for (uint64_t i=0; i<n; i++) T[i] = 'a' + rand()%sigma;
+
+        /* sort all suffixes and pick a sorted subset as a block */
+        uint64_t* SA = (uint64_t*) malloc(n*sizeof(uint64_t));
+        for (uint64_t i=0; i<n; i++) SA[i] = i;
+        std::sort(SA,SA+n,[&](uint64_t a,uint64_t b) {
+            return std::lexicographical_compare(T+a,T+n,T+b,T+n);
+        });
+        uint64_t g = 0;
+        for (uint64_t i=0; i<n; i++) if (rand()%3 || i == 0) SA[g++] = SA[i];
+        uint64_t* lcp = (uint64_t*) malloc(g*sizeof(uint64_t));
+        lcp[0] = 0;
+        for (uint64_t i=1; i<g; i++) {
+            uint64_t l = 0;
+            while (SA[i-1]+l < n && SA[i]+l < n && T[SA[i-1]+l] == T[SA[i]+l]) l++;
+            lcp[i] = l;
+        }
+
+        critbit_tree_t* a = critbit_create_from_suffixes(T,n,SA,g);
+        critbit_tree_t* b = critbit_create_from_sorted(T,n,SA,lcp,g);
+        critbit_tree_t* c = critbit_create_from_sorted(T,n,SA,NULL,g);
+        critbit_tree_t* trees[3] = {a,b,c};
+        std::string ser[3];
+        for (uint64_t i=0; i<3; i++) {
+            EXPECT_EQ(trees[i]->g , g);
+            char* mem = NULL;
+            size_t size = 0;
+            FILE* f = open_memstream(&mem,&size);
+            critbit_write(trees[i],f);
+            fclose(f);
+            ser[i].assign(mem,size);
+            free(mem);
+            critbit_free(trees[i]);
+        }
+        EXPECT_EQ(ser[0] , ser[1]);
+        EXPECT_EQ(ser[0] , ser[2]);
+
+        free(T);
+        free(SA);
+        free(lcp);
+    }
+}
+
+TEST(critbit , arena_reuse)
+{
+    /* rebuilding a tree in place reuses its node chunks and gives the same
+       tree as a fresh build */
+    srand(23);
+    uint64_t n = 3*CRITBIT_ARENA_CHUNK;
+    uint8_t* T = (uint8_t*) malloc(n);
+    for (uint64_t i=0; i<n; i++) T[i] = 'a' + rand()%4;
+    uint64_t* SA = (uint64_t*) malloc(n*sizeof(uint64_t));
+    for (uint64_t i=0; i<n; i++) SA[i] = i;
+    std::sort(SA,SA+n,[&](uint64_t a,uint64_t b) {
+        return std::lexicographical_compare(T+a,T+n,T+b,T+n);
+    });
+
+    critbit_tree_t* cbt = critbit_create();
+    uint64_t nchunks = 0;
+    for (uint64_t t=0; t<10; t++) {
+        uint64_t g = (t%2) ? n : 1 + rand()%CRITBIT_ARENA_CHUNK;
+        critbit_build_from_sorted(cbt,T,n,SA,NULL,g);
+        EXPECT_EQ(cbt->g , g);
+        if (t == 1) nchunks = cbt->arena.nchunks;
+        if (t > 1) EXPECT_EQ(cbt->arena.nchunks , nchunks);
+
+        critbit_tree_t* fresh = critbit_create_from_sorted(T,n,SA,NULL,g);
+        char* mem[2] = {NULL,NULL};
+        size_t size[2] = {0,0};
+        critbit_tree_t* trees[2] = {cbt,fresh};
+        for (uint64_t i=0; i<2; i++) {
+            FILE* f = open_memstream(&mem[i],&size[i]);
+            critbit_write(trees[i],f);
+            fclose(f);
+        }
+        ASSERT_EQ(size[0] , size[1]);
+        EXPECT_EQ(memcmp(mem[0],mem[1],size[0]) , 0);
+        free(mem[0]);
+        free(mem[1]);
+        critbit_free(fresh);
+    }
+
+    /* nodes of deleted suffixes are reused by later inserts */
+    critbit_clear(cbt);
+    EXPECT_EQ(cbt->g , 0ULL);
+    EXPECT_EQ(cbt->root , (critbit_node_t*) NULL);
+    for (uint64_t i=0; i<100; i++) critbit_insert_suffix(cbt,T,n,i);
+    uint64_t used = cbt->arena.used;
+    for (uint64_t i=0; i<50; i++) EXPECT_EQ(critbit_delete_suffix(cbt,T,n,i) , 0ULL);
+    for (uint64_t i=0; i<50; i++) critbit_insert_suffix(cbt,T,n,i);
+    EXPECT_EQ(cbt->arena.used , used);
+    EXPECT_EQ(cbt->g , 100ULL);
+    for (uint64_t i=0; i<100; i++) EXPECT_EQ(critbit_contains(cbt,T,n,T+i,n-i) , 1ULL);
+
+    critbit_free(cbt);
+    free(T);
+    free(SA);
+}
+TEST(critbit , serialize)
+{
+    /* a^n gives a tree that degenerates into a path of depth n-1 */
+    uint64_t n = 200000;
+    uint8_t* T = (uint8_t*) malloc(n);
+    memset(T,'a',n);
+    uint64_t* SA = (uint64_t*) malloc(n*sizeof(uint64_t));
+    uint64_t* lcp = (uint64_t*) malloc(n*sizeof(uint64_t));
+    for (uint64_t i=0; i<n; i++) {
+        SA[i] = n-1-i;
+        lcp[i] = i;
+    }
+    critbit_tree_t* cbt = critbit_create_from_sorted(T,n,SA,lcp,n);
+
+    /* serialize with wider fields than needed into a larger zeroed buffer */
+    uint64_t pos_width = 24, suffix_width = 20;
+    uint64_t bytes = critbit_serialized_size(n,pos_width,suffix_width,0);
+    /* one header word, the excess directory and the three arrays packed without padding */
+    uint64_t blocks = (2*(2*n-1)+CRITBIT_DIR_BLOCK-1)/CRITBIT_DIR_BLOCK;
+    EXPECT_EQ(critbit_dir_words(n) , blocks + (196+25+4+1+1)/2);
+    EXPECT_EQ(bytes , 8*(1+critbit_dir_words(n)+(2*(2*n-1)+(n-1)*pos_width+n*suffix_width+63)/64));
+    EXPECT_EQ(critbit_serialize(cbt,pos_width,suffix_width,0,NULL,bytes-1) , 0ULL);
+    uint64_t size = bytes + 4096;
+    uint64_t* mem = (uint64_t*) malloc(size);
+    memset(mem,0xFF,size);
+    EXPECT_EQ(critbit_serialize(cbt,pos_width,suffix_width,0,mem,size) , bytes);
+    for (uint64_t i=bytes; i<size; i++) EXPECT_EQ(((uint8_t*)mem)[i] , 0);
+
+    critbit_mem_t cbm;
+    critbit_mem_init(&cbm,mem);
+    EXPECT_EQ(cbm.g , n);
+    EXPECT_EQ(cbm.pos_width , pos_width);
+    EXPECT_EQ(cbm.suffix_width , suffix_width);
+    for (uint64_t i=0; i<n; i+=997) EXPECT_EQ(critbit_mem_getsuffix(&cbm,i) , SA[i]);
+    uint64_t lb,rb;
+    EXPECT_EQ(critbit_mem_search(&cbm,T,n,T,1000,&lb,&rb) , n-999);
+    EXPECT_TRUE(lb == 999 && rb == n);
+
+    /* critbit_write uses the smallest widths */
+    char* wmem = NULL;
+    size_t wsize = 0;
+    FILE* f = open_memstream(&wmem,&wsize);
+    critbit_write(cbt,f);
+    fclose(f);
+    critbit_mem_init(&cbm,(uint64_t*)wmem);
+    EXPECT_EQ(cbm.pos_width , 4ULL);
+    EXPECT_EQ(cbm.suffix_width , 18ULL);
+    EXPECT_EQ(wsize , critbit_serialized_size(n,4,18,0));
+    EXPECT_EQ(critbit_mem_search(&cbm,T,n,T,1000,&lb,&rb) , n-999);
+
+    free(wmem);
+    free(mem);
+    free(lcp);
+    free(SA);
+    free(T);
+    critbit_free(cbt);
+}
+
+TEST(critbit , serialize_base)
+{
+    uint64_t n = 1000;
+    uint8_t* T = (uint8_t*) malloc(n);
+    memset(T,'a',n);
+    uint64_t* SA = (uint64_t*) malloc(n*sizeof(uint64_t));
+    uint64_t* lcp = (uint64_t*) malloc(n*sizeof(uint64_t));
+    for (uint64_t i=0; i<n; i++) {
+        SA[i] = n-1-i;
+        lcp[i] = i;
+    }
+    /* the suffixes 200..799 stored relative to 200 */
+    uint64_t g = 600;
+    critbit_tree_t* cbt = critbit_create_from_sorted(T,n,SA+200,lcp+200,g);
+    uint64_t widths[3] = {10,33,60};
+    for (uint64_t w=0; w<3; w++) {
+        uint64_t bytes = critbit_serialized_size(g,11,widths[w],200);
+        EXPECT_EQ(bytes , critbit_serialized_size(g,11,widths[w],0) + 8);
+        uint64_t* mem = (uint64_t*) malloc(bytes);
+        EXPECT_EQ(critbit_serialize(cbt,11,widths[w],200,mem,bytes) , bytes);
+
+        critbit_mem_t cbm;
+        critbit_mem_init(&cbm,mem);
+        EXPECT_EQ(cbm.g , g);
+        EXPECT_EQ(cbm.suffix_width , widths[w]);
+        EXPECT_EQ(cbm.suffix_base , 200ULL);
+        for (uint64_t i=0; i<g; i++) EXPECT_EQ(critbit_mem_getsuffix(&cbm,i) , SA[200+i]);
+
+        /* bulk decoding of ranges up to the end of the array */
+        std::vector<uint64_t> out(g);
+        for (uint64_t lo=0; lo<g; lo+=37) {
+            for (uint64_t hi=lo; hi<=g; hi+=(g-lo)/5+1) {
+                critbit_mem_getsuffixes(&cbm,lo,hi,out.data());
+                for (uint64_t i=lo; i<hi; i++) EXPECT_EQ(out[i-lo] , SA[200+i]);
+            }
+            critbit_mem_getsuffixes(&cbm,lo,g,out.data());
+            for (uint64_t i=lo; i<g; i++) EXPECT_EQ(out[i-lo] , SA[200+i]);
+        }
+
+        uint64_t lb,rb;
+        EXPECT_EQ(critbit_mem_search(&cbm,T,n,T,500,&lb,&rb) , 301ULL);
+        EXPECT_TRUE(lb == 299 && rb == g);
+
+        critbit_tree_t* loaded = critbit_load_from_mem(mem,bytes);
+        EXPECT_EQ(critbit_contains(loaded,T,n,T,790) , 1ULL);
+        critbit_free(loaded);
+        free(mem);
+    }
+
+    free(lcp);
+    free(SA);
+    free(T);
+    critbit_free(cbt);
+}
+
+TEST(critbit , mem_lcp)
+{
+    /* no 0 bytes, so the crit bytes are the exact lcps */
+    uint64_t n = 3000;
+    std::string T(n,'a');
+    srand(23);
+    for (uint64_t i=0; i<n; i++) T[i] = 'a' + rand()%3;
+    std::vector<uint64_t> SA(n),lcp(n,0);
+    for (uint64_t i=0; i<n; i++) SA[i] = i;
+    std::sort(SA.begin(),SA.end(),[&](uint64_t a,uint64_t b) { return T.compare(a,n,T,b,n) < 0; });
+    for (uint64_t i=1; i<n; i++) {
+        while (SA[i-1]+lcp[i] < n && SA[i]+lcp[i] < n && T[SA[i-1]+lcp[i]] == T[SA[i]+lcp[i]]) lcp[i]++;
+    }
+
+    /* one page worth of suffixes from the middle */
+    uint64_t g = 700;
+    const uint8_t* Tb = (const uint8_t*)T.data();
+    critbit_tree_t* cbt = critbit_create_from_sorted(Tb,n,SA.data()+1000,lcp.data()+1000,g);
+    char* mem = NULL;
+    size_t size = 0;
+    FILE* f = open_memstream(&mem,&size);
+    critbit_write(cbt,f);
+    fclose(f);
+    critbit_mem_t cbm;
+    critbit_mem_init(&cbm,(uint64_t*)mem);
+
+    /* the lcp of two leaves is the minimum of the lcps between them */
+    for (uint64_t a=0; a<g; a+=13) {
+        uint64_t l = UINT64_MAX;
+        EXPECT_EQ(critbit_mem_lcp(&cbm,a,a) , UINT64_MAX);
+        for (uint64_t b=a+1; b<g; b++) {
+            l = std::min(l,lcp[1000+b]);
+            if (b%7 == 0) {
+                EXPECT_EQ(critbit_mem_lcp(&cbm,a,b) , l);
+                EXPECT_EQ(critbit_mem_lcp(&cbm,b,a) , l);
+            }
+        }
+    }
+
+    /* the descent bounds the lcp of the candidate with the first and last leaf
+       and patterns agreeing in the bytes it looked at reach the same candidate */
+    for (uint64_t i=0; i<500; i++) {
+        std::string P = T.substr(rand()%(n-20),1+rand()%20);
+        if (i%3 == 0) P[rand()%P.size()] = 'a' + rand()%4;
+        uint64_t lcp_first, lcp_last, reach;
+        uint64_t c = critbit_mem_locate(&cbm,(const uint8_t*)P.data(),P.size(),&lcp_first,&lcp_last,&reach);
+        EXPECT_EQ(c , critbit_mem_candidate(&cbm,(const uint8_t*)P.data(),P.size()));
+        EXPECT_EQ(lcp_first , critbit_mem_lcp(&cbm,0,c));
+        EXPECT_EQ(lcp_last , critbit_mem_lcp(&cbm,c,g-1));
+        if (reach <= P.size()) {
+            std::string Q = P.substr(0,reach) + "cab";
+            EXPECT_EQ(critbit_mem_candidate(&cbm,(const uint8_t*)Q.data(),Q.size()) , c);
+        }
+    }
+
+    free(mem);
+    critbit_free(cbt);
+}
+
+TEST(critbit , match_kernels)
+{
+    /* a repetitive buffer with single mismatches at all positions and
+       alignments. the compared ranges end at the end of the allocations */
+    uint64_t n = 300;
+    std::vector<uint8_t> a(n), b(n);
+    for (uint64_t i=0; i<n; i++) a[i] = b[i] = (uint8_t)(i%3);
+    sbmatch_lcp_fn fns[4] = { sbmatch_lcp_scalar, sbmatch_lcp_sse2, sbmatch_lcp_avx2, sbmatch_lcp };
+    uint64_t nfns = sbmatch_has_avx2() ? 4 : 2;
+    for (uint64_t f=0; f<nfns; f++) {
+        for (uint64_t off=0; off<40; off++) {
+            uint64_t len = n - off;
+            EXPECT_EQ(fns[f](a.data()+off,b.data()+off,len) , len);
+            for (uint64_t x=off; x<n; x+=7) {
+                b[x] ^= 0x80;
+                EXPECT_EQ(fns[f](a.data()+off,b.data()+off,len) , x-off);
+                EXPECT_EQ(fns[f](a.data()+off,b.data()+off,x-off) , x-off);
+                b[x] ^= 0x80;
+            }
+        }
+    }
+    EXPECT_EQ(sbmatch_lcp(a.data()+n,b.data()+n,0) , 0ULL);
+
+    /* crit bits of suffixes. a suffix that ended compares as 0 bytes */
+    const uint8_t T[] = { 'a','b','a','b','a','b',0,0,'a','b' };
+    uint64_t tn = sizeof(T);
+    EXPECT_EQ(sbmatch_critbit(T,tn,0,2,0) , (4ULL<<3) + CRITBIT_GETCRITBITPOS('a',0));
+    EXPECT_EQ(sbmatch_critbit(T,tn,0,2,4) , (4ULL<<3) + CRITBIT_GETCRITBITPOS('a',0));
+    EXPECT_EQ(sbmatch_critbit(T,tn,0,8,0) , (2ULL<<3) + CRITBIT_GETCRITBITPOS('a',0));
+    EXPECT_EQ(sbmatch_critbit(T,tn,6,7,0) , (1ULL<<3) + CRITBIT_GETCRITBITPOS(0,'a'));
+    EXPECT_EQ(sbmatch_critbit(T,tn,2,0,0) , (4ULL<<3) + CRITBIT_GETCRITBITPOS(0,'a'));
+
+    /* the longer suffix continues with 0 bytes after the shorter one ended */
+    const uint8_t T2[] = { 'z',0,0,'z',0 };
+    EXPECT_EQ(sbmatch_critbit(T2,5,3,0,0) , (3ULL<<3) + CRITBIT_GETCRITBITPOS('z',0));
+    EXPECT_EQ(sbmatch_critbit(T2,5,1,4,0) , (2ULL<<3) + CRITBIT_GETCRITBITPOS('z',0));
+
+    /* suffixes which only differ in their length */
+    const uint8_t T3[] = { 0,0 };
+    EXPECT_EQ(sbmatch_critbit(T3,2,0,1,0) , (2ULL<<3));
+}
+
+TEST(critbit , bp_directory)
+{
+    /* random texts give bushy trees, a^n a path crossing all blocks */
+    uint64_t n = 3000;
+    std::vector<uint8_t> T(n);
+    std::vector<uint64_t> suffixes(n);
+    for (uint64_t t=0; t<3; t++) {
+        srand(4711+t);
+        for (uint64_t i=0; i<n; i++) T[i] = (t == 2) ? 'a' : 'a' + rand()%(2+10*t);
+        for (uint64_t i=0; i<n; i++) suffixes[i] = i;
+        critbit_tree_t* cbt = critbit_create_from_suffixes(T.data(),n,suffixes.data(),n);
+
+        char* mem = NULL;
+        size_t size = 0;
+        FILE* f = open_memstream(&mem,&size);
+        critbit_write(cbt,f);
+        fclose(f);
+        critbit_mem_t cbm;
+        critbit_mem_init(&cbm,(uint64_t*)mem);
+        EXPECT_EQ(cbm.dir_blocks , (2*(2*n-1)+CRITBIT_DIR_BLOCK-1)/CRITBIT_DIR_BLOCK);
+
+        /* compare with a scan of the bp */
+        uint64_t bits = 2*(2*n-1);
+        std::vector<uint64_t> open;
+        uint64_t excess = 0;
+        for (uint64_t i=0; i<bits; i++) {
+            EXPECT_EQ(critbit_mem_excess(&cbm,i) , excess);
+            if ((cbm.bp[i>>6]>>(i&63))&1) {
+                open.push_back(i);
+                excess++;
+            } else {
+                EXPECT_EQ(critbit_mem_findclose(&cbm,open.back()) , i);
+                open.pop_back();
+                excess--;
+            }
+        }
+        EXPECT_TRUE(open.empty());
+
+        /* the navigation built on it */
+        uint64_t lb,rb;
+        for (uint64_t i=0; i<n; i+=101) {
+            uint64_t m = std::min(n-i,(uint64_t)4), occ = 0;
+            for (uint64_t j=0; j+m<=n; j++) occ += (memcmp(&T[j],&T[i],m) == 0);
+            EXPECT_EQ(critbit_mem_search(&cbm,T.data(),n,&T[i],m,&lb,&rb) , occ);
+        }
+
+        free(mem);
+        critbit_free(cbt);
+    }
+}
 
 int main(int argc, char** argv)
 {
@@ -1,8 +1,11 @@
 
 #include "critbit_tree.h"
+#include "sb_match.h"
 
 #include <sdsl/int_vector.hpp>
 #include <stack>
+#include <algorithm>
+#include <string.h>
 
 using namespace sdsl;
 
@@ -17,6 +20,13 @@ critbit_create()
     }
     cbt->root = NULL;
     cbt->g = 0;
+    cbt->arena.chunks = NULL;
+    cbt->arena.nchunks = 0;
+    cbt->arena.cur = 0;
+    cbt->arena.used = 0;
+    cbt->arena.freelist = NULL;
+    cbt->stack = NULL;
+    cbt->stack_size = 0;
     return cbt;
 }
 
@@ -31,32 +41,145 @@ critbit_create_from_suffixes(const uint8_t* T,uint64_t n,uint64_t* suffixes,uint
     return cbt;
 }
 
-/* clears all data from the critbit tree */
+/* bulk load the suffixes given in lexicographical order. lcp[i] is the lcp of
+   suffixes[i-1] and suffixes[i] (lcp[0] is not used).
+
+   the crit bit of two adjacent suffixes lies in the byte at their lcp. apart
+   from the two bytes at each lcp no text is read. without lcp values adjacent
+   suffixes are compared directly */
+critbit_tree_t*
+critbit_create_from_sorted(const uint8_t* T,uint64_t n,const uint64_t* suffixes,const uint64_t* lcp,uint64_t nsuffixes)
+{
+    critbit_tree_t* cbt = critbit_create();
+    critbit_build_from_sorted(cbt,T,n,suffixes,lcp,nsuffixes);
+    return cbt;
+}
+
+/* like critbit_create_from_sorted, but replaces the content of cbt */
+void
+critbit_build_from_sorted(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint64_t* suffixes,const uint64_t* lcp,uint64_t nsuffixes)
+{
+    uint64_t* crit = (uint64_t*) malloc(nsuffixes*sizeof(uint64_t));
+    if (!crit) {
+        fprintf(stderr, "error mallocing crit bit memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t i=1; i<nsuffixes; i++) {
+        uint64_t j = suffixes[i-1];
+        uint64_t k = suffixes[i];
+        /* a suffix that ended compares as 0 bytes */
+        crit[i] = sbmatch_critbit(T,n,j,k,lcp ? lcp[i] : 0);
+    }
+    critbit_build_from_critbits(cbt,suffixes,crit,nsuffixes);
+    free(crit);
+}
+
+/* bulk load the suffixes given in lexicographical order. crit[i] is the crit
+   bit position of suffixes[i-1] and suffixes[i] (crit[0] is not used).
+
+   the tree is the cartesian tree of the crit bits: the smallest one is the root,
+   the suffixes left and right of it form the subtrees. we build it in one sweep
+   keeping the right-most path on a stack. no text is accessed */
+critbit_tree_t*
+critbit_create_from_critbits(const uint64_t* suffixes,const uint64_t* crit,uint64_t nsuffixes)
+{
+    critbit_tree_t* cbt = critbit_create();
+    critbit_build_from_critbits(cbt,suffixes,crit,nsuffixes);
+    return cbt;
+}
+
+/* like critbit_create_from_critbits, but replaces the content of cbt. the
+   nodes of the previous content are reused */
+void
+critbit_build_from_critbits(critbit_tree_t* cbt,const uint64_t* suffixes,const uint64_t* crit,uint64_t nsuffixes)
+{
+    critbit_clear(cbt);
+    if (nsuffixes == 0) return;
+
+    critbit_node_t** stack = (critbit_node_t**) malloc(nsuffixes*sizeof(critbit_node_t*));
+    if (!stack) {
+        fprintf(stderr, "error mallocing critbit stack memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t top = 0;
+    critbit_node_t* last = CRITBIT_SETSUFFIX(suffixes[0]);
+    for (uint64_t i=1; i<nsuffixes; i++) {
+        critbit_node_t* cbn = critbit_new_node(cbt);
+        cbn->crit_bit_pos = crit[i];
+
+        /* nodes with a larger crit bit end up in the left subtree of the new node */
+        critbit_node_t* child = last;
+        while (top && stack[top-1]->crit_bit_pos > cbn->crit_bit_pos) {
+            stack[top-1]->child[CRITBIT_RIGHTCHILD] = child;
+            child = stack[--top];
+        }
+        cbn->child[CRITBIT_LEFTCHILD] = child;
+        stack[top++] = cbn;
+        last = CRITBIT_SETSUFFIX(suffixes[i]);
+    }
+    /* close the right-most path */
+    while (top) {
+        stack[top-1]->child[CRITBIT_RIGHTCHILD] = last;
+        last = stack[--top];
+    }
+    free(stack);
+
+    cbt->root = last;
+    cbt->g = nsuffixes;
+}
+
+/* clears all data from the critbit tree. the nodes are not freed one by one,
+   the arena is rewound and its chunks are reused by the next inserts */
 void
 critbit_clear(critbit_tree_t* cbt)
 {
-    /* post order traverse */
-    if (cbt->root) critbit_delete_nodes(cbt->root);
+    cbt->arena.cur = 0;
+    cbt->arena.used = 0;
+    cbt->arena.freelist = NULL;
     cbt->root = NULL;
+    cbt->g = 0;
 }
 
 /* clears all data from the critbit tree and deletes the tree */
 void
 critbit_free(critbit_tree_t* cbt)
 {
-    /* post order traverse */
-    if (cbt->root) critbit_delete_nodes(cbt->root);
+    for (uint64_t i=0; i<cbt->arena.nchunks; i++) free(cbt->arena.chunks[i]);
+    free(cbt->arena.chunks);
+    free(cbt->stack);
     free(cbt);
 }
 
-void
-critbit_delete_nodes(critbit_node_t* node)
+/* returns an uninitialized node from the arena of the tree. nodes of deleted
+   suffixes are reused first */
+critbit_node_t*
+critbit_new_node(critbit_tree_t* cbt)
 {
-    if (! CRITBIT_ISLEAF(node)) {
-        critbit_delete_nodes(node->child[CRITBIT_LEFTCHILD]);
-        critbit_delete_nodes(node->child[CRITBIT_RIGHTCHILD]);
-        free(node);
+    critbit_arena_t* a = &cbt->arena;
+    if (a->freelist) {
+        critbit_node_t* cbn = a->freelist;
+        a->freelist = cbn->child[0];
+        return cbn;
+    }
+    if (a->used == CRITBIT_ARENA_CHUNK) {
+        a->cur++;
+        a->used = 0;
+    }
+    if (a->cur == a->nchunks) {
+        critbit_node_t** chunks = (critbit_node_t**) realloc(a->chunks,(a->nchunks+1)*sizeof(critbit_node_t*));
+        if (!chunks) {
+            fprintf(stderr, "error mallocing critbit arena memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        a->chunks = chunks;
+        a->chunks[a->nchunks] = (critbit_node_t*) malloc(CRITBIT_ARENA_CHUNK*sizeof(critbit_node_t));
+        if (!a->chunks[a->nchunks]) {
+            fprintf(stderr, "error mallocing critbit node memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        a->nchunks++;
     }
+    return &a->chunks[a->cur][a->used++];
 }
 
 /* returns the number of bytes used by the critbit tree.
@@ -115,23 +238,17 @@ critbit_insert_suffix(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,uint64_t s
         return;
     }
 
-    /* compare suffixes till we find the crit bit pos */
-    while (k+i < n && j+i < n) {
-        if (T[k+i] != T[j+i]) {
-            critbit_pos = CRITBIT_GETCRITBITPOS(T[k+i],T[j+i]);
-            /* remember if the bit is 0 or 1 for the direction later */
-            newdirection = CRITBIT_GETDIRECTION(T[k+i],critbit_pos);
-            break;
-        }
-        i++;
-    }
+    /* compare suffixes till we find the crit bit pos. a suffix that ended
+       compares as 0 bytes, the same way the traversal treats it */
+    uint64_t crit = sbmatch_critbit(T,n,j,k,0);
+    i = CRITBIT_GETBYTEPOS(crit);
+    critbit_pos = CRITBIT_GETBITPOS(crit);
+    /* remember if the bit is 0 or 1 for the direction later */
+    uint8_t sym_k = (k+i < n) ? T[k+i] : 0;
+    newdirection = CRITBIT_GETDIRECTION(sym_k,critbit_pos);
 
     /* create the new node */
-    critbit_node_t* cbn = (critbit_node_t*) malloc(sizeof(critbit_node_t));
-    if (!cbn) {
-        fprintf(stderr, "error mallocing critbit node memory.\n");
-        exit(EXIT_FAILURE);
-    }
+    critbit_node_t* cbn = critbit_new_node(cbt);
     /* bit pos = bytepos*8 + bit pos in the byte */
     cbn->crit_bit_pos = (i<<3) + critbit_pos;
     /* store the data again in the ptr */
@@ -209,7 +326,9 @@ critbit_delete_suffix(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,uint64_t s
             /* our siblings replaces our parent in the grandparent */
             grandparent->child[gp_direction] = parent->child[1 - direction];
         }
-        free(parent);
+        /* keep the node for the next insert */
+        parent->child[0] = cbt->arena.freelist;
+        cbt->arena.freelist = parent;
     }
 
     /* one less node */
@@ -244,11 +363,7 @@ critbit_contains(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t*
 
     /* we are at a leaf. check if the prefix matches P up to m symbols. */
     uint64_t suffixpos = CRITBIT_GETSUFFIX(cur_node);
-    uint64_t i;
-    for (i = 0; i < m && suffixpos+i < n; i++) {
-        if (T[suffixpos+i] != P[i]) return 0;
-    }
-    if (i==m) return 1;
+    if (m <= n-suffixpos && sbmatch_lcp(T+suffixpos,P,m) == m) return 1;
     return 0;
 }
 
@@ -261,14 +376,29 @@ critbit_intcmp(const void* a,const void* b)
     return ua - ub;
 }
 
-/* returns all suffix positions matching the prefix P of length m. */
-uint64_t
-critbit_suffixes(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t* P,uint64_t m,uint64_t** results)
+/* makes sure the traversal stack of the tree holds at least size entries */
+static void
+critbit_reserve_stack(critbit_tree_t* cbt,uint64_t size)
 {
-    if (!cbt->root) return 0;
+    if (cbt->stack_size >= size) return;
+    free(cbt->stack);
+    cbt->stack_size = size;
+    cbt->stack = (uint64_t*) malloc(cbt->stack_size*sizeof(uint64_t));
+    if (!cbt->stack) {
+        fprintf(stderr, "error mallocing critbit stack memory.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* returns the highest node of the tree whose suffixes are all prefixed by P
+   or NULL if no suffix is prefixed by P */
+static critbit_node_t*
+critbit_locus(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t* P,uint64_t m)
+{
+    if (!cbt->root) return NULL;
 
     critbit_node_t* cur_node = cbt->root;
-    critbit_node_t* locus = NULL;
+    critbit_node_t* locus = cbt->root;
     uint8_t direction; /* direction parent -> current node */
     while (! CRITBIT_ISLEAF(cur_node)) {
         /* traverse till we find a leaf */
@@ -296,11 +426,16 @@ critbit_suffixes(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t*
 
     /* we are at a leaf. check if the prefix matches P up to m symbols. */
     uint64_t suffixpos = CRITBIT_GETSUFFIX(cur_node);
-    uint64_t i;
-    for (i = 0; i < m && suffixpos+i < n; i++) {
-        if (T[suffixpos+i] != P[i]) return 0;
-    }
-    if (i==m) {
+    if (m <= n-suffixpos && sbmatch_lcp(T+suffixpos,P,m) == m) return locus;
+    return NULL;
+}
+
+/* returns all suffix positions matching the prefix P of length m. */
+uint64_t
+critbit_suffixes(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t* P,uint64_t m,uint64_t** results)
+{
+    critbit_node_t* locus = critbit_locus(cbt,T,n,P,m);
+    if (locus) {
         /* the prefix matched. now traverse all the children of the locus */
         uint64_t nresults = 0;
         uint64_t res_size = 512;
@@ -330,6 +465,50 @@ critbit_suffixes(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t*
     return 0;
 }
 
+/* writes at most limit suffixes prefixed by P into results and returns
+   their number. with CRITBIT_ORDER_LEX these are the lexicographically
+   smallest ones in lexicographical order: the leaves below the locus are
+   visited left to right and the walk stops after limit leaves. with
+   CRITBIT_ORDER_POS these are the smallest positions in ascending order,
+   which needs all leaves below the locus but only a heap of limit entries
+   instead of the whole result set */
+uint64_t
+critbit_suffixes_limit(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t* P,uint64_t m,
+                       uint64_t limit,uint64_t order,uint64_t* results)
+{
+    critbit_node_t* locus = critbit_locus(cbt,T,n,P,m);
+    if (!locus || limit == 0) return 0;
+
+    /* the stack holds the right children still to visit. the depth of the
+       tree is below g */
+    critbit_reserve_stack(cbt,cbt->g);
+    uint64_t* stack = cbt->stack;
+    uint64_t top = 0;
+    uint64_t nresults = 0;
+    stack[top++] = (uint64_t) locus;
+    while (top) {
+        critbit_node_t* node = (critbit_node_t*) stack[--top];
+        while (! CRITBIT_ISLEAF(node)) {
+            stack[top++] = (uint64_t) node->child[CRITBIT_RIGHTCHILD];
+            node = node->child[CRITBIT_LEFTCHILD];
+        }
+        uint64_t suffix = CRITBIT_GETSUFFIX(node);
+        if (order == CRITBIT_ORDER_LEX) {
+            results[nresults++] = suffix;
+            if (nresults == limit) break;
+        } else if (nresults < limit) {
+            results[nresults++] = suffix;
+            std::push_heap(results,results+nresults);
+        } else if (suffix < results[0]) {
+            std::pop_heap(results,results+nresults);
+            results[nresults-1] = suffix;
+            std::push_heap(results,results+nresults);
+        }
+    }
+    if (order != CRITBIT_ORDER_LEX) std::sort_heap(results,results+nresults);
+    return nresults;
+}
+
 void
 critbit_collectsuffixes(critbit_node_t* node,uint64_t** results,uint64_t* nresults,uint64_t* res_size)
 {
@@ -349,7 +528,7 @@ critbit_addresult(uint64_t** results,uint64_t* nresults,uint64_t* res_size,uint6
 {
     if (*nresults == *res_size) {
         *res_size = *res_size * 2;
-        *results = (uint64_t*) realloc(*results,*res_size);
+        *results = (uint64_t*) realloc(*results,*res_size*sizeof(uint64_t));
         if (*results == NULL) {
             fprintf(stderr, "error reallocing critbit result set memory.\n");
             exit(EXIT_FAILURE);
@@ -405,101 +584,228 @@ critbit_print_tex_node(critbit_node_t* node)
     }
 }
 
-void
-critbit_create_bp(critbit_node_t* node,bit_vector& bp,uint64_t* pos)
+/* number of bits needed to store x. 0 needs one bit */
+static uint64_t
+critbit_width(uint64_t x)
 {
-    bp[*pos] = 1; (*pos)++;
-    if (! CRITBIT_ISLEAF(node)) {
-        critbit_create_bp(node->child[CRITBIT_LEFTCHILD],bp,pos);
-        critbit_create_bp(node->child[CRITBIT_RIGHTCHILD],bp,pos);
-    }
-    bp[*pos] = 0; (*pos)++;
+    return x ? bit_magic::l1BP(x)+1 : 1;
 }
 
-/* we difference encode the positions here to get smaller numbers */
-void
-critbit_create_posarray(critbit_node_t* node,int_vector<>& pos,uint64_t* p,uint64_t parentpos)
+/* walks the tree once in preorder using the stack of the tree instead of
+   recursion, so degenerated trees of repetitive texts are no problem.
+
+   if bp is NULL only the largest pos delta and suffix are collected. otherwise
+   the bp sequence, the difference encoded crit bit positions and the suffixes
+   are written into the zeroed bit array bp, the latter two starting at the bit
+   offsets pos and suffixes */
+static void
+critbit_traverse(critbit_tree_t* cbt,uint64_t* bp,uint64_t pos,uint64_t pos_width,uint64_t suffixes,
+                 uint64_t suffix_width,uint64_t suffix_base,uint64_t* max_pos,uint64_t* max_suffix)
 {
-    if (! CRITBIT_ISLEAF(node)) {
-        pos[*p] = node->crit_bit_pos - parentpos; (*p)++;
-        critbit_create_posarray(node->child[CRITBIT_LEFTCHILD],pos,p,node->crit_bit_pos);
-        critbit_create_posarray(node->child[CRITBIT_RIGHTCHILD],pos,p,node->crit_bit_pos);
+    /* the stack holds (node,crit bit pos of the parent) pairs. a parent pos of
+       UINT64_MAX marks the closing parenthesis of an internal node. every
+       ancestor leaves at most its marker and its right child on the stack */
+    critbit_reserve_stack(cbt,4*cbt->g);
+    uint64_t* stack = cbt->stack;
+    uint64_t top = 0;
+    uint64_t b = 0, p = 0, s = 0;
+    stack[0] = (uint64_t) cbt->root;
+    stack[1] = 0;
+    top = 1;
+    while (top) {
+        top--;
+        critbit_node_t* node = (critbit_node_t*) stack[2*top];
+        uint64_t parent_pos = stack[2*top+1];
+        if (parent_pos == UINT64_MAX) {
+            /* the 0 of the closing parenthesis is already there */
+            b++;
+            continue;
+        }
+        if (bp) bp[b>>6] |= 1ULL << (b&63);
+        b++;
+        if (CRITBIT_ISLEAF(node)) {
+            uint64_t suffix = CRITBIT_GETSUFFIX(node);
+            if (bp) {
+                uint64_t i = suffixes + s*suffix_width;
+                bit_magic::write_int(bp+(i>>6),suffix-suffix_base,i&0x3F,suffix_width);
+            } else if (suffix > *max_suffix) {
+                *max_suffix = suffix;
+            }
+            s++;
+            b++;
+        } else {
+            /* we difference encode the positions here to get smaller numbers */
+            uint64_t delta = node->crit_bit_pos - parent_pos;
+            if (bp) {
+                uint64_t i = pos + p*pos_width;
+                bit_magic::write_int(bp+(i>>6),delta,i&0x3F,pos_width);
+            } else if (delta > *max_pos) {
+                *max_pos = delta;
+            }
+            p++;
+            stack[2*top] = (uint64_t) node;
+            stack[2*top+1] = UINT64_MAX;
+            stack[2*top+2] = (uint64_t) node->child[CRITBIT_RIGHTCHILD];
+            stack[2*top+3] = node->crit_bit_pos;
+            stack[2*top+4] = (uint64_t) node->child[CRITBIT_LEFTCHILD];
+            stack[2*top+5] = node->crit_bit_pos;
+            top += 3;
+        }
     }
 }
 
-void
-critbit_create_suffixarray(critbit_node_t* node,int_vector<>& suffixes,uint64_t* p)
+/* lowest excess reached after 1..8 bits of a byte of bp and the excess of
+   the whole byte. bit 0 of the byte comes first */
+static int8_t critbit_byte_min[256];
+static int8_t critbit_byte_excess[256];
+
+static int
+critbit_byte_tables()
 {
-    if (! CRITBIT_ISLEAF(node)) {
-        critbit_create_suffixarray(node->child[CRITBIT_LEFTCHILD],suffixes,p);
-        critbit_create_suffixarray(node->child[CRITBIT_RIGHTCHILD],suffixes,p);
-    } else {
-        suffixes[*p] = CRITBIT_GETSUFFIX(node); (*p)++;
+    for (int v=0; v<256; v++) {
+        int e = 0, lo = 8;
+        for (int b=0; b<8; b++) {
+            e += ((v>>b)&1) ? 1 : -1;
+            lo = std::min(lo,e);
+        }
+        critbit_byte_min[v] = lo;
+        critbit_byte_excess[v] = e;
     }
+    return 1;
 }
+static int critbit_byte_ready = critbit_byte_tables();
 
+/* number of CRITBIT_DIR_BLOCK bit blocks the directory of a tree with g
+   suffixes covers. a bp of a single block is scanned without one */
+static uint64_t
+critbit_dir_blocks(uint64_t g)
+{
+    uint64_t bits = g ? (g+g-1)*2 : 0;
+    if (bits <= CRITBIT_DIR_BLOCK) return 0;
+    return (bits+CRITBIT_DIR_BLOCK-1)/CRITBIT_DIR_BLOCK;
+}
+
+/* returns the number of words of the excess directory of a tree with g
+   suffixes. the directory is a range min max tree over the bp:
+
+	[blocks words. excess before the block | lowest excess in the block<<32]
+	[32 bit lowest excess of every range min tree node, level by level bottom up]
 
+   where the excess before bp position i is the number of open minus close
+   parens in [0,i). a level has one node per CRITBIT_DIR_FANOUT nodes of the
+   level below, the top level has one. with it the excess at any position is
+   one word plus a popcount of at most a block, and the close paren of a node
+   is found by scanning at most two blocks and a path of the range min tree */
 uint64_t
-critbit_write(critbit_tree_t* cbt,FILE* out)
+critbit_dir_words(uint64_t g)
 {
-    fprintf(stderr, "g = %Lu\n", cbt->g);
-
-    /* create the bp sequence of 2g bits */
-    bit_vector bp((cbt->g+cbt->g-1)*2);
-    uint64_t p = 0;
-    critbit_create_bp(cbt->root,bp,&p);
-    if (p != (cbt->g+cbt->g-1)*2) {
-        fprintf(stderr, "ERROR creating bp sequence (%lu,%lu)\n",p,cbt->g*2);
+    uint64_t blocks = critbit_dir_blocks(g);
+    uint64_t upper = 0;
+    for (uint64_t s=blocks; s > 1; ) {
+        s = (s+CRITBIT_DIR_FANOUT-1)/CRITBIT_DIR_FANOUT;
+        upper += s;
     }
+    return blocks + (upper+1)/2;
+}
 
-    /* create pos array */
-    int_vector<> pos(cbt->g-1);
-    p = 0;
-    critbit_create_posarray(cbt->root,pos,&p,0);
-    if (p != cbt->g-1) {
-        fprintf(stderr, "ERROR creating pos array sequence (%lu,%lu)\n",p,cbt->g-1);
+/* writes the excess directory of the bits bp bits of bp into dir */
+static void
+critbit_dir_build(uint64_t* dir,const uint64_t* bp,uint64_t bits)
+{
+    uint64_t blocks = (bits > CRITBIT_DIR_BLOCK) ? (bits+CRITBIT_DIR_BLOCK-1)/CRITBIT_DIR_BLOCK : 0;
+    if (!blocks) return;
+    uint64_t e = 0;
+    for (uint64_t k=0; k<blocks; k++) {
+        uint64_t start = e, lo = UINT64_MAX;
+        uint64_t end = std::min((k+1)*CRITBIT_DIR_BLOCK,bits);
+        for (uint64_t i=k*CRITBIT_DIR_BLOCK; i<end; i++) {
+            if ((bp[i>>6]>>(i&0x3F))&1) e++;
+            else e--;
+            lo = std::min(lo,e);
+        }
+        dir[k] = start | (lo<<32);
     }
 
-    /* create suffixes array */
-    int_vector<> suffixes(cbt->g);
-    p = 0;
-    critbit_create_suffixarray(cbt->root,suffixes,&p);
-    if (p != cbt->g) {
-        fprintf(stderr, "ERROR creating suffix array sequence (%lu,%lu)\n",p,cbt->g);
+    /* the levels of the range min tree */
+    uint32_t* up = (uint32_t*) (dir + blocks);
+    uint64_t size = blocks;
+    uint32_t* below = NULL;
+    while (size > 1) {
+        uint64_t next = (size+CRITBIT_DIR_FANOUT-1)/CRITBIT_DIR_FANOUT;
+        for (uint64_t j=0; j<next; j++) {
+            uint32_t lo = UINT32_MAX;
+            for (uint64_t c=j*CRITBIT_DIR_FANOUT; c<std::min((j+1)*CRITBIT_DIR_FANOUT,size); c++) {
+                lo = std::min(lo,below ? below[c] : (uint32_t)(dir[c]>>32));
+            }
+            up[j] = lo;
+        }
+        below = up;
+        up += next;
+        size = next;
     }
+}
 
-    uint64_t written = 0;
-    /* write g */
-    written += fwrite(&cbt->g,1,sizeof(uint64_t),out);
-
-    /* compress */
-    util::bit_compress(pos);
-    util::bit_compress(suffixes);
-
-    /* write len of data */
-    uint64_t pos_width = pos.get_int_width();
-    uint64_t suffix_width = suffixes.get_int_width();
-    written += fwrite(&pos_width,1,sizeof(uint64_t),out);
-    written += fwrite(&suffix_width,1,sizeof(uint64_t),out);
-
-    fprintf(stderr, "critbit::write: bit_pos_in_byte %lu\n",pos_width);
-    fprintf(stderr, "critbit::write: suffix_in_byte %lu\n",suffix_width);
+/* returns the number of bytes critbit_serialize writes for g suffixes */
+uint64_t
+critbit_serialized_size(uint64_t g,uint64_t pos_width,uint64_t suffix_width,uint64_t suffix_base)
+{
+    uint64_t bp_bits = g ? (g+g-1)*2 : 0;
+    uint64_t npos = g ? g-1 : 0;
+    uint64_t bits = bp_bits + npos*pos_width + g*suffix_width;
+    return (1 + (suffix_base != 0) + critbit_dir_words(g) + ((bits+63)>>6))*sizeof(uint64_t);
+}
 
-    /* write bp */
-    const uint64_t* bp_data = bp.data();
-    uint64_t data_len = bp.capacity()>>3; /* convert bits to byte */
-    written += fwrite(bp_data,1,data_len,out);
+/* serializes the tree into the size byte buffer mem using the given widths,
+   which must hold every crit bit position delta and suffix. the rest of the
+   buffer is zeroed. returns the number of bytes used or 0 if the tree does not
+   fit. the layout is
 
-    /* write pos array */
-    const uint64_t* pos_data = pos.data();
-    data_len = pos.capacity()>>3; /* convert bits to byte */
-    written += fwrite(pos_data,1,data_len,out);
+   [g|pos_width|suffix_width|has base][suffix_base][dir][bp][pos][suffixes]
 
-    /* write suffixes */
-    const uint64_t* suffix_data = suffixes.data();
-    data_len = suffixes.capacity()>>3; /* convert bits to byte */
-    written += fwrite(suffix_data,1,data_len,out);
+   with the counts packed into the first word (see CRITBIT_HEADER), the excess
+   directory of bp (see critbit_dir_words) and the bit arrays bp, pos and
+   suffixes following each other without padding. the
+   suffixes are stored relative to suffix_base (frame of reference), which is
+   only written if it is not 0. pos widths must be below 256, suffix widths
+   below 128 */
+uint64_t
+critbit_serialize(critbit_tree_t* cbt,uint64_t pos_width,uint64_t suffix_width,uint64_t suffix_base,
+                  uint64_t* mem,uint64_t size)
+{
+    uint64_t bytes = critbit_serialized_size(cbt->g,pos_width,suffix_width,suffix_base);
+    if (bytes > size) return 0;
+    memset(mem,0,size);
+
+    mem[0] = CRITBIT_HEADER(cbt->g,pos_width,suffix_width,suffix_base);
+    if (suffix_base) *(++mem) = suffix_base;
+    if (cbt->g == 0) return bytes;
+    uint64_t pos = (cbt->g+cbt->g-1)*2;
+    uint64_t suffixes = pos + (cbt->g-1)*pos_width;
+    uint64_t* dir = mem+1;
+    uint64_t* bp = dir + critbit_dir_words(cbt->g);
+    critbit_traverse(cbt,bp,pos,pos_width,suffixes,suffix_width,suffix_base,NULL,NULL);
+    critbit_dir_build(dir,bp,pos);
+    return bytes;
+}
 
+/* writes the tree with the smallest widths that hold its positions and suffixes */
+uint64_t
+critbit_write(critbit_tree_t* cbt,FILE* out)
+{
+    uint64_t max_pos = 0, max_suffix = 0;
+    if (cbt->g) critbit_traverse(cbt,NULL,0,0,0,0,0,&max_pos,&max_suffix);
+    uint64_t pos_width = critbit_width(max_pos);
+    uint64_t suffix_width = critbit_width(max_suffix);
+
+    uint64_t size = critbit_serialized_size(cbt->g,pos_width,suffix_width,0);
+    uint64_t* mem = (uint64_t*) malloc(size);
+    if (!mem) {
+        fprintf(stderr, "error mallocing critbit serialization memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    critbit_serialize(cbt,pos_width,suffix_width,0,mem,size);
+    uint64_t written = fwrite(mem,1,size,out);
+    free(mem);
     return written;
 }
 
@@ -510,6 +816,13 @@ critbit_getelem(const uint64_t* mem,uint64_t idx,uint64_t width)
     return bit_magic::read_int(mem+(i>>6), i&0x3F, width);
 }
 
+/* reads width bits starting at bit offset bit of mem */
+uint64_t
+critbit_getbits(const uint64_t* mem,uint64_t bit,uint64_t width)
+{
+    return bit_magic::read_int(mem+(bit>>6), bit&0x3F, width);
+}
+
 
 /* reconstructs the tree from memory */
 critbit_tree_t*
@@ -518,26 +831,22 @@ critbit_load_from_mem(uint64_t* mem,uint64_t size)
     critbit_tree_t* cbt = critbit_create();
 
     /* calc starting positions of all data elements */
-    cbt->g = mem[0];
-    uint64_t pos_width = mem[1];
-    uint64_t suffix_width = mem[2];
-    uint64_t* bp = &mem[3];
-    uint64_t pos_offset = 3 + ((((cbt->g+cbt->g-1)*2)+63)>>6);
-    uint64_t* pos = &mem[pos_offset];
-    uint64_t pos_len_in_u64 = ((cbt->g * pos_width)+63)>>6;
-    uint64_t suffix_offset = pos_offset + pos_len_in_u64;
-    uint64_t* suffixes = &mem[suffix_offset];
+    critbit_mem_t cbm;
+    critbit_mem_init(&cbm,mem);
+    cbt->g = cbm.g;
+    uint64_t pos_width = cbm.pos_width;
+    uint64_t suffix_width = cbm.suffix_width;
+    uint64_t suffix_base = cbm.suffix_base;
+    const uint64_t* bp = cbm.bp;
+    uint64_t pos = cbm.pos_bit;
+    uint64_t suffixes = cbm.suffix_bit;
 
     /* reconstruct the tree */
     std::stack<critbit_node_t*> stack;
 
     /* add root to the tree */
-    critbit_node_t* cbn = (critbit_node_t*) malloc(sizeof(critbit_node_t));
-    if (!cbn) {
-        fprintf(stderr, "error mallocing critbit node memory.\n");
-        exit(EXIT_FAILURE);
-    }
-    cbn->crit_bit_pos = critbit_getelem(pos,0,pos_width);
+    critbit_node_t* cbn = critbit_new_node(cbt);
+    cbn->crit_bit_pos = critbit_getbits(bp,pos,pos_width);
     cbn->child[CRITBIT_LEFTCHILD] = NULL;
     cbn->child[CRITBIT_RIGHTCHILD] = NULL;
     stack.push(cbn);
@@ -555,20 +864,16 @@ critbit_load_from_mem(uint64_t* mem,uint64_t size)
             /* add suffix leaf to current top node of stack */
             cbn = stack.top();
             if (cbn->child[CRITBIT_LEFTCHILD] == NULL)
-                cbn->child[CRITBIT_LEFTCHILD] = CRITBIT_SETSUFFIX(critbit_getelem(suffixes,cursuffix,suffix_width));
+                cbn->child[CRITBIT_LEFTCHILD] = CRITBIT_SETSUFFIX(suffix_base+critbit_getbits(bp,suffixes+cursuffix*suffix_width,suffix_width));
             else
-                cbn->child[CRITBIT_RIGHTCHILD] = CRITBIT_SETSUFFIX(critbit_getelem(suffixes,cursuffix,suffix_width));
+                cbn->child[CRITBIT_RIGHTCHILD] = CRITBIT_SETSUFFIX(suffix_base+critbit_getbits(bp,suffixes+cursuffix*suffix_width,suffix_width));
             cursuffix++;
             i+=2;
             continue;
         }
         if (critbit_getelem(bp,i,1) == 1 && critbit_getelem(bp,i+1,1) == 1) {
             /* add new node on the stack */
-            cbn = (critbit_node_t*) malloc(sizeof(critbit_node_t));
-            if (!cbn) {
-                fprintf(stderr, "error mallocing critbit node memory.\n");
-                exit(EXIT_FAILURE);
-            }
+            cbn = critbit_new_node(cbt);
             /* link to the parent */
             parent = stack.top();
             if (parent->child[CRITBIT_LEFTCHILD] == NULL) parent->child[CRITBIT_LEFTCHILD] = cbn;
@@ -576,7 +881,7 @@ critbit_load_from_mem(uint64_t* mem,uint64_t size)
 
             /* get data */
             /* we difference encoded the numbers so we have to undo this here */
-            cbn->crit_bit_pos = parent->crit_bit_pos + critbit_getelem(pos,curpos,pos_width);
+            cbn->crit_bit_pos = parent->crit_bit_pos + critbit_getbits(bp,pos+curpos*pos_width,pos_width);
             cbn->child[CRITBIT_LEFTCHILD] = NULL;
             cbn->child[CRITBIT_RIGHTCHILD] = NULL;
             stack.push(cbn);
@@ -593,3 +898,330 @@ critbit_load_from_mem(uint64_t* mem,uint64_t size)
     }
     return cbt;
 }
+
+
+/* the serialized tree is laid out as written by critbit_write:
+
+	[g|pos_width|suffix_width|has base][suffix_base][dir][bp bits][pos array][suffix array]
+
+   the three arrays are packed back to back behind the header words and the
+   excess directory. */
+void
+critbit_mem_init(critbit_mem_t* cbm,const uint64_t* mem)
+{
+    cbm->g = CRITBIT_HEADER_G(mem[0]);
+    cbm->pos_width = CRITBIT_HEADER_POS_WIDTH(mem[0]);
+    cbm->suffix_width = CRITBIT_HEADER_SUFFIX_WIDTH(mem[0]);
+    cbm->suffix_base = CRITBIT_HEADER_HAS_BASE(mem[0]) ? mem[1] : 0;
+    cbm->dir = &mem[1 + CRITBIT_HEADER_HAS_BASE(mem[0])];
+    cbm->dir_blocks = critbit_dir_blocks(cbm->g);
+    cbm->bp = cbm->dir + critbit_dir_words(cbm->g);
+    cbm->pos_bit = cbm->g ? (cbm->g+cbm->g-1)*2 : 0;
+    cbm->suffix_bit = cbm->pos_bit + (cbm->g ? cbm->g-1 : 0)*cbm->pos_width;
+}
+
+/* returns the i-th smallest suffix stored in the tree */
+uint64_t
+critbit_mem_getsuffix(const critbit_mem_t* cbm,uint64_t i)
+{
+    return cbm->suffix_base + critbit_getbits(cbm->bp,cbm->suffix_bit+i*cbm->suffix_width,cbm->suffix_width);
+}
+
+/* decodes the suffixes of rank lo to hi-1 into out. scans read whole pages,
+   so instead of extracting every entry from its one or two words we load the
+   8 bytes starting at the byte of the entry and shift. this needs no branch
+   and works for widths up to 57 bits. entries whose 8 bytes would reach past
+   the suffix array fall back to getbits */
+void
+critbit_mem_getsuffixes(const critbit_mem_t* cbm,uint64_t lo,uint64_t hi,uint64_t* out)
+{
+    uint64_t width = cbm->suffix_width;
+    uint64_t base = cbm->suffix_base;
+    uint64_t bit = cbm->suffix_bit + lo*width;
+    uint64_t fast = hi;
+    if (width > 57) {
+        fast = lo;
+    } else {
+        /* the arrays end at a word boundary */
+        uint64_t end = ((cbm->suffix_bit + cbm->g*width + 63)>>6)*64;
+        if (end < 64 + cbm->suffix_bit) {
+            fast = lo;
+        } else if (end < 64 + cbm->suffix_bit + hi*width) {
+            fast = (end - 64 - cbm->suffix_bit)/width;
+            fast = std::max(lo,std::min(fast,hi));
+        }
+    }
+    const uint8_t* bytes = (const uint8_t*) cbm->bp;
+    uint64_t mask = (width == 64) ? UINT64_MAX : (1ULL<<width)-1;
+    uint64_t i = lo;
+    for (; i < fast; i++, bit += width) {
+        uint64_t word;
+        memcpy(&word,bytes+(bit>>3),sizeof(uint64_t));
+        out[i-lo] = base + ((word >> (bit&7)) & mask);
+    }
+    for (; i < hi; i++, bit += width) {
+        out[i-lo] = base + critbit_getbits(cbm->bp,bit,width);
+    }
+}
+
+#define CRITBIT_MEM_BIT(bp,i)     (((bp)[(i)>>6]>>((i)&0x3F))&1)
+#define CRITBIT_MEM_ISLEAF(bp,i)  (CRITBIT_MEM_BIT(bp,(i)+1) == 0)
+
+/* returns the excess before bp position i: the depth of the node whose
+   paren is at i */
+uint64_t
+critbit_mem_excess(const critbit_mem_t* cbm,uint64_t i)
+{
+    uint64_t k = cbm->dir_blocks ? i/CRITBIT_DIR_BLOCK : 0;
+    uint64_t x = k*CRITBIT_DIR_BLOCK;
+    uint64_t ones = 0;
+    for (; x+64 <= i; x += 64) ones += __builtin_popcountll(cbm->bp[x>>6]);
+    if (x < i) ones += __builtin_popcountll(cbm->bp[x>>6] & ((1ULL<<(i-x))-1));
+    uint64_t start = cbm->dir_blocks ? (uint32_t)cbm->dir[k] : 0;
+    return start + 2*ones - (i - k*CRITBIT_DIR_BLOCK);
+}
+
+/* scans the bp from position x with excess e before it till the excess drops
+   to target or end is reached. whole bytes are skipped with the byte tables.
+   returns the position of the paren reaching target or UINT64_MAX */
+static uint64_t
+critbit_mem_scan(const uint64_t* bp,uint64_t x,uint64_t end,int64_t e,int64_t target)
+{
+    while (x < end) {
+        if (!(x&7) && x+8 <= end) {
+            uint8_t v = (bp[x>>6]>>(x&0x3F)) & 0xFF;
+            if (e + critbit_byte_min[v] > target) {
+                e += critbit_byte_excess[v];
+                x += 8;
+                continue;
+            }
+        }
+        e += CRITBIT_MEM_BIT(bp,x) ? 1 : -1;
+        if (e == target) return x;
+        x++;
+    }
+    return UINT64_MAX;
+}
+
+/* lowest excess below node j of a level of the range min tree */
+static inline uint64_t
+critbit_mem_dirmin(const critbit_mem_t* cbm,const uint32_t* level_mins,uint64_t level,uint64_t j)
+{
+    return level ? level_mins[j] : (cbm->dir[j]>>32);
+}
+
+/* first block after block k with an excess of at most target. walks up the
+   range min tree till a right sibling reaches target and down to its left
+   most block doing so */
+static uint64_t
+critbit_mem_nextblock(const critbit_mem_t* cbm,uint64_t k,uint64_t target)
+{
+    const uint32_t* up = (const uint32_t*) (cbm->dir + cbm->dir_blocks);
+    uint64_t offset[CRITBIT_DIR_MAXLEVELS];
+    uint64_t size[CRITBIT_DIR_MAXLEVELS];
+    uint64_t level = 0, node = k;
+    offset[0] = 0;
+    size[0] = cbm->dir_blocks;
+    while (1) {
+        uint64_t end = std::min((node/CRITBIT_DIR_FANOUT+1)*CRITBIT_DIR_FANOUT,size[level]);
+        for (uint64_t j=node+1; j<end; j++) {
+            if (critbit_mem_dirmin(cbm,up+offset[level],level,j) > target) continue;
+            while (level) {
+                level--;
+                j *= CRITBIT_DIR_FANOUT;
+                while (critbit_mem_dirmin(cbm,up+offset[level],level,j) > target) j++;
+            }
+            return j;
+        }
+        if (size[level] <= 1 || level+1 == CRITBIT_DIR_MAXLEVELS) {
+            fprintf(stderr, "critbit bp is not balanced.\n");
+            exit(EXIT_FAILURE);
+        }
+        offset[level+1] = level ? offset[level]+size[level] : 0;
+        size[level+1] = (size[level]+CRITBIT_DIR_FANOUT-1)/CRITBIT_DIR_FANOUT;
+        node /= CRITBIT_DIR_FANOUT;
+        level++;
+    }
+}
+
+/* returns the position of the close paren matching the open paren at i */
+uint64_t
+critbit_mem_findclose(const critbit_mem_t* cbm,uint64_t i)
+{
+    int64_t target = critbit_mem_excess(cbm,i);
+    uint64_t bits = (cbm->g+cbm->g-1)*2;
+    if (!cbm->dir_blocks) return critbit_mem_scan(cbm->bp,i+1,bits,target+1,target);
+
+    /* the rest of the block of i */
+    uint64_t k = i/CRITBIT_DIR_BLOCK;
+    uint64_t end = std::min((k+1)*CRITBIT_DIR_BLOCK,bits);
+    uint64_t close = critbit_mem_scan(cbm->bp,i+1,end,target+1,target);
+    if (close != UINT64_MAX) return close;
+
+    /* the first block reaching the excess holds the close paren */
+    k = critbit_mem_nextblock(cbm,k,target);
+    end = std::min((k+1)*CRITBIT_DIR_BLOCK,bits);
+    return critbit_mem_scan(cbm->bp,k*CRITBIT_DIR_BLOCK,end,(uint32_t)cbm->dir[k],target);
+}
+
+/* skip the subtree whose open paren is at bp position i.
+   returns the bp position following the matching close paren and adds
+   the number of leaves and internal nodes of the subtree to the counters.
+   every internal node has two children, so a subtree of k nodes has
+   (k+1)/2 leaves and the counts follow from the position of the close paren */
+static uint64_t
+critbit_mem_skip(const critbit_mem_t* cbm,uint64_t i,uint64_t* leaves,uint64_t* internal)
+{
+    if (CRITBIT_MEM_ISLEAF(cbm->bp,i)) {
+        (*leaves)++;
+        return i+2;
+    }
+    uint64_t close = critbit_mem_findclose(cbm,i);
+    uint64_t nodes = (close-i+1)/2;
+    *leaves += (nodes+1)/2;
+    *internal += nodes/2;
+    return close+1;
+}
+
+/* blind descent: follow the bits of P down to a leaf without looking at the text.
+   returns the rank of the candidate leaf. the candidate shares the longest prefix
+   with P of all suffixes stored in the tree. */
+uint64_t
+critbit_mem_candidate(const critbit_mem_t* cbm,const uint8_t* P,uint64_t m)
+{
+    uint64_t lcp_first, lcp_last, reach;
+    return critbit_mem_locate(cbm,P,m,&lcp_first,&lcp_last,&reach);
+}
+
+/* the blind descent of critbit_mem_candidate, which also returns what the
+   path tells about the candidate without the text: lcp_first and lcp_last are
+   lower bounds of its lcp in bytes with the first and the last leaf (the crit
+   byte of the first turn away from them, UINT64_MAX for the leaf itself).
+   reach is the number of leading bytes of P the descent looked at, so any
+   pattern sharing them with P reaches the same candidate */
+uint64_t
+critbit_mem_locate(const critbit_mem_t* cbm,const uint8_t* P,uint64_t m,
+                   uint64_t* lcp_first,uint64_t* lcp_last,uint64_t* reach)
+{
+    uint64_t i = 0;        /* bp position of the current node */
+    uint64_t p = 0;        /* preorder rank of the current internal node */
+    uint64_t leaf = 0;     /* number of leaves left of the current node */
+    uint64_t crit_bit_pos = 0;
+    *lcp_first = *lcp_last = UINT64_MAX;
+    *reach = 0;
+    while (! CRITBIT_MEM_ISLEAF(cbm->bp,i)) {
+        crit_bit_pos += critbit_getbits(cbm->bp,cbm->pos_bit+p*cbm->pos_width,cbm->pos_width);
+        p++;
+        uint64_t byte_pos = CRITBIT_GETBYTEPOS(crit_bit_pos);
+        uint8_t bit_pos_in_byte = CRITBIT_GETBITPOS(crit_bit_pos);
+        uint8_t sym = 0;
+        /* if we are past the end of P we go to the left-most child */
+        if (byte_pos < m) sym = P[byte_pos];
+        *reach = byte_pos+1;
+        i++; /* left child */
+        if (CRITBIT_GETDIRECTION(sym,bit_pos_in_byte)) {
+            i = critbit_mem_skip(cbm,i,&leaf,&p);
+            if (*lcp_first == UINT64_MAX) *lcp_first = byte_pos;
+        } else if (*lcp_last == UINT64_MAX) {
+            *lcp_last = byte_pos;
+        }
+    }
+    return leaf;
+}
+
+/* lower bound of the lcp in bytes of the leaves a and b: the crit byte of
+   their lowest common ancestor. UINT64_MAX if a == b */
+uint64_t
+critbit_mem_lcp(const critbit_mem_t* cbm,uint64_t a,uint64_t b)
+{
+    if (a == b) return UINT64_MAX;
+    if (a > b) std::swap(a,b);
+    uint64_t i = 0;
+    uint64_t p = 0;
+    uint64_t leaf = 0;
+    uint64_t crit_bit_pos = 0;
+    while (! CRITBIT_MEM_ISLEAF(cbm->bp,i)) {
+        crit_bit_pos += critbit_getbits(cbm->bp,cbm->pos_bit+p*cbm->pos_width,cbm->pos_width);
+        p++;
+        uint64_t left = 0, internal = 0;
+        uint64_t right = critbit_mem_skip(cbm,i+1,&left,&internal);
+        if (b < leaf + left) {
+            i++;
+        } else if (a >= leaf + left) {
+            i = right;
+            leaf += left;
+            p += internal;
+        } else {
+            break;
+        }
+    }
+    return CRITBIT_GETBYTEPOS(crit_bit_pos);
+}
+
+/* given the lcp of P with the candidate suffix and the symbol of the candidate
+   at position lcp (0 if the candidate ends there), determine the range [lb,rb)
+   of suffixes in the tree prefixed by P. if no suffix is prefixed by P,
+   lb = rb = number of suffixes lexicographically smaller than P. */
+void
+critbit_mem_rank(const critbit_mem_t* cbm,const uint8_t* P,uint64_t m,uint64_t lcp,uint8_t sym,uint64_t* lb,uint64_t* rb)
+{
+    uint64_t stop_pos;
+    uint8_t direction = 0;
+    if (lcp >= m) {
+        /* P is a prefix of the candidate: stop at the highest node below bit m*8 */
+        stop_pos = m<<3;
+    } else {
+        /* P branches off the candidate at the first differing bit */
+        uint8_t critbit = 7;
+        if (P[lcp] != sym) critbit = CRITBIT_GETCRITBITPOS(P[lcp],sym);
+        stop_pos = (lcp<<3) + critbit;
+        direction = (P[lcp] != sym) ? CRITBIT_GETDIRECTION(P[lcp],critbit) : 1;
+        stop_pos++;
+    }
+
+    /* walk down the path of P again till we reach the first node
+       which discriminates at or past the stop position */
+    uint64_t i = 0;
+    uint64_t p = 0;
+    uint64_t leaf = 0;
+    uint64_t crit_bit_pos = 0;
+    while (! CRITBIT_MEM_ISLEAF(cbm->bp,i)) {
+        uint64_t node_pos = crit_bit_pos + critbit_getbits(cbm->bp,cbm->pos_bit+p*cbm->pos_width,cbm->pos_width);
+        if (node_pos >= stop_pos) break;
+        crit_bit_pos = node_pos;
+        p++;
+        uint8_t sym = P[CRITBIT_GETBYTEPOS(crit_bit_pos)];
+        i++;
+        if (CRITBIT_GETDIRECTION(sym,CRITBIT_GETBITPOS(crit_bit_pos))) {
+            i = critbit_mem_skip(cbm,i,&leaf,&p);
+        }
+    }
+
+    /* all leaves below node i share the prefix up to the stop position */
+    uint64_t nleaves = 0;
+    uint64_t ninternal = 0;
+    critbit_mem_skip(cbm,i,&nleaves,&ninternal);
+    if (lcp >= m) {
+        *lb = leaf;
+        *rb = leaf + nleaves;
+    } else {
+        if (direction) leaf += nleaves;
+        *lb = *rb = leaf;
+    }
+}
+
+/* search P in a serialized tree using the text T in memory.
+   returns the number of suffixes prefixed by P. [lb,rb) is set as in critbit_mem_rank */
+uint64_t
+critbit_mem_search(const critbit_mem_t* cbm,const uint8_t* T,uint64_t n,const uint8_t* P,uint64_t m,uint64_t* lb,uint64_t* rb)
+{
+    uint64_t suffixpos = critbit_mem_getsuffix(cbm,critbit_mem_candidate(cbm,P,m));
+
+    /* compare the candidate with P */
+    uint64_t lcp = sbmatch_lcp(T+suffixpos,P,std::min(m,n-suffixpos));
+    uint8_t sym = 0;
+    if (lcp < m && suffixpos+lcp < n) sym = T[suffixpos+lcp];
+
+    critbit_mem_rank(cbm,P,m,lcp,sym,lb,rb);
+    return *rb - *lb;
+}
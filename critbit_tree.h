@@ -15,39 +15,105 @@
 #define CRITBIT_GETBITPOS(x)       ((x&7))
 #define CRITBIT_GETDIRECTION(x,y)  ((x&(1<<(7-y)))>>(7-y))
 #define CRITBIT_GETCRITBITPOS(x,y) (__builtin_clz(x^y) - ((sizeof(unsigned int) - sizeof(uint8_t))<<3))
+#define CRITBIT_ARENA_CHUNK        4096  /* nodes per arena chunk */
+#define CRITBIT_ORDER_LEX          0     /* suffixes in lexicographical order */
+#define CRITBIT_ORDER_POS          1     /* suffixes in ascending position order */
+#define CRITBIT_DIR_BLOCK          512   /* bp bits per excess directory block. multiple of 64 */
+#define CRITBIT_DIR_FANOUT         8     /* children of a node of the range min tree over the blocks */
+#define CRITBIT_DIR_MAXLEVELS      24    /* levels of the range min tree. enough for any g */
 
 typedef struct critbit_node {
     uint64_t crit_bit_pos;           /* position of the critical bit */
     struct critbit_node* child[2];   /* child pointers or data */
 } critbit_node_t;
 
+/* bump allocator the nodes of a tree are drawn from. chunks are kept until the
+   tree is freed, so clearing a tree and building the next one reuses them */
+typedef struct {
+    critbit_node_t** chunks;    /* chunks of CRITBIT_ARENA_CHUNK nodes */
+    uint64_t nchunks;           /* number of allocated chunks */
+    uint64_t cur;               /* chunk nodes are drawn from */
+    uint64_t used;              /* nodes used in the current chunk */
+    critbit_node_t* freelist;   /* deleted nodes, linked through child[0] */
+} critbit_arena_t;
+
 typedef struct {
     critbit_node_t* root;  /* pointer to the root of the tree */
     uint64_t g;            /* number of elements in the critbit tree. */
+    critbit_arena_t arena; /* memory of the internal nodes */
+    uint64_t* stack;       /* traversal stack reused by serializations */
+    uint64_t stack_size;   /* words the stack can hold */
 } critbit_tree_t;
 
+/* read-only view of a critbit tree serialized by critbit_serialize.
+   all data is accessed in place, e.g. inside a mapped disk page. */
+typedef struct {
+    uint64_t g;                 /* number of suffixes (leaves) */
+    uint64_t pos_width;         /* bits per pos array entry */
+    uint64_t suffix_width;      /* bits per suffix array entry */
+    const uint64_t* dir;        /* excess directory of bp (see critbit_dir_words) */
+    uint64_t dir_blocks;        /* number of bp blocks in dir. 0 if bp fits into one */
+    const uint64_t* bp;         /* balanced parentheses of the 2g-1 nodes */
+    uint64_t pos_bit;           /* bit offset from bp of the difference encoded crit bit positions in preorder */
+    uint64_t suffix_bit;        /* bit offset from bp of the suffixes in lexicographical order */
+    uint64_t suffix_base;       /* added to every stored suffix */
+} critbit_mem_t;
+
+/* the serialization starts with one word holding g, the two widths and a
+   flag telling whether a word with the suffix base follows */
+#define CRITBIT_HEADER_G(h)             ((h)&0xFFFFFFFFFFFFULL)
+#define CRITBIT_HEADER_POS_WIDTH(h)     (((h)>>48)&0xFF)
+#define CRITBIT_HEADER_SUFFIX_WIDTH(h)  (((h)>>56)&0x7F)
+#define CRITBIT_HEADER_HAS_BASE(h)      ((h)>>63)
+#define CRITBIT_HEADER(g,pw,sw,base)    ((g)|((uint64_t)(pw)<<48)|((uint64_t)(sw)<<56)|((uint64_t)((base)!=0)<<63))
+
 critbit_tree_t* critbit_create_from_suffixes(const uint8_t* T,uint64_t n,uint64_t* suffixes,uint64_t nsuffixes);
+critbit_tree_t* critbit_create_from_sorted(const uint8_t* T,uint64_t n,const uint64_t* suffixes,const uint64_t* lcp,uint64_t nsuffixes);
+critbit_tree_t* critbit_create_from_critbits(const uint64_t* suffixes,const uint64_t* crit,uint64_t nsuffixes);
 critbit_tree_t* critbit_create();
+void            critbit_build_from_sorted(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint64_t* suffixes,const uint64_t* lcp,uint64_t nsuffixes);
+void            critbit_build_from_critbits(critbit_tree_t* cbt,const uint64_t* suffixes,const uint64_t* crit,uint64_t nsuffixes);
 void            critbit_free(critbit_tree_t* cbt);
 void			critbit_clear(critbit_tree_t* cbt);
 void            critbit_insert_suffix(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,uint64_t suffixpos);
 uint64_t        critbit_delete_suffix(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,uint64_t suffixpos);
 uint64_t        critbit_contains(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t* P,uint64_t m);
 uint64_t		critbit_suffixes(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t* P,uint64_t m,uint64_t** results);
+uint64_t        critbit_suffixes_limit(critbit_tree_t* cbt,const uint8_t* T,uint64_t n,const uint8_t* P,uint64_t m,
+                                       uint64_t limit,uint64_t order,uint64_t* results);
 void			critbit_print(critbit_tree_t* cbt);
 void			critbit_print_tex(critbit_tree_t* cbt);
 uint64_t		critbit_getsize_in_bytes(critbit_tree_t* cbt);
 
 /* I/O functions */
 uint64_t		critbit_write(critbit_tree_t* cbt,FILE* out);
+uint64_t        critbit_serialize(critbit_tree_t* cbt,uint64_t pos_width,uint64_t suffix_width,uint64_t suffix_base,
+                                  uint64_t* mem,uint64_t size);
+uint64_t        critbit_serialized_size(uint64_t g,uint64_t pos_width,uint64_t suffix_width,uint64_t suffix_base);
 critbit_tree_t* critbit_load_from_mem(uint64_t* mem,uint64_t size);
 
+/* search functions working directly on the serialized tree */
+void            critbit_mem_init(critbit_mem_t* cbm,const uint64_t* mem);
+uint64_t        critbit_mem_getsuffix(const critbit_mem_t* cbm,uint64_t i);
+void            critbit_mem_getsuffixes(const critbit_mem_t* cbm,uint64_t lo,uint64_t hi,uint64_t* out);
+uint64_t        critbit_mem_candidate(const critbit_mem_t* cbm,const uint8_t* P,uint64_t m);
+uint64_t        critbit_mem_locate(const critbit_mem_t* cbm,const uint8_t* P,uint64_t m,
+                                   uint64_t* lcp_first,uint64_t* lcp_last,uint64_t* reach);
+uint64_t        critbit_mem_lcp(const critbit_mem_t* cbm,uint64_t a,uint64_t b);
+void            critbit_mem_rank(const critbit_mem_t* cbm,const uint8_t* P,uint64_t m,uint64_t lcp,uint8_t sym,uint64_t* lb,uint64_t* rb);
+uint64_t        critbit_mem_search(const critbit_mem_t* cbm,const uint8_t* T,uint64_t n,const uint8_t* P,uint64_t m,uint64_t* lb,uint64_t* rb);
+uint64_t        critbit_mem_excess(const critbit_mem_t* cbm,uint64_t i);
+uint64_t        critbit_mem_findclose(const critbit_mem_t* cbm,uint64_t i);
+
 /* helper functions */
-void 			critbit_delete_nodes(critbit_node_t* node);
+critbit_node_t* critbit_new_node(critbit_tree_t* cbt);
 void			critbit_print_node(critbit_node_t* node);
 void			critbit_print_tex_node(critbit_node_t* node);
 void            critbit_collectsuffixes(critbit_node_t* node,uint64_t** results,uint64_t* nresults,uint64_t* res_size);
 void            critbit_addresult(uint64_t** results,uint64_t* nresults,uint64_t* res_size,uint64_t suffix);
 int             critbit_intcmp(const void* a,const void* b);
+uint64_t        critbit_getelem(const uint64_t* mem,uint64_t idx,uint64_t width);
+uint64_t        critbit_getbits(const uint64_t* mem,uint64_t bit,uint64_t width);
+uint64_t        critbit_dir_words(uint64_t g);
 
 #endif
\ No newline at end of file
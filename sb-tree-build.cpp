@@ -2,13 +2,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "sb_tree.h"
 
 typedef struct {
     uint64_t B;
+    uint64_t budget;
+    uint64_t layout;
     const char* sa;
+    const char* store;
     const char* input;
     const char* output;
 } cmd_args_t;
@@ -16,12 +20,15 @@ typedef struct {
 void
 print_usage(const char* program)
 {
-    printf("USAGE: %s -i <input> -s <sa> -o <output.sbti> -B <disk page size>\n",program);
+    printf("USAGE: %s -i <input> -s <sa> -o <output.sbti> -B <disk page size> -m <memory> -l <layout> -z <store>\n",program);
     printf("WHERE:\n");
     printf("        -i <input>          : input file\n");
     printf("        -s <sa>             : already constructed suffix array (optional)\n");
     printf("        -o <output>         : output index file\n");
-    printf("        -B <disk page size> : disk page size in bytes\n\n");
+    printf("        -B <disk page size> : disk page size in bytes\n");
+    printf("        -m <memory>         : build the suffix array and the index without loading the text using <memory> MiB (optional)\n");
+    printf("        -l <layout>         : page order in the index file. level (default) or veb (optional)\n");
+    printf("        -z <store>          : also write the input as a block compressed text store, which can be searched instead of the input (optional)\n\n");
 }
 
 cmd_args_t
@@ -30,10 +37,12 @@ parse_args(int argc,char** argv)
     int op;
     cmd_args_t args;
 
-    args.sa = args.input = args.output = NULL;
+    args.sa = args.input = args.output = args.store = NULL;
     args.B = 0;
+    args.budget = 0;
+    args.layout = SBT_LAYOUT_LEVEL;
 
-    while ((op=getopt(argc,argv,"i:s:o:B:")) != -1) {
+    while ((op=getopt(argc,argv,"i:s:o:B:m:l:z:")) != -1) {
         switch (op) {
             case 'i':
                 args.input = optarg;
@@ -47,6 +56,20 @@ parse_args(int argc,char** argv)
             case 'B':
                 args.B = atoll(optarg);
                 break;
+            case 'm':
+                args.budget = atoll(optarg)*1024*1024;
+                break;
+            case 'z':
+                args.store = optarg;
+                break;
+            case 'l':
+                if (strcmp(optarg,"level") == 0) args.layout = SBT_LAYOUT_LEVEL;
+                else if (strcmp(optarg,"veb") == 0) args.layout = SBT_LAYOUT_VEB;
+                else {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case '?':
                 print_usage(argv[0]);
                 exit(EXIT_FAILURE);
@@ -68,8 +91,12 @@ main(int argc,char** argv)
     cmd_args_t cargs = parse_args(argc,argv);
 
     /* build */
-    if (cargs.sa != NULL) {
-        sbt = sbtree_build(cargs.sa,cargs.input,cargs.output,20,cargs.B);
+    if (cargs.budget && cargs.sa != NULL) {
+        sbt = sbtree_build_external(cargs.sa,cargs.input,cargs.output,cargs.B,cargs.budget);
+    } else if (cargs.budget) {
+        sbt = sbtree_create_external(cargs.input,cargs.output,cargs.B,cargs.budget);
+    } else if (cargs.sa != NULL) {
+        sbt = sbtree_build(cargs.sa,cargs.input,cargs.output,cargs.B);
     } else {
         sbt = sbtree_create(cargs.input,cargs.output,cargs.B);
     }
@@ -77,5 +104,10 @@ main(int argc,char** argv)
     /* free the index */
     sbtree_free(sbt);
 
+    /* the pages are written level by level. reorder them if requested */
+    if (cargs.layout != SBT_LAYOUT_LEVEL) sbtree_relayout(cargs.output,cargs.layout);
+
+    if (cargs.store) sbtextstore_create(cargs.input,cargs.store,SBTEXTSTORE_BLOCK);
+
     return EXIT_SUCCESS;
 }
\ No newline at end of file
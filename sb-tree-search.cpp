@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+#include <string>
+
+#include "sb_tree.h"
+#include "sb_engine.h"
+#include "sb_async.h"
+
+typedef struct {
+    const char* index;
+    const char* input;
+    const char* patterns;
+    uint64_t cache_size;
+    uint64_t resident_size;
+    uint64_t threads;
+    uint64_t depth;
+    uint64_t text_cache_size;
+    uint64_t text_block;
+    uint64_t limit;
+    uint64_t order;
+} cmd_args_t;
+
+void
+print_usage(const char* program)
+{
+    printf("USAGE: %s -x <index.sbti> -i <input> -p <patterns> -r <resident size> -c <cache size> -t <threads> -a <depth> -T <text cache size> -k <text block size> -l <limit> -o <order>\n",program);
+    printf("WHERE:\n");
+    printf("        -x <index>          : index file\n");
+    printf("        -i <input>          : input file the index was built over\n");
+    printf("        -p <patterns>       : file containing one pattern per line\n");
+    printf("        -r <resident size>  : memory for the top levels of the tree in MiB (optional)\n");
+    printf("        -c <cache size>     : page cache size in MiB (optional)\n");
+    printf("        -t <threads>        : answer all patterns with a parallel query engine (optional)\n");
+    printf("        -a <depth>          : answer all patterns with io_uring keeping <depth> queries in flight (optional)\n");
+    printf("        -T <text cache size>: cache the text used for verification in MiB (optional)\n");
+    printf("        -k <text block size>: block size of the text cache in bytes (optional)\n");
+    printf("        -l <limit>          : report the positions of at most <limit> occurrences (optional)\n");
+    printf("        -o <order>          : occurrences reported with -l. 'sa' (first in suffix array order, default)\n");
+    printf("                              or 'text' (smallest positions)\n\n");
+}
+
+cmd_args_t
+parse_args(int argc,char** argv)
+{
+    int op;
+    cmd_args_t args;
+
+    args.index = args.input = args.patterns = NULL;
+    args.cache_size = SBT_DEFAULT_CACHE_SIZE;
+    args.resident_size = SBT_DEFAULT_RESIDENT_SIZE;
+    args.threads = 0;
+    args.depth = 0;
+    args.text_cache_size = 0;
+    args.text_block = SBT_DEFAULT_TEXT_BLOCK;
+    args.limit = 0;
+    args.order = SBT_ORDER_SA;
+
+    while ((op=getopt(argc,argv,"x:i:p:r:c:t:a:T:k:l:o:")) != -1) {
+        switch (op) {
+            case 'x':
+                args.index = optarg;
+                break;
+            case 'i':
+                args.input = optarg;
+                break;
+            case 'p':
+                args.patterns = optarg;
+                break;
+            case 'r':
+                args.resident_size = atoll(optarg)*1024*1024;
+                break;
+            case 'c':
+                args.cache_size = atoll(optarg)*1024*1024;
+                break;
+            case 't':
+                args.threads = atoll(optarg);
+                break;
+            case 'a':
+                args.depth = atoll(optarg);
+                break;
+            case 'T':
+                args.text_cache_size = atoll(optarg)*1024*1024;
+                break;
+            case 'k':
+                args.text_block = atoll(optarg);
+                break;
+            case 'l':
+                args.limit = atoll(optarg);
+                break;
+            case 'o':
+                if (strcmp(optarg,"sa") == 0) args.order = SBT_ORDER_SA;
+                else if (strcmp(optarg,"text") == 0) args.order = SBT_ORDER_TEXT;
+                else {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case '?':
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (args.index == NULL || args.input == NULL || args.patterns == NULL) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    return args;
+}
+
+/* appends the streamed occurrences to a string */
+static int
+report_positions(void* arg,const uint64_t* suffixes,uint64_t k)
+{
+    std::string* out = (std::string*) arg;
+    char num[32];
+    for (uint64_t i=0; i<k; i++) {
+        snprintf(num,sizeof(num),"%s%lu",out->empty() ? "" : " ",suffixes[i]);
+        out->append(num);
+    }
+    return 0;
+}
+
+/* read all patterns and answer them with the parallel engine or,
+   if depth is set, with the asynchronous io_uring search */
+void
+search_parallel(sbtree_t* sbt,FILE* pf,uint64_t threads,uint64_t depth)
+{
+    std::vector<std::string> patterns;
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    while ((len = getline(&line,&line_size,pf)) > 0) {
+        if (line[len-1] == '\n') len--;
+        if (len == 0) continue;
+        patterns.push_back(std::string(line,len));
+    }
+    free(line);
+
+    uint64_t k = patterns.size();
+    std::vector<const uint8_t*> P(k);
+    std::vector<uint64_t> m(k),lo(k),hi(k);
+    for (uint64_t i=0; i<k; i++) {
+        P[i] = (const uint8_t*) patterns[i].data();
+        m[i] = patterns[i].size();
+    }
+
+    sbengine_t* eng = NULL;
+    sbasync_t* sa = NULL;
+    sbtree_qstats_t qs;
+    double start = omp_get_wtime();
+    if (depth) {
+        sa = sbasync_create(sbt,depth);
+        sbasync_search(sa,P.data(),m.data(),k,lo.data(),hi.data(),&qs);
+    } else {
+        eng = sbengine_create(sbt,threads);
+        sbengine_search(eng,P.data(),m.data(),k,lo.data(),hi.data(),&qs);
+    }
+    double elapsed = omp_get_wtime() - start;
+
+    printf("pattern;occurrences\n");
+    for (uint64_t i=0; i<k; i++) printf("%s;%lu\n",patterns[i].c_str(),hi[i]-lo[i]);
+
+    fprintf(stderr, "queries = %lu\n",k);
+    if (sa) fprintf(stderr, "queries in flight = %lu\n",sa->depth);
+    else fprintf(stderr, "threads = %lu\n",eng->nthreads);
+    fprintf(stderr, "queries per second = %.0f\n",k/elapsed);
+    if (k) {
+        fprintf(stderr, "avg pages read = %.2f\n",(double)qs.pages_read/k);
+        fprintf(stderr, "avg text reads = %.2f\n",(double)qs.text_reads/k);
+    }
+    sbengine_free(eng);
+    sbasync_free(sa);
+}
+
+int
+main(int argc,char** argv)
+{
+    cmd_args_t cargs = parse_args(argc,argv);
+
+    sbtree_t* sbt = sbtree_load(cargs.index,cargs.input,cargs.resident_size,cargs.cache_size);
+    sbtree_set_textcache(sbt,cargs.text_block,cargs.text_cache_size);
+
+    FILE* pf = fopen(cargs.patterns,"r");
+    if (!pf) {
+        fprintf(stderr, "cannot open pattern file '%s'\n",cargs.patterns);
+        exit(EXIT_FAILURE);
+    }
+
+    if (cargs.threads || cargs.depth) {
+        search_parallel(sbt,pf,cargs.threads,cargs.depth);
+        fclose(pf);
+        sbtree_free(sbt);
+        return EXIT_SUCCESS;
+    }
+
+    /* search each pattern and report the occurrences and the I/O cost */
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    uint64_t npatterns = 0, total_pages = 0, total_text = 0;
+    if (cargs.limit) printf("pattern;occurrences;reported;pages_read;pages_cached;text_reads;text_bytes;positions\n");
+    else printf("pattern;occurrences;pages_read;pages_cached;text_reads;text_bytes\n");
+    while ((len = getline(&line,&line_size,pf)) > 0) {
+        if (line[len-1] == '\n') len--;
+        if (len == 0) continue;
+
+        sbtree_qstats_t qs;
+        if (cargs.limit) {
+            /* only the first occurrences. the leaf scan stops after limit of
+               them, the number of all occurrences comes from the descent */
+            std::string positions;
+            uint64_t nocc;
+            uint64_t nres = sbtree_search_limit(sbt,(const uint8_t*)line,len,cargs.limit,cargs.order,
+                                                report_positions,&positions,&nocc,&qs);
+            printf("%.*s;%lu;%lu;%lu;%lu;%lu;%lu;%s\n",(int)len,line,nocc,nres,qs.pages_read,qs.pages_cached,
+                   qs.text_reads,qs.text_bytes,positions.c_str());
+        } else {
+            uint64_t nres = sbtree_count(sbt,(const uint8_t*)line,len,&qs);
+            printf("%.*s;%lu;%lu;%lu;%lu;%lu\n",(int)len,line,nres,qs.pages_read,qs.pages_cached,qs.text_reads,qs.text_bytes);
+        }
+        npatterns++;
+        total_pages += qs.pages_read;
+        total_text += qs.text_reads;
+    }
+    free(line);
+    fclose(pf);
+
+    if (npatterns) {
+        fprintf(stderr, "queries = %lu\n",npatterns);
+        fprintf(stderr, "avg pages read = %.2f\n",(double)total_pages/npatterns);
+        fprintf(stderr, "avg text reads = %.2f\n",(double)total_text/npatterns);
+    }
+
+    sbtree_free(sbt);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,417 @@
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+
+#include "sb_async.h"
+#include "sb_util.h"
+#include "critbit_tree.h"
+
+/* set up an io_uring instance with the given number of submission entries.
+   returns NULL if the kernel does not support io_uring */
+sbasync_ring_t*
+sbasync_ring_create(uint32_t entries)
+{
+    struct io_uring_params p;
+    memset(&p,0,sizeof(p));
+    int fd = syscall(__NR_io_uring_setup,entries,&p);
+    if (fd < 0) return NULL;
+
+    sbasync_ring_t* ring = (sbasync_ring_t*) sb_malloc(sizeof(sbasync_ring_t));
+    ring->fd = fd;
+    ring->sq_entries = p.sq_entries;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(uint32_t);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL,ring->sq_ring_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL,ring->cq_ring_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe*) mmap(NULL,ring->sqes_size,PROT_READ|PROT_WRITE,
+                 MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        fprintf(stderr, "error mapping io_uring rings.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t* sq = (uint8_t*) ring->sq_ring;
+    ring->sq_head = (uint32_t*) (sq + p.sq_off.head);
+    ring->sq_tail = (uint32_t*) (sq + p.sq_off.tail);
+    ring->sq_mask = (uint32_t*) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*) (sq + p.sq_off.array);
+    uint8_t* cq = (uint8_t*) ring->cq_ring;
+    ring->cq_head = (uint32_t*) (cq + p.cq_off.head);
+    ring->cq_tail = (uint32_t*) (cq + p.cq_off.tail);
+    ring->cq_mask = (uint32_t*) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    return ring;
+}
+
+void
+sbasync_ring_free(sbasync_ring_t* ring)
+{
+    if (ring) {
+        munmap(ring->sq_ring,ring->sq_ring_size);
+        munmap(ring->cq_ring,ring->cq_ring_size);
+        munmap(ring->sqes,ring->sqes_size);
+        close(ring->fd);
+        free(ring);
+    }
+}
+
+/* queue a read of len bytes at offset into buf. submitted with the next sbasync_ring_submit */
+void
+sbasync_ring_read(sbasync_ring_t* ring,int fd,void* buf,uint32_t len,uint64_t offset,uint64_t user_data)
+{
+    uint32_t tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head,__ATOMIC_ACQUIRE) == ring->sq_entries) {
+        /* submission queue full */
+        sbasync_ring_submit(ring,0);
+    }
+    uint32_t idx = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe,0,sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail,tail+1,__ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+/* submit all queued reads and wait till at least wait_nr reads completed */
+void
+sbasync_ring_submit(sbasync_ring_t* ring,uint32_t wait_nr)
+{
+    uint32_t flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    while (ring->to_submit || wait_nr) {
+        int ret = syscall(__NR_io_uring_enter,ring->fd,ring->to_submit,wait_nr,flags,NULL,0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            fprintf(stderr, "error submitting to io_uring (%s).\n",strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        ring->to_submit -= ret;
+        ring->in_flight += ret;
+        break;
+    }
+}
+
+/* take the next completion. returns 0 if there is none */
+int
+sbasync_ring_reap(sbasync_ring_t* ring,uint64_t* user_data,int32_t* res)
+{
+    uint32_t head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail,__ATOMIC_ACQUIRE)) return 0;
+    struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head,head+1,__ATOMIC_RELEASE);
+    ring->in_flight--;
+    return 1;
+}
+
+/* create an asynchronous search context with up to depth queries in flight */
+sbasync_t*
+sbasync_create(const sbtree_t* sbt,uint64_t depth)
+{
+    sbasync_t* sa = (sbasync_t*) sb_malloc(sizeof(sbasync_t));
+    sa->sbt = sbt;
+
+    /* every query in flight pins at most two pages */
+    if (depth > sbt->cache->nframes/2) depth = sbt->cache->nframes/2;
+    if (depth == 0) depth = 1;
+    sa->depth = depth;
+    sa->slots = (sbasync_slot_t*) sb_malloc(depth*sizeof(sbasync_slot_t));
+
+    /* each query has at most two reads outstanding */
+    sa->ring = sbasync_ring_create(2*depth);
+    if (!sa->ring) {
+        fprintf(stderr, "io_uring not available. falling back to synchronous search.\n");
+    }
+    return sa;
+}
+
+void
+sbasync_free(sbasync_t* sa)
+{
+    if (sa) {
+        for (uint64_t i=0; i<sa->depth; i++) {
+            free(sa->slots[i].buf[0]);
+            free(sa->slots[i].buf[1]);
+        }
+        free(sa->slots);
+        sbasync_ring_free(sa->ring);
+        free(sa);
+    }
+}
+
+/* queue the next text read of every candidate of slot s not verified yet.
+   a candidate is read past the bytes known to match P. with a text cache the
+   blocks are taken from the cache as long as they are there and only a missing
+   block is read, into its frame. without one the text is read in pieces doubling
+   in size from SBT_TEXT_PROBE. a candidate whose block is busy stalls the slot.
+   returns the number of reads queued */
+uint32_t
+sbasync_text_next(sbasync_t* sa,uint64_t s,uint64_t nsides,const uint8_t* P,sbtree_qstats_t* qs)
+{
+    const sbtree_t* sbt = sa->sbt;
+    sbpagecache_t* tc = sbt->textcache;
+    sbasync_slot_t* sl = &sa->slots[s];
+    uint32_t queued = 0;
+    for (uint64_t side=0; side<nsides; side++) {
+        if (!tc) {
+            if (sl->step[side] == 0 || sl->lcp[side] >= sl->len[side]) continue;
+            sl->req[side] = std::min(sl->step[side],sl->len[side]-sl->lcp[side]);
+            sbasync_ring_read(sa->ring,sbt->text->fd,sl->buf[side]+sl->lcp[side],sl->req[side],
+                              sl->pos[side]+sl->lcp[side],(s<<1)|side);
+            qs->text_reads++;
+            qs->text_bytes += sl->req[side];
+            queued++;
+            continue;
+        }
+        while (sl->step[side] && sl->lcp[side] < sl->len[side]) {
+            uint64_t p = sl->pos[side] + sl->lcp[side];
+            uint64_t start = p - p%tc->B;
+            int status;
+            const uint8_t* block = sbpagecache_pin_async(tc,start,&status);
+            if (!block) {
+                sl->stalled = 1;
+                break;
+            }
+            if (status == SBPAGECACHE_MISS) {
+                sl->block[side] = block;
+                sl->req[side] = std::min(tc->B,tc->size-start);
+                sbasync_ring_read(sa->ring,tc->fd,(void*)block,sl->req[side],start,(s<<1)|side);
+                qs->text_reads++;
+                qs->text_bytes += sl->req[side];
+                queued++;
+                break;
+            }
+            qs->text_cached++;
+            sbasync_text_block(sa,s,side,P,block);
+        }
+    }
+    return queued;
+}
+
+/* compare candidate side of slot s with P inside the pinned text cache block
+   and unpin it */
+void
+sbasync_text_block(sbasync_t* sa,uint64_t s,uint64_t side,const uint8_t* P,const uint8_t* block)
+{
+    sbpagecache_t* tc = sa->sbt->textcache;
+    sbasync_slot_t* sl = &sa->slots[s];
+    uint64_t off = (sl->pos[side] + sl->lcp[side]) % tc->B;
+    uint64_t end = std::min(sl->len[side]-sl->lcp[side],tc->B-off);
+    uint64_t l = sbtree_buf_lcp(block+off,end,P+sl->lcp[side],&sl->sym[side]);
+    sbpagecache_unpin(tc,block);
+    sl->lcp[side] += l;
+    if (l < end) sl->step[side] = 0;
+}
+
+/* run the query in slot s as far as possible without blocking.
+   returns 1 if the query is finished */
+int
+sbasync_advance(sbasync_t* sa,uint64_t s,const uint8_t** P,const uint64_t* m,
+                uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs)
+{
+    const sbtree_t* sbt = sa->sbt;
+    sbasync_slot_t* sl = &sa->slots[s];
+    const uint8_t* Pq = P[sl->q];
+    uint64_t mq = m[sl->q];
+
+    while (!sl->pending) {
+        uint64_t nsides = (sl->idx[0] == sl->idx[1]) ? 1 : 2;
+
+        if (sl->stage == SBASYNC_PAGES) {
+            /* acquire the pages of the current level */
+            sl->stalled = 0;
+            for (uint64_t side=0; side<nsides; side++) {
+                if (sl->page[side]) continue;
+                if (sl->level + sbt->resident_levels >= sbt->height) {
+                    sl->page[side] = sbtree_load_node(sbt,sl->level,sl->idx[side],qs);
+                    continue;
+                }
+                int status;
+                uint64_t offset = sbtree_page_offset(sbt,sl->level,sl->idx[side]);
+                sl->page[side] = (sb_diskpage_t*) sbpagecache_pin_async(sbt->cache,offset,&status);
+                if (!sl->page[side]) {
+                    sl->stalled = 1;
+                } else if (status == SBPAGECACHE_MISS) {
+                    sbasync_ring_read(sa->ring,sbt->fd,sl->page[side],sbt->B,offset,(s<<1)|side);
+                    sl->pending++;
+                    qs->pages_read++;
+                } else {
+                    qs->pages_cached++;
+                }
+            }
+            if (sl->stalled || sl->pending) return 0;
+
+            /* find the blind trie candidates and the bytes they are known to match */
+            for (uint64_t side=0; side<nsides; side++) {
+                critbit_mem_t cbm;
+                critbit_mem_init(&cbm,sl->page[side]->data);
+                uint64_t lcp_first, lcp_last, reach;
+                sl->cand[side] = critbit_mem_locate(&cbm,Pq,mq,&lcp_first,&lcp_last,&reach);
+                uint64_t from = sbtree_node_from(sbt,sl->page[side],&sl->lcpb[side],lcp_first,lcp_last,mq);
+                sl->pos[side] = critbit_mem_getsuffix(&cbm,sl->cand[side]);
+                sl->len[side] = mq;
+                if (sl->pos[side] + mq > sbt->n) sl->len[side] = sbt->n - sl->pos[side];
+                sl->lcp[side] = std::min(from,sl->len[side]);
+                sl->step[side] = SBT_TEXT_PROBE;
+                sl->sym[side] = 0;
+                sl->req[side] = 0;
+                sl->block[side] = NULL;
+                if (sbt->text->compressed) {
+                    /* blocks of a compressed text have to be decoded, read them through the cache */
+                    sl->lcp[side] = sbtree_text_lcp(sbt,sl->pos[side],Pq,mq,sl->lcp[side],
+                                                    sl->buf[side],&sl->sym[side],qs);
+                    sl->step[side] = 0;
+                }
+            }
+            sl->stage = SBASYNC_TEXT;
+            sl->pending = sbasync_text_next(sa,s,nsides,Pq,qs);
+            if (sl->stalled && !sl->pending) return 0;
+            continue;
+        }
+
+        /* compare the pieces which arrived and read on where they all matched */
+        sl->stalled = 0;
+        for (uint64_t side=0; side<nsides; side++) {
+            if (!sl->req[side]) continue;
+            if (sl->block[side]) {
+                sbasync_text_block(sa,s,side,Pq,sl->block[side]);
+                sl->block[side] = NULL;
+            } else {
+                uint64_t l = sbtree_buf_lcp(sl->buf[side]+sl->lcp[side],sl->req[side],
+                                            Pq+sl->lcp[side],&sl->sym[side]);
+                sl->lcp[side] += l;
+                sl->step[side] = (l < sl->req[side]) ? 0 : 2*sl->step[side];
+            }
+            sl->req[side] = 0;
+        }
+        sl->pending = sbasync_text_next(sa,s,nsides,Pq,qs);
+        if (sl->stalled && !sl->pending) return 0;
+        if (sl->pending) continue;
+
+        /* the candidates are verified: rank P in the pages and go down one level */
+        for (uint64_t side=0; side<nsides; side++) {
+            critbit_mem_t cbm;
+            critbit_mem_init(&cbm,sl->page[side]->data);
+            uint64_t lb,rb;
+            critbit_mem_rank(&cbm,Pq,mq,sl->lcp[side],sl->sym[side],&lb,&rb);
+            uint64_t first = sbtree_page_first(sbt,sl->page[side]);
+            sbtree_bound_t b = sl->lcpb[side];
+            if (nsides == 1) {
+                sl->bound[0] = lb;
+                sl->bound[1] = rb;
+                sl->first[0] = sl->first[1] = first;
+                sbtree_node_bound(sbt,sl->page[0],&cbm,&b,sl->cand[0],sl->lcp[0],lb ? lb-1 : 0,&sl->lcpb[0]);
+                sbtree_node_bound(sbt,sl->page[0],&cbm,&b,sl->cand[0],sl->lcp[0],rb ? rb-1 : 0,&sl->lcpb[1]);
+            } else {
+                sl->bound[side] = side ? rb : lb;
+                sl->first[side] = first;
+                sbtree_node_bound(sbt,sl->page[side],&cbm,&b,sl->cand[side],sl->lcp[side],
+                                  sl->bound[side] ? sl->bound[side]-1 : 0,&sl->lcpb[side]);
+            }
+            sbtree_free_node(sbt,sl->page[side]);
+            sl->page[side] = NULL;
+        }
+
+        if (sl->level == 0) {
+            lo[sl->q] = sl->first[0] + sl->bound[0];
+            hi[sl->q] = sl->first[1] + sl->bound[1];
+            if (hi[sl->q] < lo[sl->q]) hi[sl->q] = lo[sl->q];
+            sl->stage = SBASYNC_FREE;
+            return 1;
+        }
+        sl->level--;
+        for (uint64_t side=0; side<2; side++) {
+            sl->idx[side] = sl->first[side] + (sl->bound[side] ? sl->bound[side]-1 : 0);
+        }
+        sl->stage = SBASYNC_PAGES;
+    }
+    return 0;
+}
+
+/* search k patterns keeping up to depth queries in flight. for each pattern P[i]
+   the range [lo[i],hi[i]) of the suffix array prefixed by P[i] is computed.
+   page and text reads of all queries are submitted through one io_uring, so the
+   device sees up to 2*depth outstanding requests */
+void
+sbasync_search(sbasync_t* sa,const uint8_t** P,const uint64_t* m,uint64_t k,
+               uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs)
+{
+    sbtree_qstats_t stats;
+    if (!qs) qs = &stats;
+    memset(qs,0,sizeof(sbtree_qstats_t));
+
+    if (!sa->ring) {
+        for (uint64_t i=0; i<k; i++) sbtree_search_range(sa->sbt,P[i],m[i],&lo[i],&hi[i],qs);
+        return;
+    }
+
+    uint64_t next = 0, done = 0;
+    while (done < k) {
+        /* start new queries in free slots */
+        int stalled = 0;
+        for (uint64_t s=0; s<sa->depth; s++) {
+            sbasync_slot_t* sl = &sa->slots[s];
+            if (sl->stage == SBASYNC_FREE) {
+                if (next == k) continue;
+                sl->q = next++;
+                sl->level = sa->sbt->height-1;
+                sl->idx[0] = sl->idx[1] = 0;
+                memset(sl->lcpb,0,sizeof(sl->lcpb));
+                sl->stage = SBASYNC_PAGES;
+                if (sl->buf_size < m[sl->q]) {
+                    sl->buf_size = m[sl->q];
+                    sl->buf[0] = (uint8_t*) realloc(sl->buf[0],sl->buf_size);
+                    sl->buf[1] = (uint8_t*) realloc(sl->buf[1],sl->buf_size);
+                    if (!sl->buf[0] || !sl->buf[1]) {
+                        fprintf(stderr, "error allocating text buffers.\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                done += sbasync_advance(sa,s,P,m,lo,hi,qs);
+            } else if (sl->stalled && !sl->pending) {
+                /* retry queries which could not get a page */
+                done += sbasync_advance(sa,s,P,m,lo,hi,qs);
+            }
+            if (sl->stage != SBASYNC_FREE && sl->stalled) stalled = 1;
+        }
+
+        /* block till a read completes whenever one is outstanding: stalled
+           queries get their frames only after completions, which are handled
+           below and release pages before the next retry. without any read a
+           stalled query waits for pages pinned by other threads */
+        uint32_t outstanding = sa->ring->in_flight + sa->ring->to_submit;
+        sbasync_ring_submit(sa->ring,outstanding ? 1 : 0);
+        if (!outstanding && stalled) sched_yield();
+
+        uint64_t user_data;
+        int32_t res;
+        while (sbasync_ring_reap(sa->ring,&user_data,&res)) {
+            uint64_t s = user_data>>1;
+            uint64_t side = user_data&1;
+            sbasync_slot_t* sl = &sa->slots[s];
+            uint64_t expected = (sl->stage == SBASYNC_PAGES) ? sa->sbt->B : sl->req[side];
+            if (res < 0 || (uint64_t)res != expected) {
+                fprintf(stderr, "error reading %lu bytes asynchronously (%d).\n",expected,res);
+                exit(EXIT_FAILURE);
+            }
+            if (sl->stage == SBASYNC_PAGES) sbpagecache_loaded(sa->sbt->cache,(const uint8_t*)sl->page[side]);
+            else if (sl->block[side]) sbpagecache_loaded(sa->sbt->textcache,sl->block[side]);
+            sl->pending--;
+            if (!sl->pending) done += sbasync_advance(sa,s,P,m,lo,hi,qs);
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef SB_ASYNC_H
+#define SB_ASYNC_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <linux/io_uring.h>
+
+#include "sb_tree.h"
+
+#define SBASYNC_DEFAULT_DEPTH   256
+
+/* stages of an in-flight query */
+#define SBASYNC_FREE            0   /* slot unused */
+#define SBASYNC_PAGES           1   /* waiting for the pages of the current level */
+#define SBASYNC_TEXT            2   /* verifying the blind trie candidates */
+
+/* io_uring submission and completion rings, used without liburing */
+typedef struct {
+    int fd;
+    uint32_t sq_entries;
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    struct io_uring_sqe* sqes;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    uint64_t sq_ring_size;
+    void* cq_ring;
+    uint64_t cq_ring_size;
+    uint64_t sqes_size;
+    uint32_t to_submit;     /* queued but not submitted sqes */
+    uint32_t in_flight;     /* submitted reads without completion */
+} sbasync_ring_t;
+
+/* state of one query in flight */
+typedef struct {
+    uint64_t q;                 /* query answered in this slot */
+    int stage;
+    uint64_t level;             /* current level of the descent */
+    uint64_t idx[2];            /* page of the left and right path in the current level */
+    uint64_t bound[2];          /* rank of P in the pages of the two paths */
+    uint64_t first[2];          /* index of the first entry of the two pages in their level */
+    sb_diskpage_t* page[2];     /* pinned pages. NULL while not acquired */
+    sbtree_bound_t lcpb[2];     /* lcp bounds carried down the two paths */
+    uint64_t cand[2];           /* blind trie candidates in the two pages */
+    uint64_t pos[2];            /* their suffixes */
+    uint64_t lcp[2];            /* bytes of P matched by the candidates so far */
+    uint64_t step[2];           /* size of the next text read, 0 once verified */
+    uint8_t sym[2];             /* symbol of a candidate at the mismatch */
+    uint8_t* buf[2];            /* text of the two candidates */
+    uint64_t len[2];            /* bytes of P to compare with the candidates */
+    uint64_t req[2];            /* text bytes of the outstanding read */
+    const uint8_t* block[2];    /* text cache block being read. NULL if none */
+    uint64_t buf_size;
+    uint32_t pending;           /* outstanding reads */
+    uint32_t stalled;           /* a page or text block could not be acquired. retry later */
+} sbasync_slot_t;
+
+/* asynchronous search context. keeps up to depth queries in flight, each
+   query resumes when the page or text read it waits for completes */
+typedef struct {
+    const sbtree_t* sbt;
+    sbasync_ring_t* ring;       /* NULL if io_uring is not available */
+    uint64_t depth;
+    sbasync_slot_t* slots;
+} sbasync_t;
+
+/* create / destroy */
+sbasync_t*      sbasync_create(const sbtree_t* sbt,uint64_t depth);
+void            sbasync_free(sbasync_t* sa);
+
+/* query functions */
+void            sbasync_search(sbasync_t* sa,const uint8_t** P,const uint64_t* m,uint64_t k,
+                               uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs);
+
+/* ring functions */
+sbasync_ring_t* sbasync_ring_create(uint32_t entries);
+void            sbasync_ring_free(sbasync_ring_t* ring);
+void            sbasync_ring_read(sbasync_ring_t* ring,int fd,void* buf,uint32_t len,uint64_t offset,uint64_t user_data);
+void            sbasync_ring_submit(sbasync_ring_t* ring,uint32_t wait_nr);
+int             sbasync_ring_reap(sbasync_ring_t* ring,uint64_t* user_data,int32_t* res);
+
+/* helper functions */
+int             sbasync_advance(sbasync_t* sa,uint64_t s,const uint8_t** P,const uint64_t* m,
+                                uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs);
+uint32_t        sbasync_text_next(sbasync_t* sa,uint64_t s,uint64_t nsides,const uint8_t* P,sbtree_qstats_t* qs);
+void            sbasync_text_block(sbasync_t* sa,uint64_t s,uint64_t side,const uint8_t* P,const uint8_t* block);
+
+#endif
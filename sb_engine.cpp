@@ -0,0 +1,133 @@
+#include <string.h>
+
+#include "sb_engine.h"
+#include "sb_util.h"
+
+/* create an engine with nthreads workers. 0 = use all available cores */
+sbengine_t*
+sbengine_create(const sbtree_t* sbt,uint64_t nthreads)
+{
+    if (nthreads == 0) nthreads = omp_get_max_threads();
+
+    /* every worker pins at most two pages at a time */
+    if (sbt->cache->nframes < 2*nthreads) {
+        fprintf(stderr, "page cache too small for %lu threads (%lu frames).\n",nthreads,sbt->cache->nframes);
+        exit(EXIT_FAILURE);
+    }
+
+    sbengine_t* eng = (sbengine_t*) sb_malloc(sizeof(sbengine_t));
+    eng->sbt = sbt;
+    eng->nthreads = nthreads;
+    if (posix_memalign((void**)&eng->workers,64,nthreads*sizeof(sbengine_worker_t)) != 0) {
+        fprintf(stderr, "error allocating engine workers.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(eng->workers,0,nthreads*sizeof(sbengine_worker_t));
+    for (uint64_t i=0; i<nthreads; i++) omp_init_lock(&eng->workers[i].queue.lock);
+
+    return eng;
+}
+
+void
+sbengine_free(sbengine_t* eng)
+{
+    if (eng) {
+        for (uint64_t i=0; i<eng->nthreads; i++) {
+            omp_destroy_lock(&eng->workers[i].queue.lock);
+            free(eng->workers[i].buf);
+        }
+        free(eng->workers);
+        free(eng);
+    }
+}
+
+/* take the next query from the front of the own queue */
+int
+sbengine_pop(sbengine_deque_t* dq,uint64_t* q)
+{
+    int found = 0;
+    omp_set_lock(&dq->lock);
+    if (dq->next < dq->end) {
+        *q = dq->next++;
+        found = 1;
+    }
+    omp_unset_lock(&dq->lock);
+    return found;
+}
+
+/* move the back half of the queue of another worker to the (empty) queue of thief.
+   returns 0 if there is no work left anywhere */
+int
+sbengine_steal(sbengine_t* eng,uint64_t thief)
+{
+    for (uint64_t i=1; i<eng->nthreads; i++) {
+        sbengine_deque_t* victim = &eng->workers[(thief+i)%eng->nthreads].queue;
+        omp_set_lock(&victim->lock);
+        uint64_t remaining = victim->end - victim->next;
+        if (remaining == 0) {
+            omp_unset_lock(&victim->lock);
+            continue;
+        }
+        uint64_t end = victim->end;
+        uint64_t mid = victim->end - (remaining+1)/2;
+        victim->end = mid;
+        omp_unset_lock(&victim->lock);
+
+        sbengine_deque_t* own = &eng->workers[thief].queue;
+        omp_set_lock(&own->lock);
+        own->next = mid;
+        own->end = end;
+        omp_unset_lock(&own->lock);
+        eng->workers[thief].steals++;
+        return 1;
+    }
+    return 0;
+}
+
+/* search k patterns using all workers. for each pattern P[i] the range
+   [lo[i],hi[i]) of the suffix array prefixed by P[i] is computed.
+   qs (if not NULL) receives the summed I/O cost of all queries */
+void
+sbengine_search(sbengine_t* eng,const uint8_t** P,const uint64_t* m,uint64_t k,
+                uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs)
+{
+    /* hand out contiguous chunks of the queries */
+    for (uint64_t i=0; i<eng->nthreads; i++) {
+        sbengine_worker_t* w = &eng->workers[i];
+        w->queue.next = (k*i)/eng->nthreads;
+        w->queue.end = (k*(i+1))/eng->nthreads;
+        memset(&w->qs,0,sizeof(sbtree_qstats_t));
+        w->queries = 0;
+        w->steals = 0;
+    }
+
+    #pragma omp parallel num_threads(eng->nthreads)
+    {
+        uint64_t tid = omp_get_thread_num();
+        sbengine_worker_t* w = &eng->workers[tid];
+        uint64_t q;
+        while (sbengine_pop(&w->queue,&q) || (sbengine_steal(eng,tid) && sbengine_pop(&w->queue,&q))) {
+            if (w->buf_size < m[q]) {
+                w->buf_size = m[q];
+                w->buf = (uint8_t*) realloc(w->buf,w->buf_size);
+                if (!w->buf) {
+                    fprintf(stderr, "error allocating scratch buffer.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            sbtree_descend(eng->sbt,P[q],m[q],w->buf,&lo[q],&hi[q],NULL,&w->qs);
+            w->queries++;
+        }
+    }
+
+    if (qs) {
+        memset(qs,0,sizeof(sbtree_qstats_t));
+        for (uint64_t i=0; i<eng->nthreads; i++) {
+            qs->pages_read += eng->workers[i].qs.pages_read;
+            qs->pages_cached += eng->workers[i].qs.pages_cached;
+            qs->text_reads += eng->workers[i].qs.text_reads;
+            qs->text_bytes += eng->workers[i].qs.text_bytes;
+            qs->text_cached += eng->workers[i].qs.text_cached;
+        }
+    }
+}
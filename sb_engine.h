@@ -0,0 +1,49 @@
+#ifndef SB_ENGINE_H
+#define SB_ENGINE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <omp.h>
+
+#include "sb_tree.h"
+
+/* query ids [next,end) owned by one worker. the owner takes queries from
+   the front, idle workers steal the back half */
+typedef struct {
+    omp_lock_t lock;
+    uint64_t next;
+    uint64_t end;
+} sbengine_deque_t;
+
+/* per thread state. aligned so workers do not share cache lines */
+typedef struct {
+    sbengine_deque_t queue;
+    uint8_t* buf;               /* scratch buffer for the text verification */
+    uint64_t buf_size;
+    sbtree_qstats_t qs;         /* accumulated I/O cost of all queries */
+    uint64_t queries;           /* number of queries answered */
+    uint64_t steals;            /* number of successful steals */
+} __attribute__((aligned(64))) sbengine_worker_t;
+
+/* multi-threaded query engine over a single SB-tree. all workers share the
+   tree and its page cache. resident levels are read without any locking */
+typedef struct {
+    const sbtree_t* sbt;
+    uint64_t nthreads;
+    sbengine_worker_t* workers;
+} sbengine_t;
+
+/* create / destroy */
+sbengine_t* sbengine_create(const sbtree_t* sbt,uint64_t nthreads);
+void        sbengine_free(sbengine_t* eng);
+
+/* query functions */
+void        sbengine_search(sbengine_t* eng,const uint8_t** P,const uint64_t* m,uint64_t k,
+                            uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs);
+
+/* helper functions */
+int         sbengine_pop(sbengine_deque_t* dq,uint64_t* q);
+int         sbengine_steal(sbengine_t* eng,uint64_t thief);
+
+#endif
@@ -0,0 +1,332 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "sb_lcp.h"
+#include "sb_util.h"
+#include "sb_pagecache.h"
+#include "sb_match.h"
+#include "sb_tmpfile.h"
+
+#define SBLCP_IO_BLOCK	(1024*1024)
+#define SBLCP_TEXT_BLOCK	4096
+#define SBLCP_BUCKET_BUF	(16*1024)	/* words buffered per bucket of the external construction */
+#define SBLCP_MAX_BUCKETS	256		/* most text / SA ranges of the external construction */
+
+/* number of bits needed to store x */
+uint64_t
+sblcp_width(uint64_t x)
+{
+    if (x == 0) return 0;
+    return 64 - __builtin_clzll(x);
+}
+
+static FILE*
+sblcp_open(const char* file,const char* mode)
+{
+    FILE* f = fopen(file,mode);
+    if (!f) {
+        fprintf(stderr, "cannot open file '%s'\n",file);
+        exit(EXIT_FAILURE);
+    }
+    return f;
+}
+
+/* add one lcp value to the statistics */
+void
+sblcp_record(sblcp_stats_t* stats,uint64_t lcp)
+{
+    if (lcp > stats->max_lcp) stats->max_lcp = lcp;
+    stats->sum_lcp += lcp;
+    stats->width[sblcp_width(lcp)]++;
+}
+
+/* build the lcp array of the suffix array stored in sa_file and write it to lcp_file.
+   lcp[i] is the lcp of SA[i-1] and SA[i], lcp[0] = 0. returns the max lcp.
+
+   semi-external PLCP construction (Kasai et al. in text order): the text and one
+   array of n words are kept in memory, the suffix array is streamed twice and
+   the lcp array is streamed out in SA order.
+
+	pass 1: phi[SA[i]] = SA[i-1]
+	scan  : plcp[i] = lcp(i,phi[i]). plcp[i+1] >= plcp[i]-1, so the scan
+	        does at most 2n character comparisons. plcp overwrites phi.
+	pass 2: lcp[i] = plcp[SA[i]]
+*/
+uint64_t
+sblcp_build(const uint8_t* T,uint64_t n,const char* sa_file,const char* lcp_file,sblcp_stats_t* stats)
+{
+    sblcp_stats_t local;
+    if (!stats) stats = &local;
+    memset(stats,0,sizeof(sblcp_stats_t));
+    stats->n = n;
+
+    uint64_t* phi = (uint64_t*) sb_malloc(n*sizeof(uint64_t));
+    uint64_t* buf = (uint64_t*) sb_malloc(SBLCP_IO_BLOCK*sizeof(uint64_t));
+
+    /* pass 1 */
+    FILE* sa_in = sblcp_open(sa_file,"r");
+    uint64_t prev = n, nread, total = 0;
+    while ((nread = fread(buf,sizeof(uint64_t),SBLCP_IO_BLOCK,sa_in)) > 0) {
+        for (uint64_t i=0; i<nread; i++) {
+            phi[buf[i]] = prev;
+            prev = buf[i];
+        }
+        total += nread;
+    }
+    if (total != n) {
+        fprintf(stderr, "suffix array '%s' has %lu entries instead of %lu\n",sa_file,total,n);
+        exit(EXIT_FAILURE);
+    }
+
+    /* plcp in text order */
+    uint64_t l = 0;
+    for (uint64_t i=0; i<n; i++) {
+        uint64_t j = phi[i];
+        if (j == n) {
+            l = 0;
+        } else {
+            uint64_t end = n - std::max(i,j);
+            if (l < end) l += sbmatch_lcp(T+i+l,T+j+l,end-l);
+        }
+        phi[i] = l;
+        if (l) l--;
+    }
+
+    /* pass 2 */
+    fseek(sa_in,0,SEEK_SET);
+    FILE* lcp_out = sblcp_open(lcp_file,"w");
+    while ((nread = fread(buf,sizeof(uint64_t),SBLCP_IO_BLOCK,sa_in)) > 0) {
+        for (uint64_t i=0; i<nread; i++) {
+            buf[i] = phi[buf[i]];
+            sblcp_record(stats,buf[i]);
+        }
+        if (fwrite(buf,sizeof(uint64_t),nread,lcp_out) != nread) {
+            fprintf(stderr, "error writing lcp file '%s'\n",lcp_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(lcp_out);
+    fclose(sa_in);
+
+    free(phi);
+    free(buf);
+
+    return stats->max_lcp;
+}
+
+/* lcp of the suffixes i and j of the text cached in pc */
+uint64_t
+sblcp_cached_lcp(sbpagecache_t* pc,uint64_t n,uint64_t i,uint64_t j)
+{
+    uint64_t l = 0;
+    int miss;
+    while (i+l < n && j+l < n) {
+        uint64_t oi = (i+l) % pc->B, oj = (j+l) % pc->B;
+        const uint8_t* bi = sbpagecache_pin(pc,i+l-oi,&miss);
+        const uint8_t* bj = sbpagecache_pin(pc,j+l-oj,&miss);
+        uint64_t span = std::min(std::min(pc->B-oi,pc->B-oj),n-std::max(i,j)-l);
+        uint64_t k = sbmatch_lcp(bi+oi,bj+oj,span);
+        sbpagecache_unpin(pc,bi);
+        sbpagecache_unpin(pc,bj);
+        l += k;
+        if (k < span) break;
+    }
+    return l;
+}
+
+/* buffered writers of the buckets of sblcp_build_external. entries of
+   width words are appended to the bucket of their key */
+typedef struct {
+    sbtmpfile_t** files;
+    uint64_t* buf;
+    uint64_t* used;
+    uint64_t nbuckets;
+    uint64_t width;
+} sblcp_buckets_t;
+
+static void
+sblcp_buckets_create(sblcp_buckets_t* bk,uint64_t nbuckets,uint64_t width)
+{
+    bk->nbuckets = nbuckets;
+    bk->width = width;
+    bk->files = (sbtmpfile_t**) sb_malloc(nbuckets*sizeof(sbtmpfile_t*));
+    bk->buf = (uint64_t*) sb_malloc(nbuckets*SBLCP_BUCKET_BUF*sizeof(uint64_t));
+    bk->used = (uint64_t*) sb_malloc(nbuckets*sizeof(uint64_t));
+    for (uint64_t b=0; b<nbuckets; b++) bk->files[b] = sbtmpfile_create_write();
+}
+
+static void
+sblcp_buckets_add(sblcp_buckets_t* bk,uint64_t b,const uint64_t* entry)
+{
+    uint64_t* buf = bk->buf + b*SBLCP_BUCKET_BUF;
+    memcpy(buf+bk->used[b],entry,bk->width*sizeof(uint64_t));
+    bk->used[b] += bk->width;
+    if (bk->used[b] + bk->width > SBLCP_BUCKET_BUF) {
+        sbtmpfile_write_block(bk->files[b],buf,bk->used[b]);
+        bk->used[b] = 0;
+    }
+}
+
+/* flush all buckets and make them readable */
+static void
+sblcp_buckets_finish(sblcp_buckets_t* bk)
+{
+    for (uint64_t b=0; b<bk->nbuckets; b++) {
+        if (bk->used[b]) sbtmpfile_write_block(bk->files[b],bk->buf + b*SBLCP_BUCKET_BUF,bk->used[b]);
+        sbtmpfile_finish(bk->files[b]);
+        sbtmpfile_open_read(bk->files[b]);
+    }
+}
+
+/* reads the next entries of bucket b into the bucket buffer. returns the
+   number of words read */
+static uint64_t
+sblcp_buckets_read(sblcp_buckets_t* bk,uint64_t b)
+{
+    uint64_t max = SBLCP_BUCKET_BUF - SBLCP_BUCKET_BUF % bk->width;
+    return sbtmpfile_read_block(bk->files[b],bk->buf + b*SBLCP_BUCKET_BUF,max);
+}
+
+static void
+sblcp_buckets_free(sblcp_buckets_t* bk)
+{
+    for (uint64_t b=0; b<bk->nbuckets; b++) sbtmpfile_delete(bk->files[b]);
+    free(bk->files);
+    free(bk->buf);
+    free(bk->used);
+}
+
+/* build the lcp array like sblcp_build, but without the text in memory.
+   the Φ / PLCP construction of sblcp_build is done range by range of
+   R text positions, so the text is read in text order:
+
+	pass 1: stream the suffix array and distribute (SA[k],SA[k-1],k) into
+	        the bucket of the text range of SA[k]
+	pass 2: for each text range in order, place phi and the SA ranks of the
+	        range in memory and compute plcp in text order through a text
+	        cache. the suffix i is read sequentially, only the block of
+	        phi[i] is a random access, and at most 2n characters are
+	        compared. (k,plcp) is distributed into the bucket of the SA
+	        range of k
+	pass 3: for each SA range in order, place the lcp values in memory
+	        and write them out
+
+   half of the budget holds the two arrays of a range, the other half the
+   text cache. the number of buckets is limited to SBLCP_MAX_BUCKETS, so
+   for very large texts a range may need more memory than the budget */
+uint64_t
+sblcp_build_external(sbtextstore_t* text,const char* sa_file,const char* lcp_file,uint64_t budget,
+                     sblcp_stats_t* stats)
+{
+    sblcp_stats_t local;
+    if (!stats) stats = &local;
+    memset(stats,0,sizeof(sblcp_stats_t));
+    uint64_t n = text->n;
+    stats->n = n;
+    if (n == 0) {
+        fclose(sblcp_open(lcp_file,"w"));
+        return 0;
+    }
+
+    uint64_t R = std::max((budget/2)/(2*sizeof(uint64_t)),(uint64_t)1);
+    R = std::max(R,(n+SBLCP_MAX_BUCKETS-1)/SBLCP_MAX_BUCKETS);
+    R = std::min(R,n);
+    uint64_t nbuckets = (n+R-1)/R;
+    uint64_t* phi = (uint64_t*) sb_malloc(R*sizeof(uint64_t));
+    uint64_t* rank = (uint64_t*) sb_malloc(R*sizeof(uint64_t));
+    uint64_t* buf = (uint64_t*) sb_malloc(SBLCP_IO_BLOCK*sizeof(uint64_t));
+
+    /* pass 1 */
+    sblcp_buckets_t by_text;
+    sblcp_buckets_create(&by_text,nbuckets,3);
+    FILE* sa_in = sblcp_open(sa_file,"r");
+    uint64_t prev = n, nread, total = 0;
+    while ((nread = fread(buf,sizeof(uint64_t),SBLCP_IO_BLOCK,sa_in)) > 0) {
+        for (uint64_t i=0; i<nread; i++) {
+            if (buf[i] >= n) {
+                fprintf(stderr, "suffix array '%s' contains position %lu >= %lu\n",sa_file,buf[i],n);
+                exit(EXIT_FAILURE);
+            }
+            uint64_t entry[3] = {buf[i],prev,total+i};
+            sblcp_buckets_add(&by_text,buf[i]/R,entry);
+            prev = buf[i];
+        }
+        total += nread;
+    }
+    fclose(sa_in);
+    if (total != n) {
+        fprintf(stderr, "suffix array '%s' has %lu entries instead of %lu\n",sa_file,total,n);
+        exit(EXIT_FAILURE);
+    }
+    sblcp_buckets_finish(&by_text);
+
+    /* pass 2 */
+    sbpagecache_t* pc = sbtextstore_cache(text,SBLCP_TEXT_BLOCK,budget/2);
+    sblcp_buckets_t by_rank;
+    sblcp_buckets_create(&by_rank,nbuckets,2);
+    uint64_t l = 0;
+    for (uint64_t b=0; b<nbuckets; b++) {
+        uint64_t a = b*R, len = std::min(R,n-a), count = 0;
+        uint64_t* in = by_text.buf + b*SBLCP_BUCKET_BUF;
+        while ((nread = sblcp_buckets_read(&by_text,b)) > 0) {
+            for (uint64_t i=0; i<nread; i+=3) {
+                phi[in[i]-a] = in[i+1];
+                rank[in[i]-a] = in[i+2];
+            }
+            count += nread/3;
+        }
+        if (count != len) {
+            fprintf(stderr, "suffix array '%s' is not a permutation\n",sa_file);
+            exit(EXIT_FAILURE);
+        }
+        for (uint64_t i=a; i<a+len; i++) {
+            uint64_t j = phi[i-a];
+            if (j == n) {
+                l = 0;
+            } else if (l < n-std::max(i,j)) {
+                l += sblcp_cached_lcp(pc,n,i+l,j+l);
+            }
+            uint64_t entry[2] = {rank[i-a],l};
+            sblcp_buckets_add(&by_rank,rank[i-a]/R,entry);
+            if (l) l--;
+        }
+    }
+    sbpagecache_free(pc);
+    sblcp_buckets_free(&by_text);
+    sblcp_buckets_finish(&by_rank);
+
+    /* pass 3 */
+    FILE* lcp_out = sblcp_open(lcp_file,"w");
+    for (uint64_t b=0; b<nbuckets; b++) {
+        uint64_t a = b*R, len = std::min(R,n-a);
+        uint64_t* in = by_rank.buf + b*SBLCP_BUCKET_BUF;
+        while ((nread = sblcp_buckets_read(&by_rank,b)) > 0) {
+            for (uint64_t i=0; i<nread; i+=2) phi[in[i]-a] = in[i+1];
+        }
+        for (uint64_t k=0; k<len; k++) sblcp_record(stats,phi[k]);
+        if (fwrite(phi,sizeof(uint64_t),len,lcp_out) != len) {
+            fprintf(stderr, "error writing lcp file '%s'\n",lcp_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(lcp_out);
+    sblcp_buckets_free(&by_rank);
+
+    free(buf);
+    free(rank);
+    free(phi);
+
+    return stats->max_lcp;
+}
+
+/* print the lcp statistics to stderr */
+void
+sblcp_printstats(const sblcp_stats_t* stats)
+{
+    fprintf(stderr, "max lcp = %lu\n",stats->max_lcp);
+    if (stats->n) fprintf(stderr, "avg lcp = %.2f\n",(double)stats->sum_lcp/stats->n);
+    for (uint64_t w=0; w<SBLCP_MAX_WIDTH; w++) {
+        if (stats->width[w]) fprintf(stderr, "lcp values with %2lu bits = %lu\n",w,stats->width[w]);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SB_LCP_H
+#define SB_LCP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "sb_pagecache.h"
+#include "sb_textstore.h"
+
+#define SBLCP_MAX_WIDTH		65
+
+/* statistics gathered while the lcp array is built */
+typedef struct {
+    uint64_t n;                         /* number of lcp values */
+    uint64_t max_lcp;                   /* largest lcp of two adjacent suffixes */
+    uint64_t sum_lcp;                   /* sum of all lcp values */
+    uint64_t width[SBLCP_MAX_WIDTH];    /* width[w] = number of lcp values needing w bits */
+} sblcp_stats_t;
+
+/* construction */
+uint64_t sblcp_build(const uint8_t* T,uint64_t n,const char* sa_file,const char* lcp_file,sblcp_stats_t* stats);
+uint64_t sblcp_build_external(sbtextstore_t* text,const char* sa_file,const char* lcp_file,uint64_t budget,
+                              sblcp_stats_t* stats);
+void     sblcp_printstats(const sblcp_stats_t* stats);
+
+/* helper functions */
+uint64_t sblcp_width(uint64_t x);
+void     sblcp_record(sblcp_stats_t* stats,uint64_t lcp);
+uint64_t sblcp_cached_lcp(sbpagecache_t* pc,uint64_t n,uint64_t i,uint64_t j);
+
+#endif
@@ -0,0 +1,154 @@
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SBMATCH_X86 1
+#endif
+
+#include "sb_match.h"
+
+/* number of equal leading bytes of a and b, which differ. little endian */
+static inline uint64_t
+sbmatch_word_lcp(uint64_t a,uint64_t b)
+{
+    return __builtin_ctzll(a ^ b) >> 3;
+}
+
+/* compares the last len < 16 bytes 8 at a time, then byte by byte */
+static inline uint64_t
+sbmatch_lcp_tail(const uint8_t* a,const uint8_t* b,uint64_t len)
+{
+    uint64_t i = 0;
+    for (; i+8 <= len; i += 8) {
+        uint64_t wa, wb;
+        memcpy(&wa,a+i,8);
+        memcpy(&wb,b+i,8);
+        if (wa != wb) return i + sbmatch_word_lcp(wa,wb);
+    }
+    while (i < len && a[i] == b[i]) i++;
+    return i;
+}
+
+/* returns the number of leading bytes a[0,len) and b[0,len) have in common */
+uint64_t
+sbmatch_lcp_scalar(const uint8_t* a,const uint8_t* b,uint64_t len)
+{
+    uint64_t i = 0;
+    for (; i+16 <= len; i += 16) {
+        uint64_t l = sbmatch_lcp_tail(a+i,b+i,16);
+        if (l < 16) return i + l;
+    }
+    return i + sbmatch_lcp_tail(a+i,b+i,len-i);
+}
+
+#ifdef SBMATCH_X86
+
+/* 16 bytes per step */
+uint64_t
+sbmatch_lcp_sse2(const uint8_t* a,const uint8_t* b,uint64_t len)
+{
+    uint64_t i = 0;
+    for (; i+16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+        uint32_t ne = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(va,vb)) & 0xFFFF;
+        if (ne) return i + __builtin_ctz(ne);
+    }
+    return i + sbmatch_lcp_tail(a+i,b+i,len-i);
+}
+
+/* 32 bytes per step. only called if the cpu supports avx2 */
+__attribute__((target("avx2")))
+uint64_t
+sbmatch_lcp_avx2(const uint8_t* a,const uint8_t* b,uint64_t len)
+{
+    uint64_t i = 0;
+    for (; i+32 <= len; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a+i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b+i));
+        uint32_t ne = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va,vb));
+        if (ne) return i + __builtin_ctz(ne);
+    }
+    if (i+16 <= len) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+        uint32_t ne = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(va,vb)) & 0xFFFF;
+        if (ne) return i + __builtin_ctz(ne);
+        i += 16;
+    }
+    return i + sbmatch_lcp_tail(a+i,b+i,len-i);
+}
+
+int
+sbmatch_has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+uint64_t
+sbmatch_lcp_sse2(const uint8_t* a,const uint8_t* b,uint64_t len)
+{
+    return sbmatch_lcp_scalar(a,b,len);
+}
+
+uint64_t
+sbmatch_lcp_avx2(const uint8_t* a,const uint8_t* b,uint64_t len)
+{
+    return sbmatch_lcp_scalar(a,b,len);
+}
+
+int
+sbmatch_has_avx2()
+{
+    return 0;
+}
+
+#endif
+
+/* the widest kernel the cpu supports */
+sbmatch_lcp_fn
+sbmatch_resolve()
+{
+#ifdef SBMATCH_X86
+    if (sbmatch_has_avx2()) return sbmatch_lcp_avx2;
+    return sbmatch_lcp_sse2;
+#else
+    return sbmatch_lcp_scalar;
+#endif
+}
+
+/* returns the number of leading bytes a[0,len) and b[0,len) have in common */
+uint64_t
+sbmatch_lcp(const uint8_t* a,const uint8_t* b,uint64_t len)
+{
+    static const sbmatch_lcp_fn lcp = sbmatch_resolve();
+    return lcp(a,b,len);
+}
+
+/* crit bit position of the suffixes j and k of T[0,n) (byte pos<<3 + bit pos
+   in the byte, counted from the most significant bit) which are known to
+   share l bytes. a suffix that ended compares as 0 bytes. if the suffixes
+   only differ in their length the position of the end of the longer one is
+   returned */
+uint64_t
+sbmatch_critbit(const uint8_t* T,uint64_t n,uint64_t j,uint64_t k,uint64_t l)
+{
+    uint64_t lj = n - j, lk = n - k;
+    uint64_t common = std::min(lj,lk);
+    if (l < common) {
+        l += sbmatch_lcp(T+j+l,T+k+l,common-l);
+        if (l < common) return (l<<3) + __builtin_clz(T[j+l]^T[k+l]) - 24;
+    }
+
+    /* the shorter suffix ended. the longer one differs at its first non 0 byte */
+    const uint8_t* rest = T + ((lj > lk) ? j : k);
+    uint64_t len = std::max(lj,lk);
+    while (l < len && rest[l] == 0) l++;
+    if (l < len) return (l<<3) + __builtin_clz(rest[l]) - 24;
+    return l<<3;
+}
@@ -0,0 +1,29 @@
+#ifndef SB_MATCH_H
+#define SB_MATCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* first mismatch kernels for the text comparisons of the build and the search.
+   sbmatch_lcp compares 32 (avx2) or 16 (sse2) bytes per step, the
+   implementation is picked on the first call from the features of the cpu.
+   no kernel reads a byte outside of the compared ranges, so they are safe at
+   the end of the text and of a mapped block.
+
+   pcmpistri is not used: it stops at the first 0 byte, and the texts we index
+   may contain any byte. */
+typedef uint64_t (*sbmatch_lcp_fn)(const uint8_t* a,const uint8_t* b,uint64_t len);
+
+/* comparisons */
+uint64_t        sbmatch_lcp(const uint8_t* a,const uint8_t* b,uint64_t len);
+uint64_t        sbmatch_critbit(const uint8_t* T,uint64_t n,uint64_t j,uint64_t k,uint64_t l);
+
+/* helper functions */
+sbmatch_lcp_fn  sbmatch_resolve();
+uint64_t        sbmatch_lcp_scalar(const uint8_t* a,const uint8_t* b,uint64_t len);
+uint64_t        sbmatch_lcp_sse2(const uint8_t* a,const uint8_t* b,uint64_t len);
+uint64_t        sbmatch_lcp_avx2(const uint8_t* a,const uint8_t* b,uint64_t len);
+int             sbmatch_has_avx2();
+
+#endif
@@ -0,0 +1,254 @@
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+#include "sb_pagecache.h"
+#include "sb_util.h"
+
+/* create a page cache using at most budget bytes of page memory */
+sbpagecache_t*
+sbpagecache_create(int fd,uint64_t B,uint64_t budget)
+{
+    sbpagecache_t* pc = (sbpagecache_t*) sb_malloc(sizeof(sbpagecache_t));
+    pc->fd = fd;
+    pc->B = B;
+    struct stat st;
+    if (fstat(fd,&st) != 0) {
+        fprintf(stderr, "cannot stat file of the page cache\n");
+        exit(EXIT_FAILURE);
+    }
+    pc->size = st.st_size;
+    pc->nframes = budget/B;
+    if (pc->nframes < SBPAGECACHE_MIN_FRAMES) pc->nframes = SBPAGECACHE_MIN_FRAMES;
+
+    if (posix_memalign((void**)&pc->mem,4096,pc->nframes*B) != 0) {
+        fprintf(stderr, "error allocating %lu bytes of page cache memory\n",pc->nframes*B);
+        exit(EXIT_FAILURE);
+    }
+    pc->frames = (sbpagecache_frame_t*) sb_malloc(pc->nframes*sizeof(sbpagecache_frame_t));
+    for (uint64_t i=0; i<pc->nframes; i++) pc->frames[i].offset = SBPAGECACHE_EMPTY;
+
+    /* the hash table is kept at most half full */
+    uint64_t table_size = 1;
+    while (table_size < 2*pc->nframes) table_size <<= 1;
+    pc->table = (uint64_t*) sb_malloc(table_size*sizeof(uint64_t));
+    pc->table_mask = table_size-1;
+    omp_init_lock(&pc->lock);
+
+    return pc;
+}
+
+void
+sbpagecache_free(sbpagecache_t* pc)
+{
+    if (pc) {
+        omp_destroy_lock(&pc->lock);
+        free(pc->mem);
+        free(pc->frames);
+        free(pc->table);
+        free(pc);
+    }
+}
+
+/* read pages through load instead of from the file. size is the size of the
+   data the pages are taken from */
+void
+sbpagecache_set_loader(sbpagecache_t* pc,sbpagecache_loader_t load,void* arg,uint64_t size)
+{
+    pc->load = load;
+    pc->load_arg = arg;
+    pc->size = size;
+}
+
+static inline uint64_t
+sbpagecache_hash(const sbpagecache_t* pc,uint64_t offset)
+{
+    return (offset*0x9E3779B97F4A7C15) >> 20 & pc->table_mask;
+}
+
+/* returns the frame holding the page at offset or SBPAGECACHE_EMPTY.
+   without the lock the result is only a hint: the frame may have been
+   reused meanwhile, and an entry moved by sbpagecache_remove may be missed */
+uint64_t
+sbpagecache_lookup(const sbpagecache_t* pc,uint64_t offset)
+{
+    uint64_t slot = sbpagecache_hash(pc,offset);
+    uint64_t entry;
+    while ((entry = __atomic_load_n(&pc->table[slot],__ATOMIC_ACQUIRE))) {
+        uint64_t frame = entry-1;
+        if (__atomic_load_n(&pc->frames[frame].offset,__ATOMIC_ACQUIRE) == offset) return frame;
+        slot = (slot+1) & pc->table_mask;
+    }
+    return SBPAGECACHE_EMPTY;
+}
+
+void
+sbpagecache_insert(sbpagecache_t* pc,uint64_t frame)
+{
+    uint64_t slot = sbpagecache_hash(pc,pc->frames[frame].offset);
+    while (pc->table[slot]) slot = (slot+1) & pc->table_mask;
+    __atomic_store_n(&pc->table[slot],frame+1,__ATOMIC_RELEASE);
+}
+
+/* remove the frame from the hash table. linear probing, so we shift
+   back all following entries which would otherwise become unreachable */
+void
+sbpagecache_remove(sbpagecache_t* pc,uint64_t frame)
+{
+    uint64_t slot = sbpagecache_hash(pc,pc->frames[frame].offset);
+    while (pc->table[slot] != frame+1) slot = (slot+1) & pc->table_mask;
+    __atomic_store_n(&pc->table[slot],0,__ATOMIC_RELEASE);
+
+    uint64_t next = (slot+1) & pc->table_mask;
+    while (pc->table[next]) {
+        uint64_t home = sbpagecache_hash(pc,pc->frames[pc->table[next]-1].offset);
+        /* move the entry if its home slot is not within (slot,next] */
+        if (((next-home) & pc->table_mask) >= ((next-slot) & pc->table_mask)) {
+            __atomic_store_n(&pc->table[slot],pc->table[next],__ATOMIC_RELEASE);
+            __atomic_store_n(&pc->table[next],0,__ATOMIC_RELEASE);
+            slot = next;
+        }
+        next = (next+1) & pc->table_mask;
+    }
+}
+
+/* find a frame to reuse with the CLOCK algorithm: pages referenced since the
+   hand last passed get a second chance. pinned pages are skipped. the frame
+   is returned claimed (see SBPAGECACHE_CLAIMED) and removed from the table.
+   returns SBPAGECACHE_EMPTY if all frames are pinned. the lock has to be held */
+uint64_t
+sbpagecache_evict(sbpagecache_t* pc)
+{
+    for (uint64_t i=0; i<2*pc->nframes; i++) {
+        sbpagecache_frame_t* f = &pc->frames[pc->hand];
+        uint64_t frame = pc->hand;
+        pc->hand = (pc->hand+1) % pc->nframes;
+        if (__atomic_load_n(&f->pins,__ATOMIC_ACQUIRE)) continue;
+        if (__atomic_load_n(&f->ref,__ATOMIC_RELAXED)) {
+            __atomic_store_n(&f->ref,0,__ATOMIC_RELAXED);
+            continue;
+        }
+        /* a lock-free hit may pin the frame right now */
+        uint32_t unpinned = 0;
+        if (!__atomic_compare_exchange_n(&f->pins,&unpinned,SBPAGECACHE_CLAIMED,false,
+                                         __ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)) continue;
+        if (f->offset != SBPAGECACHE_EMPTY) sbpagecache_remove(pc,frame);
+        return frame;
+    }
+    return SBPAGECACHE_EMPTY;
+}
+
+/* pins frame if it still holds the page at offset. returns 0 if the frame
+   is being evicted or was reused for another page */
+int
+sbpagecache_trypin(sbpagecache_t* pc,uint64_t frame,uint64_t offset)
+{
+    sbpagecache_frame_t* f = &pc->frames[frame];
+    uint32_t pins = __atomic_load_n(&f->pins,__ATOMIC_ACQUIRE);
+    do {
+        if (pins == SBPAGECACHE_CLAIMED) return 0;
+    } while (!__atomic_compare_exchange_n(&f->pins,&pins,pins+1,true,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE));
+
+    /* the offset cannot change while we hold the pin */
+    if (__atomic_load_n(&f->offset,__ATOMIC_ACQUIRE) != offset) {
+        __atomic_fetch_sub(&f->pins,1,__ATOMIC_ACQ_REL);
+        return 0;
+    }
+    if (!__atomic_load_n(&f->ref,__ATOMIC_RELAXED)) __atomic_store_n(&f->ref,1,__ATOMIC_RELAXED);
+    return 1;
+}
+
+/* non-blocking page access. returns NULL and sets status to SBPAGECACHE_BUSY if
+   the page is currently read by someone else or all frames are pinned. on
+   SBPAGECACHE_MISS the frame is pinned but empty: the caller has to read the page
+   into it (e.g. asynchronously) and then call sbpagecache_loaded */
+const uint8_t*
+sbpagecache_pin_async(sbpagecache_t* pc,uint64_t offset,int* status)
+{
+    /* hit: no lock. if the lookup races with a change of the table we look
+       again under the lock, which keeps the table and the offsets fixed */
+    uint64_t frame = sbpagecache_lookup(pc,offset);
+    int pinned = (frame != SBPAGECACHE_EMPTY && sbpagecache_trypin(pc,frame,offset));
+    if (!pinned) {
+        omp_set_lock(&pc->lock);
+        frame = sbpagecache_lookup(pc,offset);
+        if (frame != SBPAGECACHE_EMPTY) {
+            pinned = sbpagecache_trypin(pc,frame,offset);
+            omp_unset_lock(&pc->lock);
+            if (!pinned) {
+                *status = SBPAGECACHE_BUSY;
+                return NULL;
+            }
+        }
+    }
+    if (pinned) {
+        if (__atomic_load_n(&pc->frames[frame].loading,__ATOMIC_ACQUIRE)) {
+            sbpagecache_unpin(pc,pc->mem + frame*pc->B);
+            *status = SBPAGECACHE_BUSY;
+            return NULL;
+        }
+        __atomic_fetch_add(&pc->hits,1,__ATOMIC_RELAXED);
+        *status = SBPAGECACHE_HIT;
+        return pc->mem + frame*pc->B;
+    }
+
+    /* miss. the lock is held */
+    frame = sbpagecache_evict(pc);
+    if (frame == SBPAGECACHE_EMPTY) {
+        omp_unset_lock(&pc->lock);
+        *status = SBPAGECACHE_BUSY;
+        return NULL;
+    }
+    /* the frame is claimed: hits cannot pin it till the pin count is set */
+    sbpagecache_frame_t* f = &pc->frames[frame];
+    __atomic_store_n(&f->offset,offset,__ATOMIC_RELEASE);
+    __atomic_store_n(&f->ref,1,__ATOMIC_RELAXED);
+    __atomic_store_n(&f->loading,1,__ATOMIC_RELEASE);
+    sbpagecache_insert(pc,frame);
+    __atomic_store_n(&f->pins,1,__ATOMIC_RELEASE);
+    pc->misses++;
+    omp_unset_lock(&pc->lock);
+    *status = SBPAGECACHE_MISS;
+    return pc->mem + frame*pc->B;
+}
+
+/* the page returned with SBPAGECACHE_MISS has been read */
+void
+sbpagecache_loaded(sbpagecache_t* pc,const uint8_t* page)
+{
+    uint64_t frame = (page - pc->mem)/pc->B;
+    __atomic_store_n(&pc->frames[frame].loading,0,__ATOMIC_RELEASE);
+}
+
+/* returns the B bytes at offset and pins them in memory till sbpagecache_unpin.
+   miss is set to 1 if the page had to be read from disk. if the page is read by
+   another thread or all frames are in use we wait */
+const uint8_t*
+sbpagecache_pin(sbpagecache_t* pc,uint64_t offset,int* miss)
+{
+    int status;
+    const uint8_t* page;
+    while ((page = sbpagecache_pin_async(pc,offset,&status)) == NULL) sched_yield();
+
+    *miss = (status == SBPAGECACHE_MISS);
+    if (*miss) {
+        uint64_t len = pc->B;
+        if (offset + len > pc->size) len = pc->size - offset;
+        if (pc->load) {
+            pc->load(pc->load_arg,offset,(uint8_t*)page,len);
+        } else if (pread(pc->fd,(void*)page,len,offset) != (ssize_t)len) {
+            fprintf(stderr, "error reading page at offset %lu\n",offset);
+            exit(EXIT_FAILURE);
+        }
+        sbpagecache_loaded(pc,page);
+    }
+    return page;
+}
+
+void
+sbpagecache_unpin(sbpagecache_t* pc,const uint8_t* page)
+{
+    uint64_t frame = (page - pc->mem)/pc->B;
+    __atomic_fetch_sub(&pc->frames[frame].pins,1,__ATOMIC_ACQ_REL);
+}
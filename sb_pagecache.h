@@ -0,0 +1,81 @@
+#ifndef SB_PAGECACHE_H
+#define SB_PAGECACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <omp.h>
+
+#define SBPAGECACHE_MIN_FRAMES  8
+#define SBPAGECACHE_EMPTY       0xFFFFFFFFFFFFFFFF
+#define SBPAGECACHE_CLAIMED     0xFFFFFFFF  /* pins of a frame being evicted */
+
+/* result of sbpagecache_pin_async */
+#define SBPAGECACHE_HIT         0
+#define SBPAGECACHE_MISS        1
+#define SBPAGECACHE_BUSY        2
+
+/* a cached disk page */
+typedef struct {
+    uint64_t offset;    /* file offset of the page. SBPAGECACHE_EMPTY if unused */
+    uint32_t pins;      /* number of current users. pinned frames are never evicted.
+                           SBPAGECACHE_CLAIMED while the frame changes its page */
+    uint32_t ref;       /* CLOCK reference bit */
+    uint32_t loading;   /* 1 while the page is read from disk */
+} sbpagecache_frame_t;
+
+/* reads the len bytes of the page at offset. replaces pread for files whose
+   pages have to be decoded, e.g. compressed text */
+typedef void (*sbpagecache_loader_t)(void* arg,uint64_t offset,uint8_t* page,uint64_t len);
+
+/* fixed size page cache over a file. pages are identified by their file offset
+   and replaced using the CLOCK algorithm.
+
+   the cache can be shared by multiple threads. hits take no lock: the hash
+   table is probed with atomic loads and the frame is pinned by a CAS on its
+   pin count, which fails while an evicting thread has claimed the frame.
+   once pinned, the frame cannot change its page, so the offset is checked
+   again after pinning. lookups that find nothing or race with a change of
+   the table fall back to the locked path.
+
+   misses and evictions are serialized by lock. the evicting thread claims an
+   unpinned frame by swapping its pin count from 0 to SBPAGECACHE_CLAIMED and
+   only then changes the offset and the table. disk reads happen outside the
+   lock: the frame is pinned and marked as loading, other threads requesting
+   the same page wait till the read is done. */
+typedef struct {
+    omp_lock_t lock;                /* serializes changes of table, frames and hand */
+    int fd;                         /* file the pages are read from */
+    uint64_t B;                     /* page size */
+    uint64_t size;                  /* file size. the last page may be shorter than B */
+    uint64_t nframes;               /* number of pages that fit into the cache */
+    uint8_t* mem;                   /* nframes*B bytes of page memory */
+    sbpagecache_frame_t* frames;    /* frame descriptors */
+    uint64_t* table;                /* hash table: offset -> frame+1. 0 = empty slot */
+    uint64_t table_mask;            /* hash table size - 1 */
+    uint64_t hand;                  /* CLOCK hand */
+    uint64_t hits;                  /* requests served from memory */
+    uint64_t misses;                /* requests that had to read from disk */
+    sbpagecache_loader_t load;      /* reads a page. NULL = pread from fd */
+    void* load_arg;                 /* first argument of load */
+} sbpagecache_t;
+
+/* create / destroy */
+sbpagecache_t* sbpagecache_create(int fd,uint64_t B,uint64_t budget);
+void           sbpagecache_free(sbpagecache_t* pc);
+void           sbpagecache_set_loader(sbpagecache_t* pc,sbpagecache_loader_t load,void* arg,uint64_t size);
+
+/* page access */
+const uint8_t* sbpagecache_pin(sbpagecache_t* pc,uint64_t offset,int* miss);
+void           sbpagecache_unpin(sbpagecache_t* pc,const uint8_t* page);
+const uint8_t* sbpagecache_pin_async(sbpagecache_t* pc,uint64_t offset,int* status);
+void           sbpagecache_loaded(sbpagecache_t* pc,const uint8_t* page);
+
+/* helper functions */
+uint64_t       sbpagecache_lookup(const sbpagecache_t* pc,uint64_t offset);
+void           sbpagecache_insert(sbpagecache_t* pc,uint64_t frame);
+void           sbpagecache_remove(sbpagecache_t* pc,uint64_t frame);
+uint64_t       sbpagecache_evict(sbpagecache_t* pc);
+int            sbpagecache_trypin(sbpagecache_t* pc,uint64_t frame,uint64_t offset);
+
+#endif
@@ -0,0 +1,343 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "sb_sa.h"
+#include "sb_util.h"
+
+/* the first 8 bytes of T as a big endian integer. missing bytes are 0 */
+uint64_t
+sbsa_key(const uint8_t* T,uint64_t len)
+{
+    uint64_t key = 0;
+    for (uint64_t i=0; i<8; i++) {
+        key <<= 8;
+        if (i < len) key |= T[i];
+    }
+    return key;
+}
+
+/* the 8 bytes at pos of the text cached in pc as a big endian integer.
+   missing bytes are 0 */
+uint64_t
+sbsa_cached_key(sbpagecache_t* pc,uint64_t n,uint64_t pos)
+{
+    uint8_t buf[8];
+    uint64_t len = std::min((uint64_t)8,n-pos);
+    uint64_t i = 0;
+    int miss;
+    while (i < len) {
+        uint64_t o = (pos+i) % pc->B;
+        const uint8_t* page = sbpagecache_pin(pc,pos+i-o,&miss);
+        uint64_t span = std::min(pc->B-o,len-i);
+        memcpy(buf+i,page+o,span);
+        sbpagecache_unpin(pc,page);
+        i += span;
+    }
+    return sbsa_key(buf,len);
+}
+
+/* compare the suffixes a and b, which are equal in their first depth bytes,
+   by their keys: the next 8 bytes of both. a suffix that ends first is
+   smaller. returns <0 or >0 like memcmp, and 0 if the keys are equal and both
+   suffixes go on. never touches the text */
+int
+sbsa_compare(uint64_t n,uint64_t depth,const sbsa_entry_t* a,const sbsa_entry_t* b)
+{
+    if (a->pos == b->pos) return 0;
+    /* the key of a suffix ending inside it is padded with 0 bytes */
+    uint64_t la = n - a->pos - depth, lb = n - b->pos - depth;
+    if (a->key != b->key) {
+        uint64_t lcp = __builtin_clzll(a->key ^ b->key) >> 3;
+        if (lcp >= la || lcp >= lb) return (la < lb) ? -1 : 1;
+        return (a->key < b->key) ? -1 : 1;
+    }
+    if (la <= 8 || lb <= 8) return (la < lb) ? -1 : 1;
+    return 0;
+}
+
+/* lcp of the suffixes a and b, whose keys hold their first 8 bytes. longer lcps
+   are read through the text cache */
+uint64_t
+sbsa_lcp(sbpagecache_t* pc,uint64_t n,const sbsa_entry_t* a,const sbsa_entry_t* b)
+{
+    if (a->pos == b->pos) return n - a->pos;
+    uint64_t la = n - a->pos, lb = n - b->pos;
+    if (a->key != b->key) return std::min((uint64_t)__builtin_clzll(a->key ^ b->key) >> 3,std::min(la,lb));
+    if (la <= 8 || lb <= 8) return std::min(la,lb);
+    return 8 + sblcp_cached_lcp(pc,n,a->pos+8,b->pos+8);
+}
+
+/* orders entries by their keys at a common depth */
+struct sbsa_less {
+    uint64_t n;
+    uint64_t depth;
+    bool operator()(const sbsa_entry_t& a,const sbsa_entry_t& b) const {
+        return sbsa_compare(n,depth,&a,&b) < 0;
+    }
+};
+
+static bool
+sbsa_less_pos(const sbsa_entry_t& a,const sbsa_entry_t& b)
+{
+    return a.pos < b.pos;
+}
+
+/* push the groups of e[start,end) the keys at depth cannot order */
+static void
+sbsa_push_ties(std::vector<uint64_t>& stack,const sbsa_entry_t* e,uint64_t start,uint64_t end,uint64_t n,uint64_t depth)
+{
+    for (uint64_t i=start; i<end;) {
+        uint64_t j = i+1;
+        while (j < end && sbsa_compare(n,depth,&e[i],&e[j]) == 0) j++;
+        if (j-i > 1) {
+            stack.push_back(i);
+            stack.push_back(j);
+            stack.push_back(depth+8);
+        }
+        i = j;
+    }
+}
+
+/* sort e[0,len), which are equal in their first depth bytes and share one key.
+   a group of ties is sorted by position, gets the next 8 bytes of its suffixes
+   as keys, read in text order, and is sorted by them. groups still tied are
+   extended again. the shared key is restored at the end */
+void
+sbsa_resolve(sbpagecache_t* pc,uint64_t n,sbsa_entry_t* e,uint64_t len,uint64_t depth)
+{
+    if (len < 2) return;
+    uint64_t key = e[0].key;
+    std::vector<uint64_t> stack;
+    stack.push_back(0);
+    stack.push_back(len);
+    stack.push_back(depth);
+    while (!stack.empty()) {
+        uint64_t d = stack.back(); stack.pop_back();
+        uint64_t end = stack.back(); stack.pop_back();
+        uint64_t start = stack.back(); stack.pop_back();
+        std::sort(e+start,e+end,sbsa_less_pos);
+        for (uint64_t i=start; i<end; i++) e[i].key = sbsa_cached_key(pc,n,e[i].pos+d);
+        sbsa_less less = {n,d};
+        std::sort(e+start,e+end,less);
+        sbsa_push_ties(stack,e,start,end,n,d);
+    }
+    for (uint64_t i=0; i<len; i++) e[i].key = key;
+}
+
+/* sort the entries e[0,len) by their suffixes. the keys order most of them,
+   the ties are resolved group by group */
+void
+sbsa_sort(sbpagecache_t* pc,uint64_t n,sbsa_entry_t* e,uint64_t len)
+{
+    sbsa_less less = {n,0};
+    std::sort(e,e+len,less);
+    for (uint64_t i=0; i<len;) {
+        uint64_t j = i+1;
+        while (j < len && sbsa_compare(n,0,&e[i],&e[j]) == 0) j++;
+        sbsa_resolve(pc,n,e+i,j-i,8);
+        i = j;
+    }
+}
+
+/* orders the run ids in the merge heap by the keys of their heads. the
+   smallest suffix is on top */
+struct sbsa_heap_cmp {
+    uint64_t n;
+    const sbsa_entry_t* head;
+    bool operator()(uint64_t a,uint64_t b) const {
+        return sbsa_compare(n,0,&head[b],&head[a]) < 0;
+    }
+};
+
+/* next entry of a run. returns 0 if the run is exhausted */
+int
+sbsa_run_next(sbsa_run_t* run,sbsa_entry_t* e)
+{
+    if (run->next == run->nbuf) {
+        run->nbuf = sbtmpfile_read_block(run->file,(uint64_t*)run->buf,2*SBSA_MERGE_BUF)/2;
+        run->next = 0;
+        if (run->nbuf == 0) return 0;
+    }
+    *e = run->buf[run->next++];
+    return 1;
+}
+
+/* sort the suffixes of text_file into runs and set up their merge, using
+   about budget bytes.
+
+   the text is cut into blocks. the suffixes starting in a block are sorted in
+   memory and written as a sorted run. the runs are merged with a heap, see
+   sbsa_merge_read. suffixes carry the first 8 bytes of their text, so the
+   comparisons of the sort and of the heap never touch the text. suffixes the
+   keys cannot order are resolved apart from them by reading on through a text
+   cache using half of the budget. the lcp values handed out are recorded in
+   stats, which have to stay valid till the merge is closed */
+sbsa_merge_t*
+sbsa_merge_open(const char* text_file,uint64_t budget,sblcp_stats_t* stats)
+{
+    memset(stats,0,sizeof(sblcp_stats_t));
+    sbsa_merge_t* merge = (sbsa_merge_t*) sb_malloc(sizeof(sbsa_merge_t));
+    merge->textstore = sbtextstore_open(text_file);
+    uint64_t n = merge->textstore->n;
+    merge->n = stats->n = n;
+    merge->stats = stats;
+    merge->pc = sbtextstore_cache(merge->textstore,SBSA_TEXT_BLOCK,budget/2);
+
+    /* create the sorted runs */
+    uint64_t run_len = std::max((uint64_t)SBSA_MIN_RUN,budget/2/(sizeof(sbsa_entry_t)+1));
+    if (run_len > n) run_len = n;
+    sbsa_entry_t* entries = (sbsa_entry_t*) sb_malloc(run_len*sizeof(sbsa_entry_t));
+    uint8_t* text = (uint8_t*) sb_malloc(run_len+8);
+    merge->nruns = run_len ? (n+run_len-1)/run_len : 0;
+    merge->runs = (sbsa_run_t*) sb_malloc(merge->nruns*sizeof(sbsa_run_t));
+    for (uint64_t r=0; r<merge->nruns; r++) {
+        uint64_t start = r*run_len;
+        uint64_t len = std::min(run_len,n-start);
+        uint64_t tlen = std::min(len+8,n-start);
+        sbtextstore_read(merge->textstore,start,tlen,text);
+        for (uint64_t i=0; i<len; i++) {
+            entries[i].pos = start+i;
+            entries[i].key = sbsa_key(text+i,tlen-i);
+        }
+        sbsa_sort(merge->pc,n,entries,len);
+
+        sbsa_run_t* run = &merge->runs[r];
+        run->file = sbtmpfile_create_write();
+        sbtmpfile_write_block(run->file,(uint64_t*)entries,2*len);
+        sbtmpfile_finish(run->file);
+        sbtmpfile_open_read(run->file);
+        run->buf = NULL;
+        run->nbuf = run->next = 0;
+    }
+    free(entries);
+    free(text);
+    fprintf(stderr, "sorted %lu runs of %lu suffixes\n",merge->nruns,run_len);
+
+    /* the heads of the runs */
+    merge->head = (sbsa_entry_t*) sb_malloc(merge->nruns*sizeof(sbsa_entry_t));
+    merge->heap = (uint64_t*) sb_malloc(merge->nruns*sizeof(uint64_t));
+    merge->tied = (sbsa_entry_t*) sb_malloc(merge->nruns*sizeof(sbsa_entry_t));
+    merge->ids = (uint64_t*) sb_malloc(merge->nruns*sizeof(uint64_t));
+    merge->nheap = 0;
+    merge->total = 0;
+    sbsa_heap_cmp cmp = {n,merge->head};
+    for (uint64_t r=0; r<merge->nruns; r++) {
+        merge->runs[r].buf = (sbsa_entry_t*) sb_malloc(SBSA_MERGE_BUF*sizeof(sbsa_entry_t));
+        if (sbsa_run_next(&merge->runs[r],&merge->head[r])) {
+            merge->heap[merge->nheap++] = r;
+            std::push_heap(merge->heap,merge->heap+merge->nheap,cmp);
+        }
+    }
+    return merge;
+}
+
+/* the next at most max entries of the suffix array and of the lcp array.
+   returns fewer only once the merge is done */
+uint64_t
+sbsa_merge_read(sbsa_merge_t* merge,uint64_t* sa,uint64_t* lcp,uint64_t max)
+{
+    uint64_t n = merge->n;
+    uint64_t* heap = merge->heap;
+    sbsa_entry_t* head = merge->head;
+    sbsa_heap_cmp cmp = {n,head};
+    uint64_t nout = 0;
+    while (nout < max && merge->nheap) {
+        std::pop_heap(heap,heap+merge->nheap,cmp);
+        uint64_t r = heap[--merge->nheap];
+
+        /* heads the keys cannot tell apart from the top are resolved together */
+        if (merge->nheap && sbsa_compare(n,0,&head[heap[0]],&head[r]) == 0) {
+            uint64_t ntied = 0;
+            merge->tied[ntied] = head[r];
+            merge->ids[ntied++] = r;
+            while (merge->nheap && sbsa_compare(n,0,&head[heap[0]],&head[r]) == 0) {
+                std::pop_heap(heap,heap+merge->nheap,cmp);
+                merge->nheap--;
+                merge->tied[ntied] = head[heap[merge->nheap]];
+                merge->ids[ntied++] = heap[merge->nheap];
+            }
+            sbsa_resolve(merge->pc,n,merge->tied,ntied,8);
+            for (uint64_t i=0; i<ntied; i++) {
+                if (head[merge->ids[i]].pos == merge->tied[0].pos) {
+                    r = merge->ids[i];
+                } else {
+                    heap[merge->nheap++] = merge->ids[i];
+                    std::push_heap(heap,heap+merge->nheap,cmp);
+                }
+            }
+        }
+        sbsa_entry_t cur = head[r];
+        if (sbsa_run_next(&merge->runs[r],&head[r])) {
+            heap[merge->nheap++] = r;
+            std::push_heap(heap,heap+merge->nheap,cmp);
+        }
+
+        uint64_t l = 0;
+        if (merge->total) l = sbsa_lcp(merge->pc,n,&merge->prev,&cur);
+        sblcp_record(merge->stats,l);
+        sa[nout] = cur.pos;
+        lcp[nout] = l;
+        nout++;
+        merge->total++;
+        merge->prev = cur;
+    }
+    return nout;
+}
+
+void
+sbsa_merge_close(sbsa_merge_t* merge)
+{
+    if (merge) {
+        for (uint64_t r=0; r<merge->nruns; r++) {
+            free(merge->runs[r].buf);
+            sbtmpfile_delete(merge->runs[r].file);
+        }
+        free(merge->runs);
+        free(merge->head);
+        free(merge->heap);
+        free(merge->tied);
+        free(merge->ids);
+        sbpagecache_free(merge->pc);
+        sbtextstore_close(merge->textstore);
+        free(merge);
+    }
+}
+
+/* build the suffix array of text_file and its lcp array using about budget
+   bytes (see sbsa_merge_open) and write them to sa_file and lcp_file.
+   returns the max lcp */
+uint64_t
+sbsa_build(const char* text_file,const char* sa_file,const char* lcp_file,uint64_t budget,sblcp_stats_t* stats)
+{
+    sblcp_stats_t local;
+    if (!stats) stats = &local;
+    sbsa_merge_t* merge = sbsa_merge_open(text_file,budget,stats);
+
+    FILE* sa_out = fopen(sa_file,"w");
+    FILE* lcp_out = fopen(lcp_file,"w");
+    if (!sa_out || !lcp_out) {
+        fprintf(stderr, "cannot open output files '%s' and '%s'\n",sa_file,lcp_file);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t* sa_buf = (uint64_t*) sb_malloc(SBSA_MERGE_BUF*sizeof(uint64_t));
+    uint64_t* lcp_buf = (uint64_t*) sb_malloc(SBSA_MERGE_BUF*sizeof(uint64_t));
+    uint64_t nout;
+    while ((nout = sbsa_merge_read(merge,sa_buf,lcp_buf,SBSA_MERGE_BUF)) > 0) {
+        if (fwrite(sa_buf,sizeof(uint64_t),nout,sa_out) != nout ||
+            fwrite(lcp_buf,sizeof(uint64_t),nout,lcp_out) != nout) {
+            fprintf(stderr, "error writing suffix array.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(sa_out);
+    fclose(lcp_out);
+    free(sa_buf);
+    free(lcp_buf);
+    sbsa_merge_close(merge);
+
+    return stats->max_lcp;
+}
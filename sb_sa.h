@@ -0,0 +1,67 @@
+#ifndef SB_SA_H
+#define SB_SA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "sb_pagecache.h"
+#include "sb_tmpfile.h"
+#include "sb_lcp.h"
+#include "sb_textstore.h"
+
+#define SBSA_TEXT_BLOCK		4096
+#define SBSA_MIN_RUN		4096
+#define SBSA_MERGE_BUF		1024
+
+/* a suffix together with 8 bytes of its text as a big endian integer. most
+   comparisons are decided by the key alone. while ties are resolved the key
+   holds the bytes at the depth of the tied group */
+typedef struct {
+    uint64_t pos;
+    uint64_t key;
+} sbsa_entry_t;
+
+/* sorted run of suffixes on disk and the buffered part of it during the merge */
+typedef struct {
+    sbtmpfile_t* file;
+    sbsa_entry_t* buf;
+    uint64_t nbuf;
+    uint64_t next;
+} sbsa_run_t;
+
+/* merge of the sorted runs. hands out the suffix array and the lcp array
+   in order, block by block */
+typedef struct {
+    sbtextstore_t* textstore;
+    sbpagecache_t* pc;          /* text cache resolving ties and long lcps */
+    uint64_t n;
+    sbsa_run_t* runs;
+    uint64_t nruns;
+    sbsa_entry_t* head;         /* current head of each run */
+    uint64_t* heap;             /* runs not exhausted, the smallest head on top */
+    uint64_t nheap;
+    sbsa_entry_t* tied;         /* heads resolved together */
+    uint64_t* ids;
+    sbsa_entry_t prev;          /* last suffix handed out */
+    uint64_t total;             /* suffixes handed out */
+    sblcp_stats_t* stats;
+} sbsa_merge_t;
+
+/* construction */
+uint64_t sbsa_build(const char* text_file,const char* sa_file,const char* lcp_file,uint64_t budget,
+                    sblcp_stats_t* stats);
+sbsa_merge_t* sbsa_merge_open(const char* text_file,uint64_t budget,sblcp_stats_t* stats);
+uint64_t sbsa_merge_read(sbsa_merge_t* merge,uint64_t* sa,uint64_t* lcp,uint64_t max);
+void     sbsa_merge_close(sbsa_merge_t* merge);
+
+/* helper functions */
+int      sbsa_compare(uint64_t n,uint64_t depth,const sbsa_entry_t* a,const sbsa_entry_t* b);
+uint64_t sbsa_lcp(sbpagecache_t* pc,uint64_t n,const sbsa_entry_t* a,const sbsa_entry_t* b);
+void     sbsa_sort(sbpagecache_t* pc,uint64_t n,sbsa_entry_t* e,uint64_t len);
+void     sbsa_resolve(sbpagecache_t* pc,uint64_t n,sbsa_entry_t* e,uint64_t len,uint64_t depth);
+uint64_t sbsa_key(const uint8_t* T,uint64_t len);
+uint64_t sbsa_cached_key(sbpagecache_t* pc,uint64_t n,uint64_t pos);
+int      sbsa_run_next(sbsa_run_t* run,sbsa_entry_t* e);
+
+#endif
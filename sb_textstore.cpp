@@ -0,0 +1,251 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <omp.h>
+
+#include <algorithm>
+
+#include "sb_textstore.h"
+#include "sb_util.h"
+
+/* read exactly len bytes at offset */
+static void
+sbtextstore_pread(int fd,void* buf,uint64_t len,uint64_t offset)
+{
+    uint64_t done = 0;
+    while (done < len) {
+        ssize_t r = pread(fd,(uint8_t*)buf+done,len-done,offset+done);
+        if (r <= 0) {
+            fprintf(stderr, "error reading %lu bytes of text at offset %lu\n",len-done,offset+done);
+            exit(EXIT_FAILURE);
+        }
+        done += r;
+    }
+}
+
+/* deflate the len bytes of in into out primed with the dictionary.
+   returns the compressed size */
+static uint64_t
+sbtextstore_deflate(const uint8_t* in,uint64_t len,const uint8_t* dict,uint64_t dict_len,uint8_t* out,uint64_t out_size)
+{
+    z_stream zs;
+    memset(&zs,0,sizeof(z_stream));
+    if (deflateInit(&zs,SBTEXTSTORE_LEVEL) != Z_OK
+        || (dict_len && deflateSetDictionary(&zs,dict,dict_len) != Z_OK)) {
+        fprintf(stderr, "error initializing the text compression.\n");
+        exit(EXIT_FAILURE);
+    }
+    zs.next_in = (Bytef*) in;
+    zs.avail_in = len;
+    zs.next_out = out;
+    zs.avail_out = out_size;
+    if (deflate(&zs,Z_FINISH) != Z_STREAM_END) {
+        fprintf(stderr, "error compressing a text block.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t size = zs.total_out;
+    deflateEnd(&zs);
+    return size;
+}
+
+/* compress text_file into a text store of blocks of block_size bytes. the
+   blocks are compressed in parallel, SBTEXTSTORE_BATCH at a time */
+void
+sbtextstore_create(const char* text_file,const char* store_file,uint64_t block_size)
+{
+    uint64_t n = sb_getfilesize(text_file);
+    int textfd = open(text_file,O_RDONLY);
+    FILE* out = fopen(store_file,"w");
+    if (textfd < 0 || !out) {
+        fprintf(stderr, "cannot compress text file '%s' into '%s'\n",text_file,store_file);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t nblocks = (n+block_size-1)/block_size;
+
+    /* the dictionary is made of evenly spaced pieces of the text. it is kept
+       small compared to the text, as it is stored and loaded with the store */
+    uint64_t dict_len = std::min(n/64,(uint64_t)SBTEXTSTORE_DICT);
+    uint8_t* dict = (uint8_t*) sb_malloc(dict_len+8);
+    uint64_t pieces = std::max((uint64_t)1,dict_len/1024);
+    for (uint64_t i=0; i<pieces; i++) {
+        uint64_t len = (i+1 < pieces) ? dict_len/pieces : dict_len - i*(dict_len/pieces);
+        uint64_t pos = std::min(i*(n/pieces),n-len);
+        sbtextstore_pread(textfd,dict+i*(dict_len/pieces),len,pos);
+    }
+
+    uint64_t header[5] = {SBTEXTSTORE_MAGIC,n,block_size,nblocks,dict_len};
+    uint64_t dict_words = (dict_len+7)/8;
+    uint64_t* offsets = (uint64_t*) sb_malloc((nblocks+1)*sizeof(uint64_t));
+    uint64_t offset = (5 + dict_words + nblocks+1)*sizeof(uint64_t);
+    if (fwrite(header,sizeof(uint64_t),5,out) != 5
+        || fwrite(dict,sizeof(uint64_t),dict_words,out) != dict_words
+        || fwrite(offsets,sizeof(uint64_t),nblocks+1,out) != nblocks+1) {
+        fprintf(stderr, "error writing text store '%s'\n",store_file);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t bound = compressBound(block_size);
+    uint8_t* text = (uint8_t*) sb_malloc(SBTEXTSTORE_BATCH*block_size);
+    uint8_t* comp = (uint8_t*) sb_malloc(SBTEXTSTORE_BATCH*bound);
+    uint64_t* size = (uint64_t*) sb_malloc(SBTEXTSTORE_BATCH*sizeof(uint64_t));
+    for (uint64_t b=0; b<nblocks; b+=SBTEXTSTORE_BATCH) {
+        uint64_t k = std::min((uint64_t)SBTEXTSTORE_BATCH,nblocks-b);
+        uint64_t start = b*block_size;
+        uint64_t len = std::min(k*block_size,n-start);
+        sbtextstore_pread(textfd,text,len,start);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (uint64_t i=0; i<k; i++) {
+            uint64_t l = std::min(block_size,len-i*block_size);
+            size[i] = sbtextstore_deflate(text+i*block_size,l,dict,dict_len,comp+i*bound,bound);
+        }
+        for (uint64_t i=0; i<k; i++) {
+            offsets[b+i] = offset;
+            offset += size[i];
+            if (fwrite(comp+i*bound,1,size[i],out) != size[i]) {
+                fprintf(stderr, "error writing text store '%s'\n",store_file);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    offsets[nblocks] = offset;
+
+    /* now the offsets are known */
+    if (fseek(out,(5+dict_words)*sizeof(uint64_t),SEEK_SET) != 0
+        || fwrite(offsets,sizeof(uint64_t),nblocks+1,out) != nblocks+1) {
+        fprintf(stderr, "error writing text store '%s'\n",store_file);
+        exit(EXIT_FAILURE);
+    }
+    fclose(out);
+    close(textfd);
+    fprintf(stderr, "compressed %lu text bytes into %lu bytes (%lu blocks)\n",n,offset,nblocks);
+
+    free(text);
+    free(comp);
+    free(size);
+    free(offsets);
+    free(dict);
+}
+
+/* open a text store or a raw text file */
+sbtextstore_t*
+sbtextstore_open(const char* file)
+{
+    sbtextstore_t* ts = (sbtextstore_t*) sb_malloc(sizeof(sbtextstore_t));
+    ts->fd = open(file,O_RDONLY);
+    struct stat st;
+    if (ts->fd < 0 || fstat(ts->fd,&st) != 0) {
+        fprintf(stderr, "cannot open text file '%s'\n",file);
+        exit(EXIT_FAILURE);
+    }
+    ts->n = st.st_size;
+
+    uint64_t header[5];
+    if (ts->n < sizeof(header) || pread(ts->fd,header,sizeof(header),0) != sizeof(header)
+        || header[0] != SBTEXTSTORE_MAGIC) {
+        /* a raw text */
+        return ts;
+    }
+    ts->compressed = 1;
+    ts->n = header[1];
+    ts->block_size = header[2];
+    ts->nblocks = header[3];
+    ts->dict_len = header[4];
+    uint64_t dict_words = (ts->dict_len+7)/8;
+    ts->dict = (uint8_t*) sb_malloc(dict_words*sizeof(uint64_t));
+    ts->offsets = (uint64_t*) sb_malloc((ts->nblocks+1)*sizeof(uint64_t));
+    sbtextstore_pread(ts->fd,ts->dict,dict_words*sizeof(uint64_t),sizeof(header));
+    sbtextstore_pread(ts->fd,ts->offsets,(ts->nblocks+1)*sizeof(uint64_t),sizeof(header)+dict_words*sizeof(uint64_t));
+    return ts;
+}
+
+void
+sbtextstore_close(sbtextstore_t* ts)
+{
+    if (ts) {
+        close(ts->fd);
+        free(ts->offsets);
+        free(ts->dict);
+        free(ts);
+    }
+}
+
+/* decompress block into out, which has to hold block_size bytes */
+void
+sbtextstore_decompress(const sbtextstore_t* ts,uint64_t block,uint8_t* out)
+{
+    uint64_t csize = ts->offsets[block+1] - ts->offsets[block];
+    uint64_t len = std::min(ts->block_size,ts->n - block*ts->block_size);
+    uint8_t* comp = (uint8_t*) sb_malloc(csize);
+    sbtextstore_pread(ts->fd,comp,csize,ts->offsets[block]);
+
+    z_stream zs;
+    memset(&zs,0,sizeof(z_stream));
+    if (inflateInit(&zs) != Z_OK) {
+        fprintf(stderr, "error initializing the text decompression.\n");
+        exit(EXIT_FAILURE);
+    }
+    zs.next_in = comp;
+    zs.avail_in = csize;
+    zs.next_out = out;
+    zs.avail_out = len;
+    int ret = inflate(&zs,Z_FINISH);
+    if (ret == Z_NEED_DICT) {
+        if (inflateSetDictionary(&zs,ts->dict,ts->dict_len) != Z_OK) ret = Z_DATA_ERROR;
+        else ret = inflate(&zs,Z_FINISH);
+    }
+    if (ret != Z_STREAM_END || zs.total_out != len) {
+        fprintf(stderr, "error decompressing text block %lu\n",block);
+        exit(EXIT_FAILURE);
+    }
+    inflateEnd(&zs);
+    free(comp);
+}
+
+/* copy len text bytes starting at pos into buf. only the blocks
+   containing the range are decompressed */
+void
+sbtextstore_read(const sbtextstore_t* ts,uint64_t pos,uint64_t len,uint8_t* buf)
+{
+    if (!ts->compressed) {
+        sbtextstore_pread(ts->fd,buf,len,pos);
+        return;
+    }
+    uint8_t* tmp = NULL;
+    while (len) {
+        uint64_t block = pos/ts->block_size;
+        uint64_t off = pos%ts->block_size;
+        uint64_t block_len = std::min(ts->block_size,ts->n - block*ts->block_size);
+        uint64_t l = std::min(len,block_len-off);
+        if (l == block_len) {
+            sbtextstore_decompress(ts,block,buf);
+        } else {
+            if (!tmp) tmp = (uint8_t*) sb_malloc(ts->block_size);
+            sbtextstore_decompress(ts,block,tmp);
+            memcpy(buf,tmp+off,l);
+        }
+        buf += l; pos += l; len -= l;
+    }
+    free(tmp);
+}
+
+/* page cache loader of compressed stores. the cache pages are the blocks */
+void
+sbtextstore_load_block(void* ts,uint64_t offset,uint8_t* block,uint64_t len)
+{
+    const sbtextstore_t* store = (const sbtextstore_t*) ts;
+    sbtextstore_decompress(store,offset/store->block_size,block);
+}
+
+/* cache over the text using at most budget bytes. pages of a raw text are
+   block_size bytes, the pages of a store are its decoded blocks */
+sbpagecache_t*
+sbtextstore_cache(sbtextstore_t* ts,uint64_t block_size,uint64_t budget)
+{
+    if (!ts->compressed) return sbpagecache_create(ts->fd,block_size,budget);
+    sbpagecache_t* pc = sbpagecache_create(ts->fd,ts->block_size,budget);
+    sbpagecache_set_loader(pc,sbtextstore_load_block,ts,ts->n);
+    return pc;
+}
@@ -0,0 +1,53 @@
+#ifndef SB_TEXTSTORE_H
+#define SB_TEXTSTORE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "sb_pagecache.h"
+
+#define SBTEXTSTORE_MAGIC       0x315a545842535342ULL   /* "BSSBXTZ1" */
+#define SBTEXTSTORE_BLOCK       (16*1024)               /* default bytes of text per compressed block */
+#define SBTEXTSTORE_DICT        (32*1024)               /* max size of the shared dictionary (zlib window) */
+#define SBTEXTSTORE_LEVEL       6                       /* zlib compression level */
+#define SBTEXTSTORE_BATCH       256                     /* blocks compressed in parallel */
+
+/* the text an index is searched over. either the raw text file or a block
+   compressed text store:
+
+	[magic][n][block_size][nblocks][dict_len]
+	[dictionary. padded to 8 bytes]
+	[nblocks+1 file offsets of the compressed blocks]
+	[compressed blocks]
+
+   every block of block_size text bytes (the last one may be shorter) is
+   deflated on its own, primed with a dictionary shared by all blocks (a sample
+   of the text), so small blocks still compress well. a read decompresses only
+   the blocks it touches. repeated reads go through a page cache of decoded
+   blocks (see sbtextstore_cache). */
+typedef struct {
+    int fd;                 /* open file descriptor of the text or the store */
+    int compressed;         /* 1 if fd is a text store */
+    uint64_t n;             /* size of the uncompressed text */
+    uint64_t block_size;    /* text bytes per compressed block */
+    uint64_t nblocks;       /* number of compressed blocks */
+    uint64_t* offsets;      /* file offset of every block and the end of the last one */
+    uint8_t* dict;          /* shared dictionary */
+    uint64_t dict_len;      /* bytes in dict */
+} sbtextstore_t;
+
+/* create / destroy */
+void            sbtextstore_create(const char* text_file,const char* store_file,uint64_t block_size);
+sbtextstore_t*  sbtextstore_open(const char* file);
+void            sbtextstore_close(sbtextstore_t* ts);
+
+/* text access */
+void            sbtextstore_read(const sbtextstore_t* ts,uint64_t pos,uint64_t len,uint8_t* buf);
+sbpagecache_t*  sbtextstore_cache(sbtextstore_t* ts,uint64_t block_size,uint64_t budget);
+
+/* helper functions */
+void            sbtextstore_load_block(void* ts,uint64_t offset,uint8_t* block,uint64_t len);
+void            sbtextstore_decompress(const sbtextstore_t* ts,uint64_t block,uint8_t* out);
+
+#endif
@@ -59,6 +59,7 @@ int sbtmpfile_open_read(sbtmpfile_t* stf)
         fprintf(stderr, "error start reading tmpfile.\n");
         exit(EXIT_FAILURE);
     }
+    return 0;
 }
 
 void sbtmpfile_delete(sbtmpfile_t* stf)
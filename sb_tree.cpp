@@ -4,44 +4,39 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/mman.h>
 #include <math.h>
 
 #include "divsufsort64.h"
 
 #include "sb_tree.h"
 #include "sb_util.h"
+#include "sb_lcp.h"
+#include "sb_sa.h"
 #include "critbit_tree.h"
+#include "sb_match.h"
 
 #include <sdsl/bitmagic.hpp>
+#include <algorithm>
+#include <string>
 
 using namespace sdsl;
 
-/* disk layout description of the index file:
+/* the disk layout of the index file is described in sb_tree.h */
 
-	0-4095         : [B][b][n][empty space]
-	4096-B+4096    : root disk page (B bytes)
-	followed by    : [ rest of the SB-tree internal pages]
-	followed by    : [ suffix array leaf pages ]
-
-	therefore: root page always at file offset 4096.
-*/
-
-/* creates the suffix array for a given text and creates the SB-tree ontop of that */
+/* creates the suffix array for a given text and creates the SB-tree ontop of that.
+   the suffix array is an intermediate file (outfile.saraw) and removed once the
+   index is written */
 sbtree_t*
 sbtree_create(const char* text_file,const char* outfile,uint64_t B)
 {
     char sa_file[256];
     /* load text file */
     fprintf(stderr, "LOADING TEXT\n");
-    uint64_t n = sb_getfilesize(text_file);;
+    sbtextstore_t* text = sbtextstore_open(text_file);
+    uint64_t n = text->n;
     uint8_t* T = (uint8_t*) sb_malloc(n);
-    FILE* t_in = fopen(text_file,"r");
-    if (fread(T,1,n,t_in) != n) {
-        fprintf(stderr, "error reading input file '%s'\n",text_file);
-        exit(EXIT_FAILURE);
-    }
-    fclose(t_in);
+    sbtextstore_read(text,0,n,T);
+    sbtextstore_close(text);
 
     /* create sa */
     fprintf(stderr, "CREATING SA\n");
@@ -62,135 +57,463 @@ sbtree_create(const char* text_file,const char* outfile,uint64_t B)
     }
     fclose(sa_out);
 
-    return sbtree_build(sa_file,text_file,outfile,25,B);
+    sbtree_t* sbt = sbtree_build(sa_file,text_file,outfile,B);
+    unlink(sa_file);
+    return sbt;
 }
 
-/* given a sa and text on disk create a SB-tree with disk page size B */
+/* creates the SB-tree without loading the text or the suffix array. the
+   suffix array and the lcp array are built block-wise in about budget bytes
+   and the merge hands them straight to the leaf level, they never go to disk.
+
+   the max lcp is only known once the merge is done, so the tree is built for
+   the longest possible one, n-1. the pages size themselves and do not depend
+   on it, only bits_per_pos and b in the header do, which are rewritten with
+   the real max lcp at the end */
 sbtree_t*
-sbtree_build(const char* sa_file,const char* text_file,const char* outfile,uint64_t maxlcp,uint64_t B)
+sbtree_create_external(const char* text_file,const char* outfile,uint64_t B,uint64_t budget)
+{
+    fprintf(stderr, "CREATING SA AND LCP\n");
+    sblcp_stats_t lcp_stats;
+    sbsa_merge_t* merge = sbsa_merge_open(text_file,budget,&lcp_stats);
+    uint64_t n = merge->n;
+    sbtree_t* sbt = sbtree_build_source(sbtree_read_merge,merge,text_file,outfile,n,n ? n-1 : 0,B,NULL);
+    sbsa_merge_close(merge);
+    sblcp_printstats(&lcp_stats);
+
+    sbt->bits_per_pos = sblcp_width(8*lcp_stats.max_lcp+7);
+    sbt->b = sbtree_calc_branch_factor(sbt);
+    int fd = open(outfile,O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open index file '%s'\n",outfile);
+        exit(EXIT_FAILURE);
+    }
+    sbtree_writeheader(sbt,fd);
+    close(fd);
+    return sbt;
+}
+
+/* given a sa and text on disk create a SB-tree with disk page size B.
+   the lcp array is built next to the index file (outfile.lcpraw) and removed
+   once the index is written. its max value determines bits_per_pos and
+   therefore the branching factor. the sa file is left alone */
+sbtree_t*
+sbtree_build(const char* sa_file,const char* text_file,const char* outfile,uint64_t B)
 {
     fprintf(stderr, "BUILT SBT\n");
+
+    /* we need the complete text in memory for construction as the critbit tree construction
+       randomly accesses the text during construction */
+    sbtextstore_t* text = sbtextstore_open(text_file);
+    uint64_t n = text->n;
+    uint8_t* T = (uint8_t*) sb_malloc(n);
+    sbtextstore_read(text,0,n,T);
+    sbtextstore_close(text);
+
+    /* create the lcp array */
+    fprintf(stderr, "CREATING LCP\n");
+    char lcp_file[256];
+    strcpy(lcp_file,outfile);
+    strcat(lcp_file,".lcpraw");
+    sblcp_stats_t lcp_stats;
+    uint64_t maxlcp = sblcp_build(T,n,sa_file,lcp_file,&lcp_stats);
+    sblcp_printstats(&lcp_stats);
+
+    sbtree_t* sbt = sbtree_build_tree(sa_file,lcp_file,text_file,outfile,n,maxlcp,B,T);
+    unlink(lcp_file);
+    free(T);
+    return sbt;
+}
+
+/* like sbtree_build, but the text is never loaded. the lcp array is computed
+   through a text cache of at most budget bytes and the critbit trees are built
+   from the crit bits alone: the two text bytes at each lcp are read in sorted
+   batches. memory use is bounded by the budget plus a few construction batches */
+sbtree_t*
+sbtree_build_external(const char* sa_file,const char* text_file,const char* outfile,uint64_t B,uint64_t budget)
+{
+    fprintf(stderr, "BUILT SBT EXTERNAL\n");
+    sbtextstore_t* text = sbtextstore_open(text_file);
+    uint64_t n = text->n;
+
+    /* create the lcp array */
+    fprintf(stderr, "CREATING LCP\n");
+    char lcp_file[256];
+    strcpy(lcp_file,outfile);
+    strcat(lcp_file,".lcpraw");
+    sblcp_stats_t lcp_stats;
+    uint64_t maxlcp = sblcp_build_external(text,sa_file,lcp_file,budget,&lcp_stats);
+    sblcp_printstats(&lcp_stats);
+    sbtextstore_close(text);
+
+    sbtree_t* sbt = sbtree_build_tree(sa_file,lcp_file,text_file,outfile,n,maxlcp,B,NULL);
+    unlink(lcp_file);
+    return sbt;
+}
+
+/* write the index over the sa and lcp files. T is the text in memory or
+   NULL if the bytes needed for the crit bits are to be read from the text file */
+sbtree_t*
+sbtree_build_tree(const char* sa_file,const char* lcp_file,const char* text_file,const char* outfile,
+                  uint64_t n,uint64_t maxlcp,uint64_t B,const uint8_t* T)
+{
+    FILE* sa_fd = fopen(sa_file,"r");
+    FILE* lcp_fd = fopen(lcp_file,"r");
+    /* we wrap the suffix and lcp array in the tmpfile to read them like the upper levels */
+    sbtree_files_t files;
+    files.suffixes = sbtmpfile_read_from_file(sa_fd);
+    files.lcps = sbtmpfile_read_from_file(lcp_fd);
+    sbtmpfile_open_read(files.suffixes);
+    sbtmpfile_open_read(files.lcps);
+    sbtree_t* sbt = sbtree_build_source(sbtree_read_files,&files,text_file,outfile,n,maxlcp,B,T);
+    sbtmpfile_delete(files.suffixes);
+    sbtmpfile_delete(files.lcps);
+    return sbt;
+}
+
+/* write the index over the suffixes and lcp values handed out by read. maxlcp
+   has to bound the lcp values. T as in sbtree_build_tree */
+sbtree_t*
+sbtree_build_source(sbtree_source_t read,void* arg,const char* text_file,const char* outfile,
+                    uint64_t n,uint64_t maxlcp,uint64_t B,const uint8_t* T)
+{
     sbtree_t* sbt = (sbtree_t*) sb_malloc(sizeof(sbtree_t));
+    sbt->n = n;
 
-    sbt->n = sb_getfilesize(text_file);
+    /* a crit bit lies in the byte following the lcp of two suffixes */
     sbt->bits_per_suffix = bit_magic::l1BP(sbt->n)+1;
-    sbt->bits_per_pos = 8*(bit_magic::l1BP(maxlcp)+1);
+    sbt->bits_per_pos = sblcp_width(8*maxlcp+7);
     sbt->B = B;
     sbt->b = sbtree_calc_branch_factor(sbt);
-    sbt->height = sbtree_calc_height(sbt);
 
     fprintf(stderr, "n = %zu\n",sbt->n);
     fprintf(stderr, "bits_per_suffix = %zu\n",sbt->bits_per_suffix);
     fprintf(stderr, "bits_per_pos = %zu\n",sbt->bits_per_pos);
     fprintf(stderr, "b = %zu\n",sbt->b);
     fprintf(stderr, "B = %zu\n",sbt->B);
-    fprintf(stderr, "height = %zu\n",sbt->height);
 
-    /* open output file */
-    FILE* out = fopen(outfile,"w");
-    if (!out) {
-        fprintf(stderr, "cannot open output file '%s'\n",outfile);
+    if (sbt->b < 2 || B % sizeof(uint64_t)) {
+        fprintf(stderr, "disk page size %lu too small for %lu bit suffixes and %lu bit positions "
+                        "or not a multiple of 8\n",B,sbt->bits_per_suffix,sbt->bits_per_pos);
         exit(EXIT_FAILURE);
     }
 
-    /* write the index header first */
-    sbtree_writeheader(sbt,out);
+    /* the index is written sequentially through the double buffered writer */
+    sbwriter_t* out = sbwriter_create(outfile);
 
-    /* now write a dummy root page that are going to overwrite later.
-       we do this so the root file is always at the same offset in the index file */
-    sbtree_addpadding(out,B);
+    /* the header and the root page are written once the tree is complete and
+       its levels are known. we write a dummy for now, so the root is always at
+       the same offset in the index file */
+    sbwriter_zero(out,SBT_ROOT_OFFSET+B);
 
     /* construct the whole sbt tree */
-    FILE* sa_fd = fopen(sa_file,"r");
-    /* we wrap the suffix array in the tmpfile to keep the createtree function simple */
-    sbtmpfile_t* sbtf = sbtmpfile_read_from_file(sa_fd);
+    sbt->text = sbtextstore_open(text_file);
+    if (sbt->text->compressed) sbtree_set_textcache(sbt,SBT_DEFAULT_TEXT_BLOCK,SBT_DEFAULT_CACHE_SIZE);
 
-    /* we need the complete text in memory for construction as the critbit tree construction
-       randomly accesses the text during construction */
-    uint8_t* T = (uint8_t*) malloc(sbt->n);
-    FILE* t_in = fopen(text_file,"r");
-    if (!t_in) {
-        fprintf(stderr, "cannot input text file '%s'\n",text_file);
-        exit(EXIT_FAILURE);
-    }
-    if (fread(T,1,sbt->n,t_in) != sbt->n) {
-        fprintf(stderr, "error reading input text from file '%s'\n",text_file);
+    sbt->height = 0;
+    sbtree_createtree(sbt,read,arg,T,sbt->n,out);
+    if (sbt->text->compressed) sbtree_set_textcache(sbt,SBT_DEFAULT_TEXT_BLOCK,0);
+    sbwriter_finish(out);
+    fprintf(stderr, "height = %zu\n",sbt->height);
+
+    /* the root is the last page written. copy it over the dummy root page */
+    sbtree_calc_layout(sbt);
+    int fd = open(outfile,O_RDWR);
+    uint8_t* root = (uint8_t*) sb_malloc(B);
+    if (fd < 0 || pread(fd,root,B,sbtree_page_offset(sbt,sbt->height-1,0)) != (ssize_t)B
+               || pwrite(fd,root,B,SBT_ROOT_OFFSET) != (ssize_t)B) {
+        fprintf(stderr, "error copying the root page in index file '%s'\n",outfile);
         exit(EXIT_FAILURE);
     }
-    fclose(t_in);
-
-    sbtree_createtree(sbt,sbtf,T,sbt->n,out);
-    sbtmpfile_delete(sbtf);
+    free(root);
+    sbtree_writeheader(sbt,fd);
 
     /* close the index file */
-    fclose(out);
+    close(fd);
 
     /* open the file so we can use the sbt right away */
     sbt->fd = open(outfile,O_RDONLY);
-    sbt->textfd = open(text_file,O_RDONLY);
+    sbt->cache = sbpagecache_create(sbt->fd,sbt->B,SBT_DEFAULT_CACHE_SIZE);
+    sbtree_load_resident(sbt,0);
 
     return sbt;
 }
 
-/* stream sa from disk and construct the sb-tree */
+/* bits needed to store x in a page. 0 needs one bit */
+static inline uint64_t
+sbtree_width(uint64_t x)
+{
+    return x ? sblcp_width(x) : 1;
+}
+
+/* bytes of the critbit tree of g suffixes in [min_suf,max_suf] with crit bits
+   up to max_crit. the suffixes are stored relative to min_suf if that makes the
+   page smaller, which happens for the long runs of nearby suffixes of repetitive
+   texts. base is set to min_suf in this case and to 0 otherwise */
+static inline uint64_t
+sbtree_page_bytes(uint64_t g,uint64_t max_crit,uint64_t min_suf,uint64_t max_suf,uint64_t* base)
+{
+    uint64_t plain = critbit_serialized_size(g,sbtree_width(max_crit),sbtree_width(max_suf),0);
+    uint64_t relative = critbit_serialized_size(g,sbtree_width(max_crit),sbtree_width(max_suf-min_suf),min_suf);
+    *base = (relative < plain) ? min_suf : 0;
+    return std::min(plain,relative);
+}
+
+/* build the critbit tree over the nsuf suffixes and serialize it straight into
+   the B byte page buffer. crit[i] is the crit bit position of suf[i-1] and suf[i].
+   the page uses the smallest widths that hold its suffixes and crit bits, the
+   last word of the page holds the index of its first entry in the level and
+   the word before it next_lcp, the lcp of its last suffix with the first
+   suffix of the next page. cbt is rebuilt in place so its node arena is
+   reused from page to page */
+static void
+sbtree_create_page(const sbtree_t* sbt,critbit_tree_t* cbt,const uint64_t* suf,const uint64_t* crit,
+                   uint64_t nsuf,uint64_t first,uint64_t next_lcp,uint8_t* page)
+{
+    uint64_t min_suf = *std::min_element(suf,suf+nsuf);
+    uint64_t max_suf = *std::max_element(suf,suf+nsuf);
+    uint64_t max_crit = (nsuf > 1) ? *std::max_element(crit+1,crit+nsuf) : 0;
+    uint64_t base;
+    uint64_t bytes = sbtree_page_bytes(nsuf,max_crit,min_suf,max_suf,&base);
+
+    /* the suffixes of a block arrive in SA order */
+    critbit_build_from_critbits(cbt,suf,crit,nsuf);
+
+    /* every pos entry is a difference of crit bit positions and at most max_crit */
+    uint64_t size = sbt->B - 2*sizeof(uint64_t);
+    if (!critbit_serialize(cbt,sbtree_width(max_crit),sbtree_width(max_suf-base),base,(uint64_t*)page,size)) {
+        fprintf(stderr, "ERROR! critbit tree larger than block size! (%lu,%lu)\n",bytes,size);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(page+size,&next_lcp,sizeof(uint64_t));
+    memcpy(page+size+sizeof(uint64_t),&first,sizeof(uint64_t));
+}
+
+/* source reading a level from a pair of tmp files (sbtree_files_t) */
+uint64_t
+sbtree_read_files(void* arg,uint64_t* suf,uint64_t* lcp,uint64_t max)
+{
+    sbtree_files_t* files = (sbtree_files_t*) arg;
+    uint64_t r = sbtmpfile_read_block(files->suffixes,suf,max);
+    if (sbtmpfile_read_block(files->lcps,lcp,r) != r) {
+        fprintf(stderr, "error reading lcp values.\n");
+        exit(EXIT_FAILURE);
+    }
+    return r;
+}
+
+/* source handing out the merged suffix array of a sbsa_merge_t */
+uint64_t
+sbtree_read_merge(void* arg,uint64_t* suf,uint64_t* lcp,uint64_t max)
+{
+    return sbsa_merge_read((sbsa_merge_t*) arg,suf,lcp,max);
+}
+
+/* stream sa and lcp from read and construct the sb-tree. the upper levels are
+   streamed from tmp files.
+
+   the suffixes of a level are packed greedily: a page takes suffixes as long as
+   its critbit tree, encoded with the widths of its own largest suffix and crit
+   bit, or of its suffix range if that is smaller, fits into the page. this
+   gives at least b entries per page and usually more than the global widths
+   allow. the last word of each page holds the index of its first entry among
+   all entries of the level: the SA rank on the leaf level and the index of the
+   first child page on the levels above. the word before it holds the lcp of
+   the last entry with the first entry of the next page, which the search uses
+   to bound the lcp of the pattern with the entries at the right end of a page.
+
+   we read up to SBT_BUILD_BATCH full pages per thread, compute the crit bits of
+   all adjacent suffixes, cut the pages and build and serialize their critbit
+   trees in parallel. the batch is appended in page order, so the file layout
+   does not depend on the number of threads. the writer puts the pages on disk
+   in the background while the next batch is built. suffixes of a page that is
+   not complete yet stay in the buffer for the next batch.
+
+   the lcp of the first suffixes of two adjacent pages is the minimum of the
+   lcp values between them, which gives the lcp array of the next level.
+
+   if T is NULL only the two bytes at the lcp of adjacent suffixes are needed.
+   they are read for a whole batch at once with sbtree_text_fetch, which sorts
+   and merges the reads. only if the shorter suffix ended there and the other
+   has a 0 byte, the longer one is read on up to its first non 0 byte.
+
+   every thread keeps one critbit tree for all its blocks, so after the first
+   pages no node memory is allocated and the threads do not contend in malloc. */
 void
-sbtree_createtree(sbtree_t* sbt,sbtmpfile_t* suffixes,const uint8_t* T,uint64_t n,FILE* sbt_fd)
+sbtree_createtree(sbtree_t* sbt,sbtree_source_t read,void* arg,const uint8_t* T,uint64_t n,sbwriter_t* out)
 {
-    /* tmp file we store the next level in */
+    uint64_t level = sbt->height++;
+    if (level >= SBT_MAX_HEIGHT) {
+        fprintf(stderr, "SB-tree height %lu too large.\n",sbt->height);
+        exit(EXIT_FAILURE);
+    }
+
+    /* tmp files we store the next level in */
     sbtmpfile_t* next_level = sbtmpfile_create_write();
+    sbtmpfile_t* next_lcps = sbtmpfile_create_write();
 
-    /* read b suffixes and process */
-    sbtmpfile_open_read(suffixes);
-    uint64_t* suf = (uint64_t*) sb_malloc(sbt->b*sizeof(uint64_t));
-    uint64_t* next_suf = (uint64_t*) sb_malloc(sbt->b*sizeof(uint64_t));
-    uint64_t j,nsuf; j = 0;
+    uint64_t nthreads = omp_get_max_threads();
+    uint64_t batch = nthreads*SBT_BUILD_BATCH;
+    uint64_t cap = batch*sbtree_calc_max_fill(sbt);
+    uint64_t page_size = sbt->B - 2*sizeof(uint64_t);
+    critbit_tree_t** trees = (critbit_tree_t**) sb_malloc(nthreads*sizeof(critbit_tree_t*));
+    for (uint64_t t=0; t<nthreads; t++) trees[t] = critbit_create();
+    uint64_t* suf = (uint64_t*) sb_malloc(cap*sizeof(uint64_t));
+    uint64_t* lcp = (uint64_t*) sb_malloc(cap*sizeof(uint64_t));
+    uint64_t* crit = (uint64_t*) sb_malloc(cap*sizeof(uint64_t));
+    uint64_t* start = (uint64_t*) sb_malloc((batch+1)*sizeof(uint64_t));
+    uint8_t* pages = (uint8_t*) sb_malloc(batch*sbt->B);
+    uint8_t* sym = NULL;
+    uint64_t* sym_pos = NULL;
+    uint64_t* sym_len = NULL;
+    uint8_t** sym_buf = NULL;
+    if (!T) {
+        sym = (uint8_t*) sb_malloc(2*cap);
+        sym_pos = (uint64_t*) sb_malloc(2*cap*sizeof(uint64_t));
+        sym_len = (uint64_t*) sb_malloc(2*cap*sizeof(uint64_t));
+        sym_buf = (uint8_t**) sb_malloc(2*cap*sizeof(uint8_t*));
+    }
+    uint64_t* next_suf = (uint64_t*) sb_malloc(batch*sizeof(uint64_t));
+    uint64_t* next_lcp = (uint64_t*) sb_malloc(batch*sizeof(uint64_t));
+    uint64_t have = 0;              /* suffixes in the buffer */
+    uint64_t consumed = 0;          /* suffixes in the pages written so far */
     uint64_t blocks_processed = 0;
-    while ((nsuf=sbtmpfile_read_block(suffixes,suf,sbt->b)) > 0) {
-        fprintf(stderr, "PROCESSING %lu suffixes.\n",nsuf);
-        fprintf(stderr, "creating critbit tree.\n");
-        critbit_tree_t* cbt = critbit_create_from_suffixes(T,n,suf,nsuf);
-
-        /* write node to the index file. fits into B bytes */
-        uint64_t written = critbit_write(cbt,sbt_fd);
-        critbit_free(cbt);
-        fprintf(stderr, "written %lu bytes to disk.\n",written);
-
-        if (written > sbt->B) {
-            fprintf(stderr, "ERROR! critbit tree larger than block size! (%lu,%lu)\n",written,sbt->B);
-            exit(EXIT_FAILURE);
+    uint64_t min_lcp = 0;           /* min lcp since the first suffix of the previous page */
+    int eof = 0;
+
+    while (1) {
+        /* fill up the buffer */
+        uint64_t old = have;
+        if (!eof) {
+            have += read(arg,suf+have,lcp+have,cap-have);
+            eof = (have < cap);
         }
+        if (have == 0) break;
 
-        /* add padding to fill up the disk page */
-        sbtree_addpadding(sbt_fd,sbt->B-written);
+        /* the crit bits of the new adjacent suffixes. the crit bit lies in the
+           byte at their lcp, a suffix that ended compares as 0 bytes */
+        uint64_t from = std::max(old,(uint64_t)1);
+        if (T) {
+            for (uint64_t i=from; i<have; i++) {
+                crit[i] = sbmatch_critbit(T,n,suf[i-1],suf[i],lcp[i]);
+            }
+        } else {
+            uint64_t nreq = 0;
+            memset(sym+2*from,0,2*(have-from));
+            for (uint64_t i=from; i<have; i++) {
+                for (uint64_t side=0; side<2; side++) {
+                    uint64_t p = suf[i-1+side] + lcp[i];
+                    if (p >= n) continue;
+                    sym_pos[nreq] = p;
+                    sym_len[nreq] = 1;
+                    sym_buf[nreq] = sym + 2*i + side;
+                    nreq++;
+                }
+            }
+            sbtree_qstats_t qs;
+            memset(&qs,0,sizeof(sbtree_qstats_t));
+            sbtree_text_fetch(sbt,sym_pos,sym_len,sym_buf,nreq,&qs);
+            for (uint64_t i=from; i<have; i++) {
+                if (sym[2*i] != sym[2*i+1]) {
+                    crit[i] = (lcp[i]<<3) + CRITBIT_GETCRITBITPOS(sym[2*i],sym[2*i+1]);
+                    continue;
+                }
+                /* the shorter suffix ended and the longer one goes on with 0 bytes.
+                   as in sbmatch_critbit it differs at its first non 0 byte */
+                uint64_t p = std::min(suf[i-1],suf[i]);
+                uint8_t c;
+                uint64_t q = sbtree_text_nonzero(sbt,p+lcp[i],&c,&qs);
+                crit[i] = ((q-p)<<3) + ((q < n) ? CRITBIT_GETCRITBITPOS(0,c) : 0);
+            }
+        }
 
-        /* add the first suffix in block to next lvl file */
-        next_suf[j] = suf[0]; j++;
-        if (j==sbt->b) {
-            fprintf(stderr, "writing %lu suffixes to tmp file for next lvl.\n",j);
-            sbtmpfile_write_block(next_level,next_suf,sbt->b);
-            j = 0;
+        /* cut the pages. a page reaching the end of the buffer may take more
+           suffixes unless the input ended */
+        uint64_t nblocks = 0, s = 0;
+        while (s < have && nblocks < batch) {
+            uint64_t e = s+1, min_suf = suf[s], max_suf = suf[s], max_crit = 0, base;
+            while (e < have) {
+                uint64_t mn = std::min(min_suf,suf[e]);
+                uint64_t ms = std::max(max_suf,suf[e]);
+                uint64_t mc = std::max(max_crit,crit[e]);
+                if (sbtree_page_bytes(e+1-s,mc,mn,ms,&base) > page_size) break;
+                min_suf = mn;
+                max_suf = ms;
+                max_crit = mc;
+                e++;
+            }
+            if (e == have && !eof) break;
+            start[nblocks++] = s;
+            s = e;
         }
+        start[nblocks] = s;
+        fprintf(stderr, "creating %lu critbit trees.\n",nblocks);
 
-        blocks_processed++;
-    }
-    /* write last block of the next level */
-    if (j>0) {
-        sbtmpfile_write_block(next_level,next_suf,j);
+        #pragma omp parallel for schedule(dynamic)
+        for (uint64_t i=0; i<nblocks; i++) {
+            /* the last page of the level has no successor */
+            uint64_t next_lcp = (start[i+1] < have) ? lcp[start[i+1]] : 0;
+            sbtree_create_page(sbt,trees[omp_get_thread_num()],suf+start[i],crit+start[i],
+                               start[i+1]-start[i],consumed+start[i],next_lcp,pages+i*sbt->B);
+        }
+        /* the pages are appended in page order */
+        sbwriter_append(out,pages,nblocks*sbt->B);
+
+        /* add the first suffix in each page to next lvl file */
+        for (uint64_t i=0; i<nblocks; i++) {
+            uint64_t* l = lcp + start[i];
+            uint64_t nsuf = start[i+1]-start[i];
+            next_suf[i] = suf[start[i]];
+            next_lcp[i] = (blocks_processed+i) ? std::min(min_lcp,l[0]) : 0;
+            min_lcp = (nsuf > 1) ? *std::min_element(l+1,l+nsuf) : UINT64_MAX;
+        }
+        sbtmpfile_write_block(next_level,next_suf,nblocks);
+        sbtmpfile_write_block(next_lcps,next_lcp,nblocks);
+        blocks_processed += nblocks;
+
+        /* keep the suffixes of the incomplete page */
+        consumed += s;
+        have -= s;
+        memmove(suf,suf+s,have*sizeof(uint64_t));
+        memmove(lcp,lcp+s,have*sizeof(uint64_t));
+        memmove(crit,crit+s,have*sizeof(uint64_t));
+        if (eof && have == 0) break;
     }
+    sbt->level_pages[level] = blocks_processed;
 
     fprintf(stderr, "processed %lu blocks\n",blocks_processed);
 
     free(suf);
+    free(lcp);
+    free(crit);
+    free(start);
+    free(pages);
+    free(sym);
+    free(sym_pos);
+    free(sym_len);
+    free(sym_buf);
     free(next_suf);
+    free(next_lcp);
+    for (uint64_t t=0; t<nthreads; t++) critbit_free(trees[t]);
+    free(trees);
     sbtmpfile_finish(next_level);
+    sbtmpfile_finish(next_lcps);
 
     /* recurse to the next level if we processed more than 1 block this level -> not root yet */
-    if (blocks_processed > 1) sbtree_createtree(sbt,next_level,T,n,sbt_fd);
+    if (blocks_processed > 1) {
+        sbtree_files_t files = {next_level,next_lcps};
+        sbtmpfile_open_read(next_level);
+        sbtmpfile_open_read(next_lcps);
+        sbtree_createtree(sbt,sbtree_read_files,&files,T,n,out);
+    }
+    sbtmpfile_delete(next_level);
+    sbtmpfile_delete(next_lcps);
 }
 
-/* load a SB-tree from disk */
+/* load a SB-tree from disk. the top levels of the tree are kept in memory using
+   at most resident_size bytes. all other disk pages are cached using at most cache_size bytes */
 sbtree_t*
-sbtree_load(const char* sb_file,const char* text_file)
+sbtree_load(const char* sb_file,const char* text_file,uint64_t resident_size,uint64_t cache_size)
 {
     sbtree_t* sbt = (sbtree_t*) sb_malloc(sizeof(sbtree_t));
 
@@ -203,17 +526,158 @@ sbtree_load(const char* sb_file,const char* text_file)
 
     /* read the header first */
     sbtree_readheader(sbt,in);
+    sbtree_calc_layout(sbt);
 
     /* open the file so we can use the sbt right away */
     sbt->fd = open(sb_file,O_RDONLY);
-    sbt->textfd = open(text_file,O_RDONLY);
+    sbt->text = sbtextstore_open(text_file);
+    sbtree_set_textcache(sbt,SBT_DEFAULT_TEXT_BLOCK,0);
+    sbt->cache = sbpagecache_create(sbt->fd,sbt->B,cache_size);
 
-    /* read/map the root page */
-    sbt->root = sbtree_load_diskpage(sbt,SBT_ROOT_OFFSET);
+    /* read the root and as many levels below it as fit */
+    sbtree_load_resident(sbt,resident_size);
 
     return sbt;
 }
 
+/* cache the text in blocks of block_size bytes using at most budget bytes.
+   a budget of 0 disables the cache and the text is read directly. a compressed
+   text is always read through a cache of its decoded blocks, whose size is
+   fixed by the store */
+void
+sbtree_set_textcache(sbtree_t* sbt,uint64_t block_size,uint64_t budget)
+{
+    sbpagecache_free(sbt->textcache);
+    sbt->textcache = NULL;
+    if (budget || sbt->text->compressed) sbt->textcache = sbtextstore_cache(sbt->text,block_size,budget);
+}
+
+/* number the pages from top to bottom in blocked van Emde Boas order. the
+   subtree of each page in [lo,hi) of level top, cut off below level bottom,
+   is split into the upper half of its levels, which is numbered first, and
+   the subtrees below each page of the lowest level of that half. first[l][i]
+   is the index of the first child of page i of level l */
+static void
+sbtree_veb_order(const sbtree_t* sbt,uint64_t** first,uint64_t top,uint64_t bottom,
+                 uint64_t lo,uint64_t hi,uint64_t** slot,uint64_t* next)
+{
+    if (top == bottom) {
+        for (uint64_t i = lo; i < hi; i++) slot[top][i] = (*next)++;
+        return;
+    }
+    uint64_t mid = bottom + (top-bottom+2)/2;
+    for (uint64_t r = lo; r < hi; r++) {
+        /* each page of the range is the root of its own subtree */
+        sbtree_veb_order(sbt,first,top,mid,r,r+1,slot,next);
+
+        /* the descendants of a range of pages are a range of the lower level */
+        uint64_t dlo = r, dhi = r+1;
+        for (uint64_t l = top; l > mid; l--) {
+            dlo = first[l][dlo];
+            dhi = (dhi < sbt->level_pages[l]) ? first[l][dhi] : sbt->level_pages[l-1];
+        }
+        for (uint64_t i = dlo; i < dhi; i++) {
+            uint64_t end = (i+1 < sbt->level_pages[mid]) ? first[mid][i+1] : sbt->level_pages[mid-1];
+            sbtree_veb_order(sbt,first,mid-1,bottom,first[mid][i],end,slot,next);
+        }
+    }
+}
+
+/* rewrite the pages of the index in the given layout (SBT_LAYOUT_*).
+
+   in level order the root sits at the start of the file but its children at
+   the end, far away from their descendants. in van Emde Boas order every page
+   is followed by the pages of its subtree, recursively split by height, so
+   a search path touches a few contiguous extents and readahead and large
+   device reads fetch pages that are actually needed next */
+void
+sbtree_relayout(const char* sb_file,uint64_t layout)
+{
+    sbtree_t* sbt = (sbtree_t*) sb_malloc(sizeof(sbtree_t));
+    FILE* in = fopen(sb_file,"r");
+    if (!in) {
+        fprintf(stderr, "cannot open index file '%s'\n",sb_file);
+        exit(EXIT_FAILURE);
+    }
+    sbtree_readheader(sbt,in);
+    sbtree_calc_layout(sbt);
+    int fd = open(sb_file,O_RDONLY);
+    uint64_t B = sbt->B;
+
+    /* the new slot of every page */
+    uint64_t pages = 0;
+    uint64_t* slot[SBT_MAX_HEIGHT];
+    for (uint64_t l = 0; l < sbt->height; l++) pages += sbt->level_pages[l];
+    uint64_t* page_slot = (uint64_t*) sb_malloc(pages*sizeof(uint64_t));
+    pages = 0;
+    for (uint64_t l = 0; l < sbt->height; l++) {
+        slot[l] = page_slot + pages;
+        pages += sbt->level_pages[l];
+    }
+    if (layout == SBT_LAYOUT_VEB) {
+        /* the first child of each internal page is in its last word */
+        uint64_t* first[SBT_MAX_HEIGHT];
+        for (uint64_t l = 1; l < sbt->height; l++) {
+            first[l] = (uint64_t*) sb_malloc(sbt->level_pages[l]*sizeof(uint64_t));
+            for (uint64_t i = 0; i < sbt->level_pages[l]; i++) {
+                uint64_t offset = sbtree_page_offset(sbt,l,i) + B - sizeof(uint64_t);
+                if (pread(fd,&first[l][i],sizeof(uint64_t),offset) != sizeof(uint64_t)) {
+                    fprintf(stderr, "error reading page %lu of level %lu of the index file.\n",i,l);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        uint64_t next = 0;
+        sbtree_veb_order(sbt,first,sbt->height-1,0,0,1,slot,&next);
+        for (uint64_t l = 1; l < sbt->height; l++) free(first[l]);
+    } else {
+        for (uint64_t i = 0; i < pages; i++) page_slot[i] = i;
+    }
+
+    /* write the pages in their new order to a new file */
+    uint64_t* order = (uint64_t*) sb_malloc(pages*2*sizeof(uint64_t));
+    for (uint64_t l = 0; l < sbt->height; l++) {
+        for (uint64_t i = 0; i < sbt->level_pages[l]; i++) {
+            order[2*slot[l][i]] = l;
+            order[2*slot[l][i]+1] = i;
+        }
+    }
+    std::string tmp_file = std::string(sb_file) + ".layout";
+    sbwriter_t* out = sbwriter_create(tmp_file.c_str());
+    uint8_t* page = (uint8_t*) sb_malloc(B);
+    sbwriter_zero(out,SBT_ROOT_OFFSET);
+    for (uint64_t i = 0; i <= pages; i++) {
+        /* the root copy followed by all pages */
+        uint64_t offset = i ? sbtree_page_offset(sbt,order[2*i-2],order[2*i-1]) : SBT_ROOT_OFFSET;
+        if (pread(fd,page,B,offset) != (ssize_t)B) {
+            fprintf(stderr, "error reading the index file at offset %lu.\n",offset);
+            exit(EXIT_FAILURE);
+        }
+        sbwriter_append(out,page,B);
+    }
+    if (layout != SBT_LAYOUT_LEVEL) sbwriter_append(out,page_slot,pages*sizeof(uint64_t));
+    sbwriter_finish(out);
+    free(page);
+    free(order);
+    close(fd);
+
+    fd = open(tmp_file.c_str(),O_RDWR);
+    sbt->layout = layout;
+    if (fd < 0) {
+        fprintf(stderr, "cannot open index file '%s'\n",tmp_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    sbtree_writeheader(sbt,fd);
+    close(fd);
+    if (rename(tmp_file.c_str(),sb_file) != 0) {
+        fprintf(stderr, "cannot replace index file '%s'\n",sb_file);
+        exit(EXIT_FAILURE);
+    }
+    free(page_slot);
+    free(sbt->page_slot);
+    free(sbt);
+}
+
 /* print storage statistics for the SB-tree to stdout */
 void
 sbtree_printstats(const sbtree_t* sbt)
@@ -226,9 +690,12 @@ void
 sbtree_free(sbtree_t* sbt)
 {
     if (sbt) {
-        sbtree_free_diskpage(sbt,sbt->root);
+        free(sbt->resident);
+        free(sbt->page_slot);
+        sbpagecache_free(sbt->cache);
+        sbpagecache_free(sbt->textcache);
         close(sbt->fd);
-        close(sbt->textfd);
+        sbtextstore_close(sbt->text);
         free(sbt);
     }
 }
@@ -241,98 +708,864 @@ sbtree_free(sbtree_t* sbt)
 	  - each node in the SB-T contains b <= |n| <= 2b suffixes
 	  - each node must fit into B bytes
 	  - each node contains:
-	    o |n|+1 child pointers (offset into the sb index to the
-	    						disk page containing the child)
-	       note: as the sb-tree index is organized via disk pages,
-	             we can use log(n/(2b)) bits per child pointer.
-		o a blind trie over all |n| suffixes
+	    o no child pointers. children are found through the index of the
+	      first entry stored in the last word of the page and the level
+	      offsets (see sbtree_page_offset)
+	    o one word with the lcp of the last entry and the next page
+		o a blind trie over all |n| suffixes. per suffix it needs 4 bits of
+		  balanced parentheses, one pos entry (bits_per_pos) and the suffix
+		  itself (bits_per_suffix), plus one header word and the excess
+		  directory of the parentheses (about half a bit per suffix)
  */
 uint64_t
 sbtree_calc_branch_factor(sbtree_t* sbt)
 {
-    return (uint64_t)(sbt->B/(0.25 + ((sbt->bits_per_pos + sbt->bits_per_suffix)/8.0f)));
+    /* the trie header word, the next page lcp and the first entry index. the
+       packed arrays are only padded once to a whole word, which the rounding
+       below absorbs */
+    if (sbt->B < 64) return 0;
+    uint64_t b = (8*(sbt->B - 3*sizeof(uint64_t))) / (4 + sbt->bits_per_pos + sbt->bits_per_suffix);
+    /* make room for the directory */
+    while (b && critbit_serialized_size(b,sbt->bits_per_pos,sbt->bits_per_suffix,0) > sbt->B - 2*sizeof(uint64_t)) b--;
+    return b;
 }
 
+/* the most suffixes a page can take when packed greedily: the widths are at
+   least one bit, so a suffix needs at least 6 bits */
+uint64_t
+sbtree_calc_max_fill(const sbtree_t* sbt)
+{
+    return (8*(sbt->B - 3*sizeof(uint64_t)) + 3) / 6;
+}
+
+/* get the disk page at offset from the page cache. the page stays
+   in memory till it is released with sbtree_free_diskpage */
 sb_diskpage_t*
-sbtree_load_diskpage(const sbtree_t* sbt,uint64_t offset)
+sbtree_load_diskpage(const sbtree_t* sbt,uint64_t offset,sbtree_qstats_t* qs)
 {
-    return (sb_diskpage_t*) mmap(NULL,sbt->B,PROT_READ,
-                                 MAP_PRIVATE|MAP_POPULATE,sbt->fd,offset);
+    int miss;
+    sb_diskpage_t* sbd = (sb_diskpage_t*) sbpagecache_pin(sbt->cache,offset,&miss);
+    if (qs) {
+        if (miss) qs->pages_read++;
+        else qs->pages_cached++;
+    }
+    return sbd;
 }
 
 void
 sbtree_free_diskpage(const sbtree_t* sbt,sb_diskpage_t* sbd)
 {
-    munmap((void*)sbd,sbt->B);
+    sbpagecache_unpin(sbt->cache,(const uint8_t*)sbd);
 }
 
-/* query functions */
-uint64_t*
-sbtree_search(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint64_t* nres)
+/* load page idx of the given level. pages of resident levels are never loaded from disk */
+sb_diskpage_t*
+sbtree_load_node(const sbtree_t* sbt,uint64_t level,uint64_t idx,sbtree_qstats_t* qs)
+{
+    if (level + sbt->resident_levels >= sbt->height) {
+        return (sb_diskpage_t*) (sbt->level_mem[level] + idx*sbt->B);
+    }
+    return sbtree_load_diskpage(sbt,sbtree_page_offset(sbt,level,idx),qs);
+}
+
+void
+sbtree_free_node(const sbtree_t* sbt,sb_diskpage_t* sbd)
+{
+    const uint8_t* mem = (const uint8_t*) sbd;
+    if (mem < sbt->resident || mem >= sbt->resident + sbt->resident_size) {
+        sbtree_free_diskpage(sbt,sbd);
+    }
+}
+
+/* pin the text cache block containing pos */
+static const uint8_t*
+sbtree_text_pin(const sbtree_t* sbt,uint64_t pos,sbtree_qstats_t* qs)
+{
+    sbpagecache_t* tc = sbt->textcache;
+    uint64_t start = pos - pos%tc->B;
+    int miss;
+    const uint8_t* block = sbpagecache_pin(tc,start,&miss);
+    if (miss) {
+        qs->text_reads++;
+        qs->text_bytes += std::min(tc->B,sbt->n-start);
+    } else {
+        qs->text_cached++;
+    }
+    return block;
+}
+
+/* compare P with the suffix at suffixpos, of which the first from bytes are
+   known to match P. returns the lcp and stores the symbol of the suffix at the
+   mismatch position in sym (0 if the text ends there). only the bytes past
+   from are read, and they are read in steps which stop at the first mismatch:
+   text blocks through the text cache, otherwise pieces of SBT_TEXT_PROBE
+   bytes doubling in size. buf has to hold at least m bytes. */
+uint64_t
+sbtree_text_lcp(const sbtree_t* sbt,uint64_t suffixpos,const uint8_t* P,uint64_t m,uint64_t from,
+                uint8_t* buf,uint8_t* sym,sbtree_qstats_t* qs)
 {
-    uint64_t* results = NULL;
-    uint64_t  cur_height = 0;
-    uint64_t  child_offset = 0;
-    uint64_t  l = 0;
+    uint64_t len = m;
+    if (suffixpos+len > sbt->n) len = sbt->n - suffixpos;
+    uint64_t lcp = std::min(from,len);
+    *sym = 0;
+    if (!sbt->textcache) {
+        for (uint64_t step = SBT_TEXT_PROBE; lcp < len; step *= 2) {
+            uint64_t l = std::min(step,len-lcp);
+            sbtree_text_read(sbt,suffixpos+lcp,l,buf+lcp,qs);
+            uint64_t k = sbtree_buf_lcp(buf+lcp,l,P+lcp,sym);
+            lcp += k;
+            if (k < l) break;
+        }
+        return lcp;
+    }
 
-    /* start with the root */
-    sb_diskpage_t* cur_node = sbt->root;
+    /* compare inside the cached blocks. stop at the first mismatch,
+       so the blocks after it are never loaded */
+    while (lcp < len) {
+        const uint8_t* block = sbtree_text_pin(sbt,suffixpos+lcp,qs);
+        uint64_t off = (suffixpos+lcp) % sbt->textcache->B;
+        uint64_t end = std::min(len-lcp,sbt->textcache->B-off);
+        uint64_t l = sbtree_buf_lcp(block+off,end,P+lcp,sym);
+        sbpagecache_unpin(sbt->textcache,block);
+        lcp += l;
+        if (l < end) break;
+    }
+    return lcp;
+}
 
-    /*while( cur_height < sbt->height &&
-    		(child_offset=blindtrie_search(sbt,cur_node,P,m,&l))!= 0 ) {*/
-    {
+/* position of the first non 0 text byte at or after pos, which is stored in c.
+   n if the text only has 0 bytes from pos on */
+uint64_t
+sbtree_text_nonzero(const sbtree_t* sbt,uint64_t pos,uint8_t* c,sbtree_qstats_t* qs)
+{
+    uint8_t buf[SBT_TEXT_PROBE];
+    while (pos < sbt->n) {
+        uint64_t len = std::min((uint64_t)SBT_TEXT_PROBE,sbt->n-pos);
+        sbtree_text_read(sbt,pos,len,buf,qs);
+        for (uint64_t i=0; i<len; i++) {
+            if (buf[i]) {
+                *c = buf[i];
+                return pos+i;
+            }
+        }
+        pos += len;
+    }
+    *c = 0;
+    return sbt->n;
+}
 
-        /* go to the next level + get new page */
-        sbtree_free_diskpage(sbt,cur_node); /* free old page */
-        cur_node = sbtree_load_diskpage(sbt,child_offset);
-        cur_height++;
+/* copy len text bytes starting at pos into buf */
+void
+sbtree_text_read(const sbtree_t* sbt,uint64_t pos,uint64_t len,uint8_t* buf,sbtree_qstats_t* qs)
+{
+    if (!sbt->textcache) {
+        sbtextstore_read(sbt->text,pos,len,buf);
+        qs->text_reads++;
+        qs->text_bytes += len;
+        return;
+    }
+    while (len) {
+        const uint8_t* block = sbtree_text_pin(sbt,pos,qs);
+        uint64_t off = pos % sbt->textcache->B;
+        uint64_t l = std::min(len,sbt->textcache->B-off);
+        memcpy(buf,block+off,l);
+        sbpagecache_unpin(sbt->textcache,block);
+        buf += l; pos += l; len -= l;
     }
+}
+
+/* orders text requests by their position */
+struct sbtree_pos_cmp {
+    const uint64_t* pos;
+    bool operator()(uint64_t a,uint64_t b) const { return pos[a] < pos[b]; }
+};
+
+/* read the k text ranges [pos[i],pos[i]+len[i]) into buf[i].
+
+   the requests are sorted by position. requests less than SBT_TEXT_MERGE_GAP
+   bytes apart (or overlapping) are served by one read of the covering range,
+   which is split up afterwards. without a text cache the number of reads is
+   therefore the number of clusters, not the number of requests. */
+void
+sbtree_text_fetch(const sbtree_t* sbt,const uint64_t* pos,const uint64_t* len,uint8_t** buf,
+                  uint64_t k,sbtree_qstats_t* qs)
+{
+    if (k == 0) return;
+
+    uint64_t* order = (uint64_t*) sb_malloc(k*sizeof(uint64_t));
+    for (uint64_t i=0; i<k; i++) order[i] = i;
+    sbtree_pos_cmp cmp = {pos};
+    std::sort(order,order+k,cmp);
+
+    /* in position order consecutive requests hit the same cached blocks */
+    if (sbt->textcache) {
+        for (uint64_t i=0; i<k; i++) sbtree_text_read(sbt,pos[order[i]],len[order[i]],buf[order[i]],qs);
+        free(order);
+        return;
+    }
+
+    uint8_t* stage = NULL;
+    uint64_t stage_size = 0;
+    uint64_t i = 0;
+    while (i < k) {
+        uint64_t start = pos[order[i]];
+        uint64_t end = start + len[order[i]];
+        uint64_t j = i+1;
+        while (j < k && pos[order[j]] <= end + SBT_TEXT_MERGE_GAP
+                     && pos[order[j]] + len[order[j]] - start <= SBT_TEXT_MAX_READ) {
+            end = std::max(end,pos[order[j]] + len[order[j]]);
+            j++;
+        }
+
+        if (j == i+1) {
+            sbtree_text_read(sbt,start,end-start,buf[order[i]],qs);
+        } else {
+            if (end-start > stage_size) {
+                stage_size = end-start;
+                free(stage);
+                stage = (uint8_t*) sb_malloc(stage_size);
+            }
+            sbtree_text_read(sbt,start,end-start,stage,qs);
+            for (; i < j; i++) memcpy(buf[order[i]],stage + pos[order[i]] - start,len[order[i]]);
+        }
+        i = j;
+    }
+
+    free(stage);
+    free(order);
+}
+
+/* lcp of P with the len text bytes in buf. sym as in sbtree_text_lcp */
+uint64_t
+sbtree_buf_lcp(const uint8_t* buf,uint64_t len,const uint8_t* P,uint8_t* sym)
+{
+    uint64_t lcp = sbmatch_lcp(buf,P,len);
+    *sym = 0;
+    if (lcp < len) *sym = buf[lcp];
+    return lcp;
+}
 
-    /* we are either at the correct leaf or not found */
-    if (child_offset) {
-        /* traverse that part of the SA to find the matches */
+/* the number of leading bytes of the candidate known to match P without
+   reading the text, given the lcp bounds of its path and the lcps of the
+   candidate with the first and the last entry of the page, which the blind
+   descent (critbit_mem_locate) gives: the bound for the first entry of the
+   page, carried over to the candidate, or the bound for the first entry of the
+   next page, carried over through the last entry */
+uint64_t
+sbtree_node_from(const sbtree_t* sbt,const sb_diskpage_t* sbd,const sbtree_bound_t* bound,
+                 uint64_t lcp_first,uint64_t lcp_last,uint64_t m)
+{
+    uint64_t next = std::min(lcp_last,sbtree_page_next_lcp(sbt,sbd));
+    uint64_t from = std::max(std::min(bound->first,lcp_first),std::min(bound->next,next));
+    return std::min(from,m);
+}
+
+/* the bounds of a path going down from the page to its child j, given the
+   candidate c and its lcp with P. the first entry of the child is entry j of
+   the page and the first entry of the next child entry j+1, or the first
+   entry of the next page if j is the last one */
+void
+sbtree_node_bound(const sbtree_t* sbt,const sb_diskpage_t* sbd,const critbit_mem_t* cbm,
+                  const sbtree_bound_t* bound,uint64_t c,uint64_t lcp,uint64_t j,sbtree_bound_t* child)
+{
+    child->first = std::min(lcp,critbit_mem_lcp(cbm,c,j));
+    if (j == 0) child->first = std::max(child->first,bound->first);
+    if (j+1 < cbm->g) {
+        child->next = std::min(lcp,critbit_mem_lcp(cbm,c,j+1));
     } else {
-        /* not found */
-        *nres = 0;
+        uint64_t next = std::min(critbit_mem_lcp(cbm,c,j),sbtree_page_next_lcp(sbt,sbd));
+        child->next = std::max(bound->next,std::min(lcp,next));
+    }
+}
+
+/* blind trie search inside a node: find the candidate without looking at the text,
+   verify it with the text past the bytes known to match P and set [lb,rb) to the
+   entries prefixed by P. bound holds the lcp bounds of the path, lo and hi
+   receive those of the children the left and the right path go down to
+   (ignored if NULL) */
+void
+sbtree_search_node(const sbtree_t* sbt,const sb_diskpage_t* sbd,const uint8_t* P,uint64_t m,
+                   const sbtree_bound_t* bound,uint8_t* buf,uint64_t* lb,uint64_t* rb,
+                   sbtree_bound_t* lo,sbtree_bound_t* hi,sbtree_qstats_t* qs)
+{
+    critbit_mem_t cbm;
+    critbit_mem_init(&cbm,sbd->data);
+    uint64_t lcp_first, lcp_last, reach;
+    uint64_t c = critbit_mem_locate(&cbm,P,m,&lcp_first,&lcp_last,&reach);
+    uint64_t from = sbtree_node_from(sbt,sbd,bound,lcp_first,lcp_last,m);
+    uint8_t sym;
+    uint64_t lcp = sbtree_text_lcp(sbt,critbit_mem_getsuffix(&cbm,c),P,m,from,buf,&sym,qs);
+    critbit_mem_rank(&cbm,P,m,lcp,sym,lb,rb);
+    if (lo) sbtree_node_bound(sbt,sbd,&cbm,bound,c,lcp,*lb ? *lb-1 : 0,lo);
+    if (hi) sbtree_node_bound(sbt,sbd,&cbm,bound,c,lcp,*rb ? *rb-1 : 0,hi);
+}
+
+/* find the range [lo,hi) of the suffix array prefixed by P.
+
+   we follow two root-to-leaf paths: the left one leads to the first suffix >= P,
+   the right one to the last suffix prefixed by P. if an internal node has r entries
+   smaller than P, the first suffix >= P lies in child r-1 (or is the first suffix
+   of child r, which is the same position in the SA as the entries of a level are
+   numbered consecutively).
+
+   as in the String B-tree each path carries what it knows about the lcp of P
+   with the entries around it (see sbtree_search_node), so a verification only
+   reads the text past the part of P matched further up and a query reads
+   O(m/B + height) text blocks instead of m bytes on every level. the I/O
+   cost is added to qs if it is not NULL. */
+void
+sbtree_search_range(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs)
+{
+    sbtree_qstats_t stats;
+    if (!qs) {
+        memset(&stats,0,sizeof(sbtree_qstats_t));
+        qs = &stats;
+    }
+    uint8_t* buf = (uint8_t*) sb_malloc(m);
+    sbtree_descend(sbt,P,m,buf,lo,hi,NULL,qs);
+    free(buf);
+}
+
+/* the descent of sbtree_search_range using the caller supplied
+   scratch buffer buf of at least m bytes for the text verification.
+   if leaf is not NULL it receives the leaf page of the left path */
+void
+sbtree_descend(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint8_t* buf,uint64_t* lo,uint64_t* hi,
+               uint64_t* leaf,sbtree_qstats_t* qs)
+{
+    uint64_t lo_idx = 0, hi_idx = 0; /* page index of the two paths in the current level */
+    uint64_t lo_first = 0, hi_first = 0; /* index of the first entry of the two pages */
+    uint64_t lb = 0, rb = 0, tmp;
+    sbtree_bound_t lo_bound = {0,0}, hi_bound = {0,0}; /* lcp bounds of the two paths */
+
+    for (uint64_t level = sbt->height; level-- > 0;) {
+        sb_diskpage_t* lo_node = sbtree_load_node(sbt,level,lo_idx,qs);
+        lo_first = hi_first = sbtree_page_first(sbt,lo_node);
+        sbtree_bound_t* lo_next = level ? &lo_bound : NULL;
+        sbtree_bound_t* hi_next = level ? &hi_bound : NULL;
+        if (lo_idx == hi_idx) {
+            sbtree_bound_t bound = lo_bound;
+            sbtree_search_node(sbt,lo_node,P,m,&bound,buf,&lb,&rb,lo_next,hi_next,qs);
+        } else {
+            sb_diskpage_t* hi_node = sbtree_load_node(sbt,level,hi_idx,qs);
+            hi_first = sbtree_page_first(sbt,hi_node);
+            sbtree_bound_t bound = lo_bound;
+            sbtree_search_node(sbt,lo_node,P,m,&bound,buf,&lb,&tmp,lo_next,NULL,qs);
+            bound = hi_bound;
+            sbtree_search_node(sbt,hi_node,P,m,&bound,buf,&tmp,&rb,NULL,hi_next,qs);
+            sbtree_free_node(sbt,hi_node);
+        }
+        sbtree_free_node(sbt,lo_node);
+
+        if (level == 0) break;
+        lo_idx = lo_first + (lb ? lb-1 : 0);
+        hi_idx = hi_first + (rb ? rb-1 : 0);
+    }
+
+    if (leaf) *leaf = lo_idx;
+    *lo = lo_first + lb;
+    *hi = hi_first + rb;
+    if (*hi < *lo) *hi = *lo;
+}
+
+/* query functions */
+
+/* returns the positions of all occurrences of P in SA order.
+   if qs is not NULL it receives the I/O cost of the query */
+uint64_t*
+sbtree_search(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint64_t* nres,sbtree_qstats_t* qs)
+{
+    sbtree_qstats_t stats;
+    if (!qs) qs = &stats;
+    memset(qs,0,sizeof(sbtree_qstats_t));
+
+    uint64_t lo,hi,leaf;
+    uint8_t* buf = (uint8_t*) sb_malloc(m);
+    sbtree_descend(sbt,P,m,buf,&lo,&hi,&leaf,qs);
+    free(buf);
+    *nres = hi - lo;
+    if (*nres == 0) return NULL;
+
+    return sbtree_suffixes(sbt,leaf,lo,hi,qs);
+}
+
+/* returns the number of occurrences of P without enumerating them.
+
+   the last word of each leaf page holds the SA rank of its first entry, so the
+   ranks of the two boundaries fall out of the descent. the count costs two
+   root-to-leaf paths regardless of the number of occurrences. */
+uint64_t
+sbtree_count(const sbtree_t* sbt,const uint8_t* P,uint64_t m,sbtree_qstats_t* qs)
+{
+    sbtree_qstats_t stats;
+    if (!qs) qs = &stats;
+    memset(qs,0,sizeof(sbtree_qstats_t));
+
+    uint64_t lo,hi;
+    sbtree_search_range(sbt,P,m,&lo,&hi,qs);
+    return hi - lo;
+}
+
+/* scan the leaf pages covering SA[lo,hi) starting at page leaf, which has to
+   start at or before lo, and return the suffixes in SA order */
+uint64_t*
+sbtree_suffixes(const sbtree_t* sbt,uint64_t leaf,uint64_t lo,uint64_t hi,sbtree_qstats_t* qs)
+{
+    if (hi <= lo) return NULL;
+    uint64_t* results = (uint64_t*) sb_malloc((hi-lo)*sizeof(uint64_t));
+    uint64_t j = 0;
+    for (uint64_t idx = leaf; j < hi-lo && idx < sbt->level_pages[0]; idx++) {
+        sb_diskpage_t* page = sbtree_load_node(sbt,0,idx,qs);
+        critbit_mem_t cbm;
+        critbit_mem_init(&cbm,page->data);
+        uint64_t start = sbtree_page_first(sbt,page);
+        uint64_t i = (lo > start) ? lo-start : 0;
+        uint64_t end = (hi-start < cbm.g) ? hi-start : cbm.g;
+        if (i < end) {
+            critbit_mem_getsuffixes(&cbm,i,end,results+j);
+            j += end-i;
+        }
+        sbtree_free_node(sbt,page);
     }
 
     return results;
 }
 
+/* streams at most limit occurrences of P to report and returns how many
+   were reported. if occ is not NULL it receives the number of all
+   occurrences, the size of the range found by the descent (0 if limit is 0).
 
-/* calculate the SB-Tree height */
+   in SA order the leaf pages are decoded one at a time from the left
+   boundary and handed to report, so the query stops reading pages once limit
+   occurrences are out or report asks to stop: its cost depends on limit, not
+   on the number of occurrences. in text order the limit smallest positions
+   are kept in a heap while all pages of the range are scanned (the pages are
+   not ordered by position) and reported at the end in one call */
 uint64_t
-sbtree_calc_height(const sbtree_t* sbt)
+sbtree_search_limit(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint64_t limit,uint64_t order,
+                    sbtree_report_t report,void* arg,uint64_t* occ,sbtree_qstats_t* qs)
 {
-    return (uint64_t) log(sbt->n)/log(sbt->b) + 1;
+    sbtree_qstats_t stats;
+    if (!qs) qs = &stats;
+    memset(qs,0,sizeof(sbtree_qstats_t));
+    if (occ) *occ = 0;
+    if (limit == 0) return 0;
+
+    uint64_t lo,hi,leaf;
+    uint8_t* buf = (uint8_t*) sb_malloc(m);
+    sbtree_descend(sbt,P,m,buf,&lo,&hi,&leaf,qs);
+    free(buf);
+    if (hi <= lo) return 0;
+    if (occ) *occ = hi-lo;
+    if (order == SBT_ORDER_SA) hi = lo + std::min(hi-lo,limit);
+
+    uint64_t* suffixes = (uint64_t*) sb_malloc(sbtree_calc_max_fill(sbt)*sizeof(uint64_t));
+    uint64_t* heap = NULL;
+    uint64_t nheap = 0;
+    if (order == SBT_ORDER_TEXT) heap = (uint64_t*) sb_malloc(std::min(hi-lo,limit)*sizeof(uint64_t));
+    uint64_t reported = 0;
+    int stop = 0;
+    for (uint64_t idx = leaf; !stop && idx < sbt->level_pages[0]; idx++) {
+        sb_diskpage_t* page = sbtree_load_node(sbt,0,idx,qs);
+        critbit_mem_t cbm;
+        critbit_mem_init(&cbm,page->data);
+        uint64_t start = sbtree_page_first(sbt,page);
+        uint64_t i = (lo > start) ? lo-start : 0;
+        uint64_t end = (hi-start < cbm.g) ? hi-start : cbm.g;
+        if (i < end) critbit_mem_getsuffixes(&cbm,i,end,suffixes);
+        sbtree_free_node(sbt,page);
+        if (start+end >= hi) stop = 1;
+        if (i >= end) continue;
+
+        if (order == SBT_ORDER_SA) {
+            reported += end-i;
+            if (report(arg,suffixes,end-i)) stop = 1;
+            continue;
+        }
+        for (uint64_t j=0; j<end-i; j++) {
+            if (nheap < limit) {
+                heap[nheap++] = suffixes[j];
+                std::push_heap(heap,heap+nheap);
+            } else if (suffixes[j] < heap[0]) {
+                std::pop_heap(heap,heap+nheap);
+                heap[nheap-1] = suffixes[j];
+                std::push_heap(heap,heap+nheap);
+            }
+        }
+    }
+    free(suffixes);
+
+    if (nheap) {
+        std::sort_heap(heap,heap+nheap);
+        reported = nheap;
+        report(arg,heap,nheap);
+    }
+    free(heap);
+    return reported;
 }
 
-/* write the index header + padding */
+/* orders pattern ids lexicographically by their pattern */
+struct sbtree_pattern_cmp {
+    const uint8_t** P;
+    const uint64_t* m;
+    bool operator()(uint64_t a,uint64_t b) const {
+        int cmp = memcmp(P[a],P[b],std::min(m[a],m[b]));
+        if (cmp) return cmp < 0;
+        return m[a] < m[b];
+    }
+};
+
+/* a page visit of the batched search. side 0 = left path, side 1 = right path */
+typedef struct {
+    uint64_t page;
+    uint64_t rank;      /* rank of the pattern in lexicographical order */
+    uint64_t side;
+    uint64_t node;      /* the loaded page in the current group */
+    uint64_t cand;      /* blind trie candidate */
+    uint64_t lcp_first; /* results of its blind descent, see critbit_mem_locate */
+    uint64_t lcp_last;
+    uint64_t reach;
+    uint64_t pos;       /* its suffix */
+    uint64_t len;       /* bytes of P to compare with it */
+    uint64_t lcp;       /* bytes matched so far */
+    uint64_t h;         /* lcp of P with the pattern of the previous visit of the page */
+    uint64_t lead;      /* first visit of the run of visits reaching the same candidate */
+    uint64_t step;      /* size of the next text request of the run (lead only) */
+    uint64_t off;       /* offset of the request in the candidate (lead only) */
+    uint64_t req;
+    uint8_t done;       /* lcp and sym are final */
+    uint8_t sym;
+} sbtree_visit_t;
+
+/* verify visit vis from the verified previous visit prev of the page, which
+   reached the same candidate with a pattern sharing h bytes with P. the lcp
+   follows from the lcp of prev and the symbols at h without the text, unless
+   P and the previous pattern match the candidate equally far. then only the
+   text past h is left to compare */
+static void
+sbtree_visit_derive(const sbtree_t* sbt,const sbtree_visit_t* prev,const uint8_t* Pprev,
+                    sbtree_visit_t* vis,const uint8_t* P,uint64_t m)
+{
+    uint64_t h = vis->h;
+    if (h < prev->lcp) {
+        vis->lcp = h;
+        vis->sym = Pprev[h];
+        vis->done = 1;
+    } else if (h > prev->lcp) {
+        vis->lcp = prev->lcp;
+        vis->sym = prev->sym;
+        vis->done = 1;
+    } else if (prev->lcp < prev->len) {
+        /* prev mismatched at h, so P does unless it continues with the same symbol */
+        if (h < m && P[h] == prev->sym) {
+            vis->lcp = std::max(vis->lcp,h+1);
+        } else {
+            vis->lcp = h;
+            vis->sym = prev->sym;
+            vis->done = 1;
+        }
+    } else if (prev->pos + h == sbt->n) {
+        /* the text ended */
+        vis->lcp = h;
+        vis->sym = 0;
+        vis->done = 1;
+    } else {
+        /* prev matched all of its pattern */
+        vis->lcp = std::max(vis->lcp,h);
+    }
+    if (vis->lcp >= vis->len) {
+        vis->lcp = vis->len;
+        vis->done = 1;
+    }
+}
+
+static bool
+sbtree_visit_cmp(const sbtree_visit_t& a,const sbtree_visit_t& b)
+{
+    if (a.page != b.page) return a.page < b.page;
+    if (a.rank != b.rank) return a.rank < b.rank;
+    return a.side < b.side;
+}
+
+/* search k patterns at once. for each pattern P[i] the range [lo[i],hi[i])
+   of the suffix array prefixed by P[i] is computed.
+
+   the patterns are processed in lexicographical order level by level. all
+   patterns routed to the same page are searched while the page is loaded, so
+   each distinct page is read once per level. pages are pinned in groups of at
+   most half the page cache. the blind trie candidates of all patterns in a group
+   are verified together, starting past the lcp each path carries down (see
+   sbtree_descend): in rounds of one sbtree_text_fetch, each requesting the next
+   piece of every candidate not verified yet, doubling the piece size from
+   SBT_TEXT_PROBE.
+
+   neighbouring patterns on a page share work through their lcp h. a pattern
+   sharing with the previous one all bytes its blind descent looked at reaches
+   the same candidate without a descent. consecutive patterns reaching the same
+   candidate form a run, which reads the candidate once for all of them, and a
+   pattern of a run is verified from the result of the previous one as soon as
+   that is known (see sbtree_visit_derive), mostly without comparing any text. */
 void
-sbtree_writeheader(sbtree_t* sbt,FILE* out)
+sbtree_search_batch(const sbtree_t* sbt,const uint8_t** P,const uint64_t* m,uint64_t k,
+                    uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs)
 {
-    uint64_t written = 0;
-    written += fwrite(&sbt->n,sizeof(uint64_t),1,out);
-    written += fwrite(&sbt->bits_per_suffix,sizeof(uint64_t),1,out);
-    written += fwrite(&sbt->bits_per_pos,sizeof(uint64_t),1,out);
-    written += fwrite(&sbt->b,sizeof(uint64_t),1,out);
-    written += fwrite(&sbt->B,sizeof(uint64_t),1,out);
-    written += fwrite(&sbt->height,sizeof(uint64_t),1,out);
+    sbtree_qstats_t stats;
+    if (!qs) qs = &stats;
+    memset(qs,0,sizeof(sbtree_qstats_t));
+    if (k == 0) return;
+
+    /* sort the patterns */
+    uint64_t* order = (uint64_t*) sb_malloc(k*sizeof(uint64_t));
+    for (uint64_t i=0; i<k; i++) order[i] = i;
+    sbtree_pattern_cmp cmp = {P,m};
+    std::sort(order,order+k,cmp);
+
+    /* state of the two paths per pattern: page, rank of P in it and the index
+       of the first entry of the page in its level. indexed by lexicographical rank */
+    uint64_t* idx = (uint64_t*) sb_malloc(2*k*sizeof(uint64_t));
+    uint64_t* bound = (uint64_t*) sb_malloc(2*k*sizeof(uint64_t));
+    uint64_t* base = (uint64_t*) sb_malloc(2*k*sizeof(uint64_t));
+    sbtree_bound_t* pbound = (sbtree_bound_t*) sb_malloc(2*k*sizeof(sbtree_bound_t));
+    memset(pbound,0,2*k*sizeof(sbtree_bound_t));
+    sbtree_visit_t* visits = (sbtree_visit_t*) sb_malloc(2*k*sizeof(sbtree_visit_t));
+
+    /* pages of the current group and the text requests of their visits */
+    sb_diskpage_t** nodes = (sb_diskpage_t**) sb_malloc(2*k*sizeof(sb_diskpage_t*));
+    uint64_t* req_pos = (uint64_t*) sb_malloc(2*k*sizeof(uint64_t));
+    uint64_t* req_len = (uint64_t*) sb_malloc(2*k*sizeof(uint64_t));
+    uint8_t** req_buf = (uint8_t**) sb_malloc(2*k*sizeof(uint8_t*));
+    uint8_t* text = NULL;
+    uint64_t text_size = 0;
+    uint64_t max_pinned = std::max((uint64_t)1,sbt->cache->nframes/2);
+
+    for (uint64_t level = sbt->height; level-- > 0;) {
+        /* collect the pages we have to visit on this level */
+        uint64_t nvisits = 0;
+        for (uint64_t r=0; r<k; r++) {
+            visits[nvisits].page = idx[2*r]; visits[nvisits].rank = r; visits[nvisits].side = 0; nvisits++;
+            if (idx[2*r+1] != idx[2*r]) {
+                visits[nvisits].page = idx[2*r+1]; visits[nvisits].rank = r; visits[nvisits].side = 1; nvisits++;
+            }
+        }
+        std::sort(visits,visits+nvisits,sbtree_visit_cmp);
+        bool resident = level + sbt->resident_levels >= sbt->height;
 
-    /* pad up to SBT_ROOT_OFFSET bytes so we have nice alignment */
-    sbtree_addpadding(out,SBT_ROOT_OFFSET-(written*sizeof(uint64_t)));
+        uint64_t v = 0;
+        while (v < nvisits) {
+            /* load a group of pages and find the candidates of all their visits */
+            uint64_t first = v, npages = 0;
+            while (v < nvisits && (resident || npages < max_pinned)) {
+                uint64_t page = visits[v].page;
+                nodes[npages] = sbtree_load_node(sbt,level,page,qs);
+                critbit_mem_t cbm;
+                critbit_mem_init(&cbm,nodes[npages]->data);
+                for (uint64_t start = v; v < nvisits && visits[v].page == page; v++) {
+                    sbtree_visit_t* vis = visits+v;
+                    sbtree_visit_t* prev = (v > start) ? vis-1 : NULL;
+                    uint64_t i = order[vis->rank];
+                    vis->h = 0;
+                    if (prev) {
+                        uint64_t j = order[prev->rank];
+                        uint8_t sym;
+                        vis->h = sbtree_buf_lcp(P[j],std::min(m[i],m[j]),P[i],&sym);
+                    }
+                    if (prev && vis->h >= prev->reach) {
+                        /* the descent only looks at the bytes shared with prev */
+                        vis->cand = prev->cand;
+                        vis->lcp_first = prev->lcp_first;
+                        vis->lcp_last = prev->lcp_last;
+                        vis->reach = prev->reach;
+                    } else {
+                        vis->cand = critbit_mem_locate(&cbm,P[i],m[i],&vis->lcp_first,&vis->lcp_last,&vis->reach);
+                    }
+                    uint64_t from = sbtree_node_from(sbt,nodes[npages],pbound+2*vis->rank+vis->side,
+                                                     vis->lcp_first,vis->lcp_last,m[i]);
+                    vis->node = npages;
+                    vis->pos = critbit_mem_getsuffix(&cbm,vis->cand);
+                    vis->len = std::min(m[i],sbt->n-vis->pos);
+                    vis->lcp = std::min(from,vis->len);
+                    vis->done = vis->lcp >= vis->len;
+                    vis->sym = 0;
+                    vis->lead = (prev && prev->cand == vis->cand) ? prev->lead : v;
+                    vis->step = SBT_TEXT_PROBE;
+                }
+                npages++;
+            }
+
+            /* verify the candidates past the bytes known to match. each run
+               requests the text from the first byte not matched by all of
+               its unverified visits up to the longest of them */
+            for (;;) {
+                uint64_t nreq = 0, total = 0;
+                for (uint64_t u=first; u<v;) {
+                    sbtree_visit_t* run = visits+u;
+                    uint64_t off = UINT64_MAX, end = 0;
+                    for (; u < v && visits[u].lead == run->lead; u++) {
+                        sbtree_visit_t* vis = visits+u;
+                        if (!vis->done && u > run->lead && vis[-1].done) {
+                            sbtree_visit_derive(sbt,vis-1,P[order[vis[-1].rank]],vis,
+                                                P[order[vis->rank]],m[order[vis->rank]]);
+                        }
+                        if (vis->done) continue;
+                        off = std::min(off,vis->lcp);
+                        end = std::max(end,vis->len);
+                    }
+                    if (off >= end) continue;
+                    run->off = off;
+                    req_pos[nreq] = run->pos + off;
+                    req_len[nreq] = std::min(run->step,end-off);
+                    total += req_len[nreq];
+                    run->req = nreq++;
+                    run->step *= 2;
+                }
+                if (nreq == 0) break;
+                if (total > text_size) {
+                    text_size = total;
+                    free(text);
+                    text = (uint8_t*) sb_malloc(text_size);
+                }
+                for (uint64_t j=0, off=0; j<nreq; j++) {
+                    req_buf[j] = text + off;
+                    off += req_len[j];
+                }
+                sbtree_text_fetch(sbt,req_pos,req_len,req_buf,nreq,qs);
+
+                /* compare the visits which reached the requested piece */
+                for (uint64_t u=first; u<v; u++) {
+                    sbtree_visit_t* vis = visits+u;
+                    const sbtree_visit_t* run = visits+vis->lead;
+                    uint64_t end = run->off + req_len[run->req];
+                    if (vis->done || vis->lcp >= end) continue;
+                    const uint8_t* Pr = P[order[vis->rank]];
+                    uint64_t l = std::min(end,vis->len) - vis->lcp;
+                    uint64_t lcp = sbtree_buf_lcp(req_buf[run->req]+vis->lcp-run->off,l,Pr+vis->lcp,&vis->sym);
+                    vis->lcp += lcp;
+                    vis->done = lcp < l || vis->lcp >= vis->len;
+                }
+            }
+
+            for (uint64_t u=first; u<v; u++) {
+                sbtree_visit_t* vis = visits+u;
+                uint64_t r = vis->rank;
+                const uint8_t* Pr = P[order[r]];
+                uint64_t mr = m[order[r]];
+                const sb_diskpage_t* node = nodes[vis->node];
+                critbit_mem_t cbm;
+                critbit_mem_init(&cbm,node->data);
+                uint64_t lb,rb;
+                critbit_mem_rank(&cbm,Pr,mr,vis->lcp,vis->sym,&lb,&rb);
+
+                /* a pattern whose paths share the page uses both bounds */
+                uint64_t page = vis->page;
+                uint64_t f = sbtree_page_first(sbt,node);
+                sbtree_bound_t b = pbound[2*r+vis->side];
+                if (idx[2*r] == page) {
+                    bound[2*r] = lb;
+                    base[2*r] = f;
+                    sbtree_node_bound(sbt,node,&cbm,&b,vis->cand,vis->lcp,lb ? lb-1 : 0,pbound+2*r);
+                }
+                if (idx[2*r+1] == page) {
+                    bound[2*r+1] = rb;
+                    base[2*r+1] = f;
+                    sbtree_node_bound(sbt,node,&cbm,&b,vis->cand,vis->lcp,rb ? rb-1 : 0,pbound+2*r+1);
+                }
+            }
+            for (uint64_t j=0; j<npages; j++) sbtree_free_node(sbt,nodes[j]);
+        }
+
+        if (level == 0) break;
+        for (uint64_t i=0; i<2*k; i++) idx[i] = base[i] + (bound[i] ? bound[i]-1 : 0);
+    }
+
+    for (uint64_t r=0; r<k; r++) {
+        uint64_t i = order[r];
+        lo[i] = base[2*r] + bound[2*r];
+        hi[i] = base[2*r+1] + bound[2*r+1];
+        if (hi[i] < lo[i]) hi[i] = lo[i];
+    }
+
+    free(order);
+    free(idx);
+    free(bound);
+    free(base);
+    free(pbound);
+    free(visits);
+    free(nodes);
+    free(req_pos);
+    free(req_len);
+    free(req_buf);
+    free(text);
+}
+
+/* calculate the file offset of the first page of each level from the page
+   counts. level 0 (the suffix array pages) starts right after the root page.
+   if the pages are not stored by level, the slots are counted from there */
+void
+sbtree_calc_layout(sbtree_t* sbt)
+{
+    if (sbt->height > SBT_MAX_HEIGHT) {
+        fprintf(stderr, "SB-tree height %lu too large.\n",sbt->height);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t offset = SBT_ROOT_OFFSET + sbt->B;
+    for (uint64_t l = 0; l < sbt->height; l++) {
+        sbt->level_offset[l] = offset;
+        if (!sbt->page_slot) offset += sbt->level_pages[l]*sbt->B;
+    }
+}
+
+/* read the top levels of the tree into one block of memory. we keep as many
+   levels as fit into budget bytes, but always the root. the levels are stored
+   top down so page i of a resident level l is at level_mem[l] + i*B */
+void
+sbtree_load_resident(sbtree_t* sbt,uint64_t budget)
+{
+    sbt->resident_levels = 0;
+    sbt->resident_size = 0;
+    for (uint64_t l = sbt->height; l-- > 0;) {
+        uint64_t bytes = sbt->level_pages[l]*sbt->B;
+        if (sbt->resident_levels && sbt->resident_size + bytes > budget) break;
+        sbt->resident_size += bytes;
+        sbt->resident_levels++;
+    }
+
+    sbt->resident = (uint8_t*) sb_malloc(sbt->resident_size);
+    uint8_t* mem = sbt->resident;
+    for (uint64_t l = sbt->height; l-- > sbt->height - sbt->resident_levels;) {
+        uint64_t bytes = sbt->level_pages[l]*sbt->B;
+        uint64_t done = 0;
+        while (done < bytes) {
+            /* a level is contiguous in the file unless the pages are reordered */
+            uint64_t len = sbt->page_slot ? sbt->B - done%sbt->B : bytes-done;
+            uint64_t offset = sbtree_page_offset(sbt,l,done/sbt->B) + done%sbt->B;
+            ssize_t r = pread(sbt->fd,mem+done,len,offset);
+            if (r <= 0) {
+                fprintf(stderr, "error reading level %lu of the index file.\n",l);
+                exit(EXIT_FAILURE);
+            }
+            done += r;
+        }
+        sbt->level_mem[l] = mem;
+        mem += bytes;
+    }
+    sbt->root = (sb_diskpage_t*) sbt->level_mem[sbt->height-1];
+
+    fprintf(stderr, "resident levels = %lu (%lu bytes)\n",sbt->resident_levels,sbt->resident_size);
 }
 
-/* add padding to the index file to get nice alignment */
+/* write the index header followed by the page count of each level and the
+   layout. the pages are filled greedily, so the counts can not be derived
+   from n and b */
 void
-sbtree_addpadding(FILE* out,uint64_t bytes)
+sbtree_writeheader(sbtree_t* sbt,int fd)
 {
-    if (bytes) {
-        fprintf(stderr, "added %lu bytes padding.\n",bytes);
-        uint8_t* dummy_root = (uint8_t*) sb_malloc(bytes);
-        memset(dummy_root,rand()%50,bytes);
-        fwrite(dummy_root,1,bytes,out);
-        free(dummy_root);
+    uint64_t header[7+SBT_MAX_HEIGHT] = {sbt->n,sbt->bits_per_suffix,sbt->bits_per_pos,sbt->b,sbt->B,sbt->height};
+    memcpy(header+6,sbt->level_pages,sbt->height*sizeof(uint64_t));
+    header[6+sbt->height] = sbt->layout;
+    uint64_t bytes = (7+sbt->height)*sizeof(uint64_t);
+    if (pwrite(fd,header,bytes,0) != (ssize_t)bytes) {
+        fprintf(stderr, "error writing the index header.\n");
+        exit(EXIT_FAILURE);
     }
 }
 
@@ -347,10 +1580,30 @@ sbtree_readheader(sbtree_t* sbt,FILE* in)
     read += fread(&sbt->b,sizeof(uint64_t),1,in);
     read += fread(&sbt->B,sizeof(uint64_t),1,in);
     read += fread(&sbt->height,sizeof(uint64_t),1,in);
-    fclose(in);
-
-    if (read != 6) {
+    if (read == 6 && sbt->height <= SBT_MAX_HEIGHT) {
+        read += fread(sbt->level_pages,sizeof(uint64_t),sbt->height,in);
+        read += fread(&sbt->layout,sizeof(uint64_t),1,in);
+    }
+    if (read != 7+sbt->height) {
         fprintf(stderr, "error reading index file.\n");
         exit(EXIT_FAILURE);
     }
+
+    /* the slot table follows the last page */
+    if (sbt->layout != SBT_LAYOUT_LEVEL) {
+        uint64_t pages = 0;
+        for (uint64_t l = 0; l < sbt->height; l++) pages += sbt->level_pages[l];
+        sbt->page_slot = (uint64_t*) sb_malloc(pages*sizeof(uint64_t));
+        if (fseek(in,SBT_ROOT_OFFSET + (1+pages)*sbt->B,SEEK_SET) != 0
+            || fread(sbt->page_slot,sizeof(uint64_t),pages,in) != pages) {
+            fprintf(stderr, "error reading the page slots of the index file.\n");
+            exit(EXIT_FAILURE);
+        }
+        pages = 0;
+        for (uint64_t l = 0; l < sbt->height; l++) {
+            sbt->level_slot[l] = sbt->page_slot + pages;
+            pages += sbt->level_pages[l];
+        }
+    }
+    fclose(in);
 }
\ No newline at end of file
@@ -7,8 +7,28 @@
 #include <stdlib.h>
 
 #define SBT_ROOT_OFFSET		4096
+#define SBT_MAX_HEIGHT		64
+#define SBT_DEFAULT_CACHE_SIZE	(64*1024*1024)
+#define SBT_DEFAULT_RESIDENT_SIZE	(16*1024*1024)
+#define SBT_DEFAULT_TEXT_BLOCK	4096
+#define SBT_BUILD_BATCH		16
+#define SBT_TEXT_MERGE_GAP	4096
+#define SBT_TEXT_MAX_READ	(1024*1024)
+#define SBT_TEXT_PROBE		512	/* first read of an uncached verification. doubles per step */
+
+/* order of the pages in the index file */
+#define SBT_LAYOUT_LEVEL	0	/* level by level from the leaves up */
+#define SBT_LAYOUT_VEB		1	/* blocked van Emde Boas order. parents next to their subtrees */
+
+/* order of the occurrences reported by sbtree_search_limit */
+#define SBT_ORDER_SA		0	/* suffix array order. stops after limit occurrences */
+#define SBT_ORDER_TEXT		1	/* the smallest text positions in ascending order */
 
 #include "sb_tmpfile.h"
+#include "sb_pagecache.h"
+#include "sb_writer.h"
+#include "sb_textstore.h"
+#include "critbit_tree.h"
 
 /* node in the SB-tree. size = B bytes */
 typedef struct {
@@ -18,44 +38,164 @@ typedef struct {
 /* the main sbtree struct */
 typedef struct {
     uint64_t B;                 /* page size */
-    uint64_t b;                 /* each node in the tree contains b <= x <= 2b suffixes. */
+    uint64_t b;                 /* every page but the last of a level holds at least b suffixes */
     uint64_t n;                 /* # of suffixes or size of the input text */
     uint64_t height;            /* height of the SB-tree */
     uint64_t bits_per_suffix;   /* bits used per suffix = log2(n) */
-    uint64_t bits_per_pos;      /* max lcp -> determines the max size of the pos array entries in the blind trie */
+    uint64_t bits_per_pos;      /* bits of the largest crit bit position = width(8*maxlcp+7). max size of the pos array entries */
     int fd;                     /* open file descriptor of the index */
-    int textfd;                 /* open file descriptor to the text */
+    sbtextstore_t* text;        /* the raw text or a compressed text store */
     sb_diskpage_t* root;        /* root node stays in main memory. */
+    sbpagecache_t* cache;       /* cache all non resident disk pages are accessed through */
+    sbpagecache_t* textcache;   /* cache of text blocks used for verification. NULL = read the text directly. always used for stores */
+    uint64_t resident_levels;   /* number of top levels kept in main memory (>= 1) */
+    uint64_t resident_size;     /* bytes used by the resident levels */
+    uint8_t* resident;          /* the resident levels in one block. root level first */
+    uint64_t level_offset[SBT_MAX_HEIGHT]; /* file offset of the first page of each level */
+    uint64_t level_pages[SBT_MAX_HEIGHT];  /* number of pages in each level */
+    uint8_t* level_mem[SBT_MAX_HEIGHT];    /* first page of each resident level */
+    uint64_t layout;            /* order of the pages in the file (SBT_LAYOUT_*) */
+    uint64_t* page_slot;        /* position of every page in the file, levels bottom up. NULL for the level layout */
+    uint64_t* level_slot[SBT_MAX_HEIGHT];  /* first entry of each level in page_slot */
 } sbtree_t;
 
+/* I/O cost of a single query */
+typedef struct {
+    uint64_t pages_read;        /* disk pages read from the index file */
+    uint64_t pages_cached;      /* disk pages found in the page cache. resident pages are not counted */
+    uint64_t text_reads;        /* reads from the text file to verify blind trie candidates */
+    uint64_t text_bytes;        /* bytes read from the text file */
+    uint64_t text_cached;       /* text blocks found in the text cache */
+} sbtree_qstats_t;
+
+/* lower bounds of the lcp of P with the first entry of a page and with the
+   first entry of the next page of its level, carried down a search path */
+typedef struct {
+    uint64_t first;
+    uint64_t next;
+} sbtree_bound_t;
+
+/* hands the suffixes of a level and the lcp values of adjacent ones to
+   sbtree_createtree, at most max at a time. returns fewer only at the end of
+   the level */
+typedef uint64_t (*sbtree_source_t)(void* arg,uint64_t* suf,uint64_t* lcp,uint64_t max);
+
+/* a level stored in a pair of tmp files, opened for reading */
+typedef struct {
+    sbtmpfile_t* suffixes;
+    sbtmpfile_t* lcps;
+} sbtree_files_t;
+
+/* receives the next k occurrences of a streamed query. returning non zero
+   stops the query */
+typedef int (*sbtree_report_t)(void* arg,const uint64_t* suffixes,uint64_t k);
+
 /* disk layout description of the index file:
 
-	0-4095         : [B][b][n][empty space]
-	4096-B+4096    : root disk page (B bytes)
-	followed by    : [rest of the SB-tree internal pages]
-	followed by    : [suffix array pages]
+	0-4095         : [n][bits_per_suffix][bits_per_pos][b][B][height][pages of level 0..height-1][layout][empty space]
+	4096-B+4096    : root disk page (B bytes). copy of the root page below
+	followed by    : [level 0: suffix array pages]
+	followed by    : [level 1 to height-1: internal pages. root page last]
 
 	therefore: root page always at file offset 4096.
+
+	with SBT_LAYOUT_VEB the pages following the root copy are stored in blocked
+	van Emde Boas order instead, so a root-to-leaf path lies in a few contiguous
+	extents. the pages are followed by the slot of every page in this order,
+	levels bottom up (see sbtree_relayout).
+
+	pages are filled greedily with as many entries as fit, at least b. the last
+	word of a page holds the index f of its first entry among all entries of
+	its level, the word before it the lcp of its last entry with the first
+	entry of the next page of the level (0 for the last page). page i of level 0 holds the blind trie over SA[f,f+g).
+	page i of level l > 0 holds the first suffix of pages f...f+g-1 of level l-1.
+	child offsets are therefore implicit: level_offset[l-1] + (f+j)*B. pages
+	store no child pointers, the page count table in the header is all that is
+	needed to seek to any page of any level.
+
+	the blind trie of a page starts with one word holding g and the widths of
+	its pos and suffix entries, followed by the bp, pos and suffix bit arrays
+	packed without padding (see critbit_serialize). if the suffixes of a page
+	lie close together they are stored relative to the smallest one, which is
+	kept in an extra word behind the first.
 */
 
+/* index of the first entry of a page among all entries of its level */
+static inline uint64_t
+sbtree_page_first(const sbtree_t* sbt,const sb_diskpage_t* sbd)
+{
+    return sbd->data[sbt->B/sizeof(uint64_t)-1];
+}
+
+/* lcp of the last entry of a page with the first entry of the next page */
+static inline uint64_t
+sbtree_page_next_lcp(const sbtree_t* sbt,const sb_diskpage_t* sbd)
+{
+    return sbd->data[sbt->B/sizeof(uint64_t)-2];
+}
+
+/* file offset of page idx of a level */
+static inline uint64_t
+sbtree_page_offset(const sbtree_t* sbt,uint64_t level,uint64_t idx)
+{
+    if (sbt->page_slot) idx = sbt->level_slot[level][idx];
+    return sbt->level_offset[level] + idx*sbt->B;
+}
+
 /* load/save/create functions */
 sbtree_t* sbtree_create(const char* text_file,const char* outfile,uint64_t B);
-sbtree_t* sbtree_build(const char* sa_file,const char* text_file,const char* outfile,uint64_t maxlcp,uint64_t B);
-sbtree_t* sbtree_load(const char* sb_file,const char* text_file);
+sbtree_t* sbtree_create_external(const char* text_file,const char* outfile,uint64_t B,uint64_t budget);
+sbtree_t* sbtree_build(const char* sa_file,const char* text_file,const char* outfile,uint64_t B);
+sbtree_t* sbtree_build_external(const char* sa_file,const char* text_file,const char* outfile,uint64_t B,uint64_t budget);
+sbtree_t* sbtree_build_tree(const char* sa_file,const char* lcp_file,const char* text_file,const char* outfile,
+                            uint64_t n,uint64_t maxlcp,uint64_t B,const uint8_t* T);
+sbtree_t* sbtree_build_source(sbtree_source_t read,void* arg,const char* text_file,const char* outfile,
+                              uint64_t n,uint64_t maxlcp,uint64_t B,const uint8_t* T);
+sbtree_t* sbtree_load(const char* sb_file,const char* text_file,uint64_t resident_size,uint64_t cache_size);
 void      sbtree_printstats(const sbtree_t* sbt);
 void      sbtree_free(sbtree_t* sbt);
-void      sbtree_createtree(sbtree_t* sbt,sbtmpfile_t* suffixes,const uint8_t* T,uint64_t n,FILE* sbt_fd);
+void      sbtree_set_textcache(sbtree_t* sbt,uint64_t block_size,uint64_t budget);
+void      sbtree_relayout(const char* sb_file,uint64_t layout);
+void      sbtree_createtree(sbtree_t* sbt,sbtree_source_t read,void* arg,const uint8_t* T,uint64_t n,sbwriter_t* out);
 
 /* query functions */
-uint64_t*   sbtree_search(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint64_t* nres);
+uint64_t*   sbtree_search(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint64_t* nres,sbtree_qstats_t* qs);
+uint64_t    sbtree_count(const sbtree_t* sbt,const uint8_t* P,uint64_t m,sbtree_qstats_t* qs);
+void        sbtree_search_range(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs);
+void        sbtree_search_batch(const sbtree_t* sbt,const uint8_t** P,const uint64_t* m,uint64_t k,
+                                uint64_t* lo,uint64_t* hi,sbtree_qstats_t* qs);
+uint64_t*   sbtree_suffixes(const sbtree_t* sbt,uint64_t leaf,uint64_t lo,uint64_t hi,sbtree_qstats_t* qs);
+uint64_t    sbtree_search_limit(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint64_t limit,uint64_t order,
+                                sbtree_report_t report,void* arg,uint64_t* occ,sbtree_qstats_t* qs);
 
 /* helper functions */
-uint64_t        sbtree_calc_height(const sbtree_t* sbt);
+uint64_t        sbtree_read_files(void* arg,uint64_t* suf,uint64_t* lcp,uint64_t max);
+uint64_t        sbtree_read_merge(void* arg,uint64_t* suf,uint64_t* lcp,uint64_t max);
 uint64_t	    sbtree_calc_branch_factor(sbtree_t* sbt);
-sb_diskpage_t*  sbtree_load_diskpage(const sbtree_t* sbt,uint64_t offset);
+uint64_t        sbtree_calc_max_fill(const sbtree_t* sbt);
+void            sbtree_calc_layout(sbtree_t* sbt);
+void            sbtree_load_resident(sbtree_t* sbt,uint64_t budget);
+sb_diskpage_t*  sbtree_load_diskpage(const sbtree_t* sbt,uint64_t offset,sbtree_qstats_t* qs);
 void            sbtree_free_diskpage(const sbtree_t* sbt,sb_diskpage_t* sbd);
-void            sbtree_writeheader(sbtree_t* sbt,FILE* out);
+sb_diskpage_t*  sbtree_load_node(const sbtree_t* sbt,uint64_t level,uint64_t idx,sbtree_qstats_t* qs);
+void            sbtree_free_node(const sbtree_t* sbt,sb_diskpage_t* sbd);
+uint64_t        sbtree_node_from(const sbtree_t* sbt,const sb_diskpage_t* sbd,const sbtree_bound_t* bound,
+                                 uint64_t lcp_first,uint64_t lcp_last,uint64_t m);
+void            sbtree_node_bound(const sbtree_t* sbt,const sb_diskpage_t* sbd,const critbit_mem_t* cbm,
+                                  const sbtree_bound_t* bound,uint64_t c,uint64_t lcp,uint64_t j,sbtree_bound_t* child);
+void            sbtree_search_node(const sbtree_t* sbt,const sb_diskpage_t* sbd,const uint8_t* P,uint64_t m,
+                                   const sbtree_bound_t* bound,uint8_t* buf,uint64_t* lb,uint64_t* rb,
+                                   sbtree_bound_t* lo,sbtree_bound_t* hi,sbtree_qstats_t* qs);
+void            sbtree_descend(const sbtree_t* sbt,const uint8_t* P,uint64_t m,uint8_t* buf,
+                               uint64_t* lo,uint64_t* hi,uint64_t* leaf,sbtree_qstats_t* qs);
+uint64_t        sbtree_text_lcp(const sbtree_t* sbt,uint64_t suffixpos,const uint8_t* P,uint64_t m,uint64_t from,
+                                uint8_t* buf,uint8_t* sym,sbtree_qstats_t* qs);
+void            sbtree_text_read(const sbtree_t* sbt,uint64_t pos,uint64_t len,uint8_t* buf,sbtree_qstats_t* qs);
+uint64_t        sbtree_text_nonzero(const sbtree_t* sbt,uint64_t pos,uint8_t* c,sbtree_qstats_t* qs);
+void            sbtree_text_fetch(const sbtree_t* sbt,const uint64_t* pos,const uint64_t* len,uint8_t** buf,
+                                  uint64_t k,sbtree_qstats_t* qs);
+uint64_t        sbtree_buf_lcp(const uint8_t* buf,uint64_t len,const uint8_t* P,uint8_t* sym);
+void            sbtree_writeheader(sbtree_t* sbt,int fd);
 void            sbtree_readheader(sbtree_t* sbt,FILE* in);
-void            sbtree_addpadding(FILE* out,uint64_t bytes);
 
 #endif
\ No newline at end of file
@@ -26,9 +26,4 @@ static inline uint64_t sb_getfilesize(const char* file_name)
     }
 }
 
-static inline uint64_t sb_getmaxlcp(const uint8_t* T,const char* sa_file)
-{
-
-}
-
 #endif
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "sb_writer.h"
+#include "sb_util.h"
+
+/* the background writer. takes one buffer at a time till the writer is finished */
+static void*
+sbwriter_run(void* arg)
+{
+    sbwriter_t* w = (sbwriter_t*) arg;
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        while (!w->pending && !w->done) pthread_cond_wait(&w->cond,&w->lock);
+        if (!w->pending) break;
+        const uint8_t* buf = w->pending;
+        uint64_t len = w->pending_len;
+        uint64_t offset = w->pending_offset;
+        pthread_mutex_unlock(&w->lock);
+
+        sbwriter_write(w,buf,len,offset);
+
+        pthread_mutex_lock(&w->lock);
+        w->pending = NULL;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/* create the file and start the background writer */
+sbwriter_t*
+sbwriter_create(const char* file)
+{
+    sbwriter_t* w = (sbwriter_t*) sb_malloc(sizeof(sbwriter_t));
+    w->fd = open(file,O_WRONLY|O_CREAT|O_TRUNC|O_DIRECT,0644);
+    w->direct = 1;
+    if (w->fd < 0 && errno == EINVAL) {
+        /* the file system does not support O_DIRECT */
+        w->fd = open(file,O_WRONLY|O_CREAT|O_TRUNC,0644);
+        w->direct = 0;
+    }
+    if (w->fd < 0) {
+        fprintf(stderr, "cannot open output file '%s'\n",file);
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t i=0; i<2; i++) {
+        if (posix_memalign((void**)&w->buf[i],SBWRITER_ALIGN,SBWRITER_BUFFER_SIZE) != 0) {
+            fprintf(stderr, "error allocating %u bytes of write buffer memory\n",SBWRITER_BUFFER_SIZE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    w->cur = 0;
+    w->used = 0;
+    w->offset = 0;
+    w->pending = NULL;
+    w->done = 0;
+    pthread_mutex_init(&w->lock,NULL);
+    pthread_cond_init(&w->cond,NULL);
+    if (pthread_create(&w->thread,NULL,sbwriter_run,w) != 0) {
+        fprintf(stderr, "cannot start the index writer thread\n");
+        exit(EXIT_FAILURE);
+    }
+    return w;
+}
+
+/* write the buffered data, stop the background writer and close the file.
+   returns the size of the file */
+uint64_t
+sbwriter_finish(sbwriter_t* w)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->pending) pthread_cond_wait(&w->cond,&w->lock);
+    w->done = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread,NULL);
+
+    /* O_DIRECT can only write whole aligned blocks. we write the last one
+       zero padded and cut the file to its real size */
+    uint64_t size = w->offset + w->used;
+    if (w->used) {
+        uint64_t len = w->used;
+        if (w->direct) {
+            len = (len+SBWRITER_ALIGN-1) & ~((uint64_t)SBWRITER_ALIGN-1);
+            memset(w->buf[w->cur]+w->used,0,len-w->used);
+        }
+        sbwriter_write(w,w->buf[w->cur],len,w->offset);
+        if (len != w->used && ftruncate(w->fd,size) != 0) {
+            fprintf(stderr, "error truncating the index file to %lu bytes\n",size);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    close(w->fd);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(w->buf[0]);
+    free(w->buf[1]);
+    free(w);
+    return size;
+}
+
+/* append len bytes. full buffers are handed to the background writer */
+void
+sbwriter_append(sbwriter_t* w,const void* data,uint64_t len)
+{
+    const uint8_t* src = (const uint8_t*) data;
+    while (len) {
+        uint64_t n = std::min(len,(uint64_t)SBWRITER_BUFFER_SIZE-w->used);
+        memcpy(w->buf[w->cur]+w->used,src,n);
+        w->used += n;
+        src += n;
+        len -= n;
+        if (w->used == SBWRITER_BUFFER_SIZE) sbwriter_flush(w);
+    }
+}
+
+/* append len zero bytes */
+void
+sbwriter_zero(sbwriter_t* w,uint64_t len)
+{
+    while (len) {
+        uint64_t n = std::min(len,(uint64_t)SBWRITER_BUFFER_SIZE-w->used);
+        memset(w->buf[w->cur]+w->used,0,n);
+        w->used += n;
+        len -= n;
+        if (w->used == SBWRITER_BUFFER_SIZE) sbwriter_flush(w);
+    }
+}
+
+/* file offset the next appended byte is written to */
+uint64_t
+sbwriter_offset(const sbwriter_t* w)
+{
+    return w->offset + w->used;
+}
+
+/* hand the full current buffer to the background writer and switch to the
+   other one once its previous content is written */
+void
+sbwriter_flush(sbwriter_t* w)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->pending) pthread_cond_wait(&w->cond,&w->lock);
+    w->pending = w->buf[w->cur];
+    w->pending_len = w->used;
+    w->pending_offset = w->offset;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    w->cur = 1 - w->cur;
+    w->offset += w->used;
+    w->used = 0;
+}
+
+/* write len bytes of buf at offset */
+void
+sbwriter_write(sbwriter_t* w,const uint8_t* buf,uint64_t len,uint64_t offset)
+{
+    uint64_t done = 0;
+    while (done < len) {
+        ssize_t r = pwrite(w->fd,buf+done,len-done,offset+done);
+        if (r < 0 && errno == EINVAL && w->direct) {
+            /* O_DIRECT was accepted by open but not by the file system */
+            fcntl(w->fd,F_SETFL,fcntl(w->fd,F_GETFL) & ~O_DIRECT);
+            w->direct = 0;
+            continue;
+        }
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            fprintf(stderr, "error writing %lu bytes to the index file\n",len-done);
+            exit(EXIT_FAILURE);
+        }
+        done += r;
+    }
+    if (!w->direct) {
+        /* do not let the index push the pages of queries out of the page cache */
+        sync_file_range(w->fd,offset,len,SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(w->fd,offset,len,POSIX_FADV_DONTNEED);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef SB_WRITER_H
+#define SB_WRITER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define SBWRITER_ALIGN          4096                /* alignment of O_DIRECT buffers, offsets and lengths */
+#define SBWRITER_BUFFER_SIZE    (8*1024*1024)       /* bytes per buffer. multiple of SBWRITER_ALIGN */
+
+/* sequential writer for the index file. the data is assembled in two aligned
+   buffers. a full buffer is handed to a background thread which writes it with
+   O_DIRECT while the other buffer is filled, so the build only waits for the
+   disk if it produces pages faster than they can be written.
+
+   O_DIRECT keeps the written index out of the page cache. if the file system
+   does not support it, the buffers are written normally and dropped from the
+   page cache once they reached the disk. */
+typedef struct {
+    int fd;                         /* file written to */
+    int direct;                     /* 1 if fd uses O_DIRECT */
+    uint8_t* buf[2];                /* the two write buffers */
+    uint64_t cur;                   /* buffer currently filled */
+    uint64_t used;                  /* bytes in the current buffer */
+    uint64_t offset;                /* file offset of the current buffer */
+    pthread_t thread;               /* background writer */
+    pthread_mutex_t lock;           /* protects the fields below */
+    pthread_cond_t cond;            /* signals a change of pending or done */
+    const uint8_t* pending;         /* buffer handed to the writer. NULL if idle */
+    uint64_t pending_len;           /* bytes to write from pending */
+    uint64_t pending_offset;        /* file offset of pending */
+    int done;                       /* no more buffers will follow */
+} sbwriter_t;
+
+/* create / destroy */
+sbwriter_t* sbwriter_create(const char* file);
+uint64_t    sbwriter_finish(sbwriter_t* w);
+
+/* append data */
+void        sbwriter_append(sbwriter_t* w,const void* data,uint64_t len);
+void        sbwriter_zero(sbwriter_t* w,uint64_t len);
+uint64_t    sbwriter_offset(const sbwriter_t* w);
+
+/* helper functions */
+void        sbwriter_flush(sbwriter_t* w);
+void        sbwriter_write(sbwriter_t* w,const uint8_t* buf,uint64_t len,uint64_t offset);
+
+#endif
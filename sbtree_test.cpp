@@ -0,0 +1,1089 @@
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <algorithm>
+#include <vector>
+
+#include "sb_tree.h"
+#include "sb_engine.h"
+#include "sb_async.h"
+#include "sb_lcp.h"
+#include "sb_sa.h"
+#include "critbit_tree.h"
+#include "sb_util.h"
+#include "divsufsort64.h"
+
+/* creates a text over a small alphabet so patterns occur often */
+static std::string
+sbtree_test_text(uint64_t n,uint64_t sigma,unsigned int seed)
+{
+    std::string T(n,'a');
+    srand(seed);
+    for (uint64_t i=0; i<n; i++) T[i] = 'a' + rand()%sigma;
+    return T;
+}
+
+static std::vector<uint64_t>
+sbtree_test_occ(const std::string& T,const std::string& P)
+{
+    std::vector<uint64_t> occ;
+    for (uint64_t i=0; i+P.size()<=T.size(); i++) {
+        if (memcmp(T.data()+i,P.data(),P.size()) == 0) occ.push_back(i);
+    }
+    return occ;
+}
+
+class sbtree_test : public ::testing::Test
+{
+    protected:
+        std::string T;
+        char text_file[64];
+        char index_file[64];
+
+        void create(uint64_t n,uint64_t sigma,uint64_t B) {
+            create_text(sbtree_test_text(n,sigma,4711),B);
+        }
+
+        void create_text(const std::string& text,uint64_t B) {
+            T = text;
+            uint64_t n = T.size();
+            strcpy(text_file,"/tmp/sbtree_test_XXXXXX");
+            int fd = mkstemp(text_file);
+            ASSERT_EQ(write(fd,T.data(),n),(ssize_t)n);
+            close(fd);
+            strcpy(index_file,text_file);
+            strcat(index_file,".sbti");
+            sbtree_free(sbtree_create(text_file,index_file,B));
+        }
+
+        /* the build removes its raw suffix array, so tests which need one write it */
+        void write_sa(char* sa_file) {
+            strcpy(sa_file,index_file);
+            strcat(sa_file,".saraw");
+            std::vector<uint64_t> SA(T.size());
+            ASSERT_EQ(divsufsort64((const uint8_t*)T.data(),(saidx64_t*)SA.data(),T.size()),0);
+            FILE* f = fopen(sa_file,"w");
+            ASSERT_EQ(fwrite(SA.data(),sizeof(uint64_t),SA.size(),f),SA.size());
+            fclose(f);
+        }
+
+        void check(const sbtree_t* sbt,const std::string& P) {
+            std::vector<uint64_t> occ = sbtree_test_occ(T,P);
+            uint64_t nres;
+            sbtree_qstats_t qs;
+            uint64_t* res = sbtree_search(sbt,(const uint8_t*)P.data(),P.size(),&nres,&qs);
+            ASSERT_EQ(nres,occ.size()) << "P = " << P;
+            std::sort(res,res+nres);
+            for (uint64_t i=0; i<nres; i++) EXPECT_EQ(res[i],occ[i]);
+            free(res);
+            /* one path per boundary plus the leaf scan */
+            EXPECT_LE(qs.pages_read+qs.pages_cached,2*(sbt->height-1) + nres/sbt->b + 2);
+        }
+
+        virtual void TearDown() {
+            char sa_file[128],lcp_file[128];
+            strcpy(sa_file,index_file);
+            strcat(sa_file,".saraw");
+            strcpy(lcp_file,index_file);
+            strcat(lcp_file,".lcpraw");
+            unlink(text_file);
+            unlink(index_file);
+            unlink(sa_file);
+            unlink(lcp_file);
+        }
+};
+
+TEST_F(sbtree_test , search)
+{
+    create(30000,4,512);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,SBT_DEFAULT_RESIDENT_SIZE,SBT_DEFAULT_CACHE_SIZE);
+    EXPECT_GE(sbt->height,3);
+
+    srand(42);
+    for (uint64_t i=0; i<300; i++) {
+        uint64_t m = 1 + rand()%12;
+        uint64_t pos = rand()%(T.size()-m);
+        check(sbt,T.substr(pos,m));
+        check(sbt,sbtree_test_text(m,4,i));
+    }
+    check(sbt,T);
+    check(sbt,T.substr(T.size()-5));
+    check(sbt,T.substr(0,100));
+    check(sbt,"e");
+    check(sbt,"aaaaaaaaaaaaaaaaaaaaa");
+
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , parallel_build)
+{
+    create(30000,4,1024);
+
+    /* the pages do not depend on the number of threads */
+    char parallel_file[128];
+    strcpy(parallel_file,index_file);
+    strcat(parallel_file,".parallel");
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(4);
+    sbtree_free(sbtree_create(text_file,parallel_file,1024));
+    omp_set_num_threads(threads);
+
+    FILE* a = fopen(index_file,"r");
+    FILE* b = fopen(parallel_file,"r");
+    std::vector<uint8_t> A,B;
+    int c;
+    while ((c = fgetc(a)) != EOF) A.push_back(c);
+    while ((c = fgetc(b)) != EOF) B.push_back(c);
+    fclose(a);
+    fclose(b);
+    ASSERT_EQ(A.size(),B.size());
+    EXPECT_TRUE(std::equal(A.begin()+SBT_ROOT_OFFSET,A.end(),B.begin()+SBT_ROOT_OFFSET));
+
+    sbtree_t* sbt = sbtree_load(parallel_file,text_file,0,0);
+    for (uint64_t i=0; i<100; i++) check(sbt,T.substr(i*7,1+i%9));
+    sbtree_free(sbt);
+
+    unlink(parallel_file);
+}
+
+TEST_F(sbtree_test , lcp)
+{
+    create(20000,3,1024);
+
+    /* the intermediate files are gone once the index is written */
+    char sa_file[128],lcp_file[128];
+    strcpy(lcp_file,index_file);
+    strcat(lcp_file,".lcpraw");
+    write_sa(sa_file);
+    EXPECT_NE(access(lcp_file,F_OK),0);
+
+    sblcp_stats_t stats;
+    uint64_t maxlcp = sblcp_build((const uint8_t*)T.data(),T.size(),sa_file,lcp_file,&stats);
+    uint64_t n = T.size();
+    std::vector<uint64_t> SA(n),LCP(n);
+    FILE* f = fopen(sa_file,"r");
+    ASSERT_EQ(fread(SA.data(),sizeof(uint64_t),n,f),n);
+    fclose(f);
+    f = fopen(lcp_file,"r");
+    ASSERT_EQ(fread(LCP.data(),sizeof(uint64_t),n,f),n);
+    fclose(f);
+
+    uint64_t max_lcp = 0;
+    EXPECT_EQ(LCP[0],0);
+    for (uint64_t i=1; i<n; i++) {
+        uint64_t l = 0;
+        while (SA[i-1]+l < n && SA[i]+l < n && T[SA[i-1]+l] == T[SA[i]+l]) l++;
+        ASSERT_EQ(LCP[i],l) << "i = " << i;
+        max_lcp = std::max(max_lcp,l);
+    }
+
+    /* bits_per_pos follows from the real max lcp */
+    EXPECT_EQ(maxlcp,max_lcp);
+    EXPECT_EQ(stats.n,n);
+    uint64_t total = 0;
+    for (uint64_t w=0; w<SBLCP_MAX_WIDTH; w++) total += stats.width[w];
+    EXPECT_EQ(total,n);
+
+    /* the external construction in one range, a few and the most ranges */
+    uint64_t budgets[3] = {SBT_DEFAULT_CACHE_SIZE,64*1024,0};
+    for (uint64_t b=0; b<3; b++) {
+        sbtextstore_t* ts = sbtextstore_open(text_file);
+        EXPECT_EQ(sblcp_build_external(ts,sa_file,lcp_file,budgets[b],&stats),max_lcp);
+        sbtextstore_close(ts);
+        std::vector<uint64_t> ext(n);
+        f = fopen(lcp_file,"r");
+        ASSERT_EQ(fread(ext.data(),sizeof(uint64_t),n,f),n);
+        fclose(f);
+        EXPECT_TRUE(ext == LCP) << "budget = " << budgets[b];
+    }
+
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,0);
+    EXPECT_EQ(sbt->bits_per_pos,sblcp_width(8*max_lcp+7));
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , external_build)
+{
+    create(30000,4,512);
+
+    /* the external build writes the same index without loading the text */
+    char sa_file[128],ext_file[128];
+    write_sa(sa_file);
+    strcpy(ext_file,index_file);
+    strcat(ext_file,".ext");
+    sbtree_free(sbtree_build_external(sa_file,text_file,ext_file,512,0));
+
+    /* the given suffix array is kept, the lcp array is removed */
+    EXPECT_EQ(access(sa_file,F_OK),0);
+    strcat(ext_file,".lcpraw");
+    EXPECT_NE(access(ext_file,F_OK),0);
+    ext_file[strlen(ext_file)-strlen(".lcpraw")] = 0;
+
+    FILE* a = fopen(index_file,"r");
+    FILE* b = fopen(ext_file,"r");
+    std::vector<uint8_t> A,B;
+    int c;
+    while ((c = fgetc(a)) != EOF) A.push_back(c);
+    while ((c = fgetc(b)) != EOF) B.push_back(c);
+    fclose(a);
+    fclose(b);
+    ASSERT_EQ(A.size(),B.size());
+    EXPECT_TRUE(std::equal(A.begin()+SBT_ROOT_OFFSET,A.end(),B.begin()+SBT_ROOT_OFFSET));
+    EXPECT_TRUE(std::equal(A.begin(),A.begin()+6*sizeof(uint64_t),B.begin()));
+
+    unlink(ext_file);
+}
+
+TEST_F(sbtree_test , external_zero_bytes)
+{
+    /* 0 bytes, runs of them and a text ending in them. suffixes ending where
+       another one goes on with 0 bytes only differ at its first non 0 byte */
+    std::string text = sbtree_test_text(20000,3,5);
+    for (uint64_t i=0; i<text.size(); i++) if (text[i] == 'a') text[i] = 0;
+    for (uint64_t i=0; i<50; i++) text += std::string(i%7,'\0') + "cb";
+    text += std::string(1000,'\0') + "b" + std::string(700,'\0');
+    create_text(text,512);
+
+    char sa_file[128],ext_file[128];
+    write_sa(sa_file);
+    strcpy(ext_file,index_file);
+    strcat(ext_file,".ext");
+    FILE* a = fopen(index_file,"r");
+    std::vector<uint8_t> A;
+    int c;
+    while ((c = fgetc(a)) != EOF) A.push_back(c);
+    fclose(a);
+
+    /* both external builds write the pages of the in memory build */
+    for (uint64_t build=0; build<2; build++) {
+        if (build == 0) sbtree_free(sbtree_build_external(sa_file,text_file,ext_file,512,0));
+        else sbtree_free(sbtree_create_external(text_file,ext_file,512,0));
+        FILE* b = fopen(ext_file,"r");
+        std::vector<uint8_t> E;
+        while ((c = fgetc(b)) != EOF) E.push_back(c);
+        fclose(b);
+        ASSERT_EQ(A.size(),E.size());
+        EXPECT_TRUE(std::equal(A.begin()+SBT_ROOT_OFFSET,A.end(),E.begin()+SBT_ROOT_OFFSET)) << "build " << build;
+        unlink(ext_file);
+    }
+}
+
+TEST_F(sbtree_test , external_sa)
+{
+    create(30000,3,512);
+
+    /* runs of SBSA_MIN_RUN suffixes have to be merged */
+    char ext_file[128],sa_file[128],lcp_file[128];
+    strcpy(ext_file,index_file);
+    strcat(ext_file,".ext");
+    sbtree_free(sbtree_create_external(text_file,ext_file,512,0));
+
+    /* the leaf pages hold the suffix array, so equal indexes have equal arrays.
+       the header carries the widths of the real max lcp */
+    FILE* a = fopen(index_file,"r");
+    FILE* b = fopen(ext_file,"r");
+    std::vector<uint8_t> A,B;
+    int c;
+    while ((c = fgetc(a)) != EOF) A.push_back(c);
+    while ((c = fgetc(b)) != EOF) B.push_back(c);
+    fclose(a);
+    fclose(b);
+    ASSERT_EQ(A.size(),B.size());
+    EXPECT_TRUE(std::equal(A.begin(),A.end(),B.begin()));
+    unlink(ext_file);
+
+    /* the suffix and lcp arrays never go to disk */
+    strcpy(sa_file,ext_file);
+    strcat(sa_file,".saraw");
+    strcpy(lcp_file,ext_file);
+    strcat(lcp_file,".lcpraw");
+    EXPECT_NE(access(sa_file,F_OK),0);
+    EXPECT_NE(access(lcp_file,F_OK),0);
+}
+
+TEST_F(sbtree_test , external_sa_repeats)
+{
+    /* suffixes of a run tie far beyond their keys within and across the sorted runs */
+    T = sbtree_test_text(6000,2,4711) + std::string(3000,'a') + sbtree_test_text(3000,2,13) + std::string(3000,'a');
+    strcpy(text_file,"/tmp/sbtree_test_XXXXXX");
+    int fd = mkstemp(text_file);
+    ASSERT_EQ(write(fd,T.data(),T.size()),(ssize_t)T.size());
+    close(fd);
+    strcpy(index_file,text_file);
+    strcat(index_file,".sbti");
+
+    char sa_file[128],lcp_file[128];
+    strcpy(sa_file,index_file);
+    strcat(sa_file,".saraw");
+    strcpy(lcp_file,index_file);
+    strcat(lcp_file,".lcpraw");
+    sbsa_build(text_file,sa_file,lcp_file,0,NULL);
+
+    uint64_t n = T.size();
+    std::vector<uint64_t> SA(n),LCP(n),expect(n);
+    FILE* f = fopen(sa_file,"r");
+    ASSERT_EQ(fread(SA.data(),sizeof(uint64_t),n,f),n);
+    fclose(f);
+    f = fopen(lcp_file,"r");
+    ASSERT_EQ(fread(LCP.data(),sizeof(uint64_t),n,f),n);
+    fclose(f);
+    ASSERT_EQ(divsufsort64((const uint8_t*)T.data(),(saidx64_t*)expect.data(),n),0);
+    EXPECT_TRUE(SA == expect);
+    EXPECT_EQ(LCP[0],0ULL);
+    for (uint64_t i=1; i<n; i++) {
+        uint64_t l = 0;
+        while (SA[i-1]+l < n && SA[i]+l < n && T[SA[i-1]+l] == T[SA[i]+l]) l++;
+        ASSERT_EQ(LCP[i],l) << "i = " << i;
+    }
+}
+
+TEST_F(sbtree_test , search_single_page)
+{
+    create(200,3,4096);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,SBT_DEFAULT_RESIDENT_SIZE,SBT_DEFAULT_CACHE_SIZE);
+    EXPECT_EQ(sbt->height,1);
+
+    for (uint64_t i=0; i+3<=T.size(); i++) check(sbt,T.substr(i,3));
+    check(sbt,"d");
+
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , count)
+{
+    create(30000,2,1024);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+
+    /* frequent patterns cost no more than a point lookup */
+    const char* patterns[] = {"a","b","ab","ba","aab","abba","bbbbbbbbbbbbbbbbbbbbbbbb","c"};
+    for (uint64_t i=0; i<sizeof(patterns)/sizeof(patterns[0]); i++) {
+        std::string P = patterns[i];
+        sbtree_qstats_t qs;
+        uint64_t cnt = sbtree_count(sbt,(const uint8_t*)P.data(),P.size(),&qs);
+        EXPECT_EQ(cnt,sbtree_test_occ(T,P).size()) << "P = " << P;
+        EXPECT_LE(qs.pages_read+qs.pages_cached,2*(sbt->height-1));
+    }
+    EXPECT_EQ(sbtree_count(sbt,(const uint8_t*)T.data(),T.size(),NULL),1);
+
+    sbtree_free(sbt);
+}
+
+/* collects streamed occurrences and stops after stop of them */
+typedef struct {
+    std::vector<uint64_t> occ;
+    uint64_t calls;
+    uint64_t stop;
+} sbtree_test_report_t;
+
+static int
+sbtree_test_report(void* arg,const uint64_t* suffixes,uint64_t k)
+{
+    sbtree_test_report_t* r = (sbtree_test_report_t*) arg;
+    r->occ.insert(r->occ.end(),suffixes,suffixes+k);
+    r->calls++;
+    return r->occ.size() >= r->stop;
+}
+
+TEST_F(sbtree_test , search_limit)
+{
+    create(30000,2,512);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+
+    const char* patterns[] = {"a","ab","abba","bbbbbbbbbbbbbbbbbbbbbbbb","c"};
+    for (uint64_t p=0; p<sizeof(patterns)/sizeof(patterns[0]); p++) {
+        std::string P = patterns[p];
+        std::vector<uint64_t> occ = sbtree_test_occ(T,P);
+        uint64_t nres;
+        uint64_t* res = sbtree_search(sbt,(const uint8_t*)P.data(),P.size(),&nres,NULL);
+        for (uint64_t k=1; k<=occ.size()+1; k=3*k+1) {
+            /* the first k occurrences in SA order cost about k/b leaf pages */
+            sbtree_test_report_t r = {std::vector<uint64_t>(),0,UINT64_MAX};
+            sbtree_qstats_t qs;
+            uint64_t nocc;
+            uint64_t n = sbtree_search_limit(sbt,(const uint8_t*)P.data(),P.size(),k,SBT_ORDER_SA,sbtree_test_report,&r,&nocc,&qs);
+            EXPECT_EQ(n,std::min(k,(uint64_t)occ.size())) << "P = " << P;
+            EXPECT_EQ(nocc,(uint64_t)occ.size()) << "P = " << P;
+            ASSERT_EQ(r.occ.size(),n);
+            for (uint64_t i=0; i<n; i++) EXPECT_EQ(r.occ[i],res[i]);
+            EXPECT_LE(qs.pages_read+qs.pages_cached,2*(sbt->height-1) + n/sbt->b + 2);
+
+            /* the k smallest positions */
+            r.occ.clear();
+            n = sbtree_search_limit(sbt,(const uint8_t*)P.data(),P.size(),k,SBT_ORDER_TEXT,sbtree_test_report,&r,NULL,NULL);
+            EXPECT_EQ(n,std::min(k,(uint64_t)occ.size()));
+            ASSERT_EQ(r.occ.size(),n);
+            for (uint64_t i=0; i<n; i++) EXPECT_EQ(r.occ[i],occ[i]);
+        }
+        free(res);
+    }
+
+    /* the callback stops the scan after the page reaching 10 occurrences */
+    sbtree_test_report_t r = {std::vector<uint64_t>(),0,10};
+    uint64_t n = sbtree_search_limit(sbt,(const uint8_t*)"a",1,UINT64_MAX,SBT_ORDER_SA,sbtree_test_report,&r,NULL,NULL);
+    EXPECT_EQ(n,r.occ.size());
+    EXPECT_GE(n,10ULL);
+    EXPECT_LT(n,sbtree_test_occ(T,"a").size());
+    EXPECT_EQ(sbtree_search_limit(sbt,(const uint8_t*)"a",1,0,SBT_ORDER_SA,sbtree_test_report,&r,NULL,NULL),0ULL);
+
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , page_cache)
+{
+    create(30000,4,1024);
+    /* the smallest possible cache still answers queries correctly */
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,0);
+    EXPECT_EQ(sbt->cache->nframes,SBPAGECACHE_MIN_FRAMES);
+    for (uint64_t i=0; i<100; i++) check(sbt,T.substr(i*7,1+i%6));
+    sbtree_free(sbt);
+
+    /* a repeated query is served from the cache */
+    sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+    EXPECT_EQ(sbt->resident_levels,1);
+    uint64_t nres;
+    sbtree_qstats_t qs;
+    std::string P = T.substr(500,5);
+    free(sbtree_search(sbt,(const uint8_t*)P.data(),P.size(),&nres,&qs));
+    EXPECT_GT(qs.pages_read,0);
+    free(sbtree_search(sbt,(const uint8_t*)P.data(),P.size(),&nres,&qs));
+    EXPECT_EQ(qs.pages_read,0);
+    EXPECT_GT(qs.pages_cached,0);
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , page_cache_threads)
+{
+    /* many threads pin random pages of a cache far smaller than the file.
+       hits race with evictions, every pinned page must hold its own bytes */
+    create(200000,4,1024);
+    int fd = open(text_file,O_RDONLY);
+    ASSERT_GE(fd,0);
+    uint64_t B = 512, npages = T.size()/B;
+    sbpagecache_t* pc = sbpagecache_create(fd,B,16*B);
+    uint64_t errors = 0;
+    #pragma omp parallel num_threads(8) reduction(+:errors)
+    {
+        unsigned int seed = omp_get_thread_num();
+        for (uint64_t i=0; i<20000; i++) {
+            /* a small hot set so most requests hit */
+            uint64_t page = (rand_r(&seed)%4) ? rand_r(&seed)%12 : rand_r(&seed)%npages;
+            int miss;
+            const uint8_t* p = sbpagecache_pin(pc,page*B,&miss);
+            if (memcmp(p,T.data()+page*B,B) != 0) errors++;
+            sbpagecache_unpin(pc,p);
+        }
+    }
+    EXPECT_EQ(errors,0ULL);
+    EXPECT_GT(pc->hits,pc->misses);
+    for (uint64_t i=0; i<pc->nframes; i++) EXPECT_EQ(pc->frames[i].pins,0U);
+    sbpagecache_free(pc);
+    close(fd);
+}
+
+TEST_F(sbtree_test , resident_levels)
+{
+    create(30000,4,1024);
+
+    /* root + one more level */
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,0);
+    uint64_t budget = (1 + sbt->level_pages[sbt->height-2])*sbt->B;
+    sbtree_free(sbt);
+    sbt = sbtree_load(index_file,text_file,budget,0);
+    EXPECT_EQ(sbt->resident_levels,2);
+    EXPECT_EQ(sbt->resident_size,budget);
+    for (uint64_t i=0; i<100; i++) check(sbt,T.substr(i*13,1+i%8));
+    sbtree_free(sbt);
+
+    /* everything resident: searching never touches the page cache */
+    sbt = sbtree_load(index_file,text_file,1ULL<<40,0);
+    EXPECT_EQ(sbt->resident_levels,sbt->height);
+    uint64_t nres;
+    sbtree_qstats_t qs;
+    std::string P = T.substr(100,4);
+    free(sbtree_search(sbt,(const uint8_t*)P.data(),P.size(),&nres,&qs));
+    EXPECT_GT(nres,0);
+    EXPECT_EQ(qs.pages_read+qs.pages_cached,0);
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , search_batch)
+{
+    create(30000,4,1024);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+
+    /* many patterns with shared prefixes, duplicates and non occurring patterns */
+    std::vector<std::string> patterns;
+    srand(7);
+    for (uint64_t i=0; i<500; i++) {
+        uint64_t m = 1 + rand()%10;
+        uint64_t pos = rand()%(T.size()-m);
+        patterns.push_back(T.substr(pos,m));
+        if (i%5 == 0) patterns.push_back(T.substr(pos,m/2+1));
+        if (i%7 == 0) patterns.push_back(sbtree_test_text(m,5,i));
+    }
+    patterns.push_back(patterns[3]);
+
+    uint64_t k = patterns.size();
+    std::vector<const uint8_t*> P(k);
+    std::vector<uint64_t> m(k),lo(k),hi(k);
+    for (uint64_t i=0; i<k; i++) {
+        P[i] = (const uint8_t*) patterns[i].data();
+        m[i] = patterns[i].size();
+    }
+    sbtree_qstats_t batch_qs;
+    sbtree_search_batch(sbt,P.data(),m.data(),k,lo.data(),hi.data(),&batch_qs);
+
+    uint64_t single_text_reads = 0;
+    for (uint64_t i=0; i<k; i++) {
+        uint64_t l,h;
+        sbtree_qstats_t qs;
+        memset(&qs,0,sizeof(qs));
+        sbtree_search_range(sbt,P[i],m[i],&l,&h,&qs);
+        single_text_reads += qs.text_reads;
+        EXPECT_EQ(lo[i],l) << "P = " << patterns[i];
+        EXPECT_EQ(hi[i],h) << "P = " << patterns[i];
+        EXPECT_EQ(hi[i]-lo[i],sbtree_test_occ(T,patterns[i]).size());
+    }
+    /* each page is loaded at most once per level */
+    uint64_t pages = 0;
+    for (uint64_t l=0; l+1<sbt->height; l++) pages += sbt->level_pages[l];
+    EXPECT_LE(batch_qs.pages_read+batch_qs.pages_cached,pages);
+    EXPECT_LT(batch_qs.text_reads,single_text_reads);
+
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , search_batch_neighbours)
+{
+    create(300000,4,1024);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+
+    /* groups of long patterns sharing most of their prefix */
+    std::vector<std::string> patterns;
+    srand(17);
+    for (uint64_t i=0; i<40; i++) {
+        uint64_t pos = rand()%(T.size()-3000);
+        std::string Q = T.substr(pos,2000);
+        patterns.push_back(Q);
+        patterns.push_back(Q.substr(0,1500));
+        patterns.push_back(Q.substr(0,1999) + "e");
+        patterns.push_back(Q.substr(0,1700) + "a");
+        patterns.push_back(Q.substr(0,1700) + "d");
+        patterns.push_back(T.substr(pos,2600));
+    }
+    /* runs reaching the end of the text */
+    std::string E = T.substr(T.size()-1800);
+    patterns.push_back(E);
+    patterns.push_back(E + "a");
+    patterns.push_back(E + "ab");
+    patterns.push_back(E.substr(0,1000));
+    patterns.push_back(E.substr(0,1000) + "e");
+    uint64_t k = patterns.size();
+    std::vector<const uint8_t*> P(k);
+    std::vector<uint64_t> m(k),lo(k),hi(k);
+    for (uint64_t i=0; i<k; i++) {
+        P[i] = (const uint8_t*) patterns[i].data();
+        m[i] = patterns[i].size();
+    }
+    sbtree_qstats_t batch_qs;
+    sbtree_search_batch(sbt,P.data(),m.data(),k,lo.data(),hi.data(),&batch_qs);
+
+    uint64_t single_text_bytes = 0, single_text_reads = 0;
+    for (uint64_t i=0; i<k; i++) {
+        uint64_t l,h;
+        sbtree_qstats_t qs;
+        memset(&qs,0,sizeof(qs));
+        sbtree_search_range(sbt,P[i],m[i],&l,&h,&qs);
+        single_text_bytes += qs.text_bytes;
+        single_text_reads += qs.text_reads;
+        EXPECT_EQ(lo[i],l) << "P = " << i;
+        EXPECT_EQ(hi[i],h) << "P = " << i;
+        EXPECT_EQ(hi[i]-lo[i],sbtree_test_occ(T,patterns[i]).size());
+    }
+    EXPECT_LT(2*batch_qs.text_bytes,single_text_bytes);
+    EXPECT_LT(2*batch_qs.text_reads,single_text_reads);
+
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , engine)
+{
+    create(30000,4,1024);
+
+    std::vector<std::string> patterns;
+    srand(11);
+    for (uint64_t i=0; i<2000; i++) {
+        uint64_t m = 1 + rand()%10;
+        patterns.push_back(T.substr(rand()%(T.size()-m),m));
+    }
+    uint64_t k = patterns.size();
+    std::vector<const uint8_t*> P(k);
+    std::vector<uint64_t> m(k),lo(k),hi(k);
+    for (uint64_t i=0; i<k; i++) {
+        P[i] = (const uint8_t*) patterns[i].data();
+        m[i] = patterns[i].size();
+    }
+
+    /* a tiny cache shared by all workers forces concurrent evictions */
+    uint64_t budgets[2] = {0,SBT_DEFAULT_CACHE_SIZE};
+    for (uint64_t c=0; c<2; c++) {
+        sbtree_t* sbt = sbtree_load(index_file,text_file,0,budgets[c]);
+        sbengine_t* eng = sbengine_create(sbt,4);
+        sbtree_qstats_t qs;
+        sbengine_search(eng,P.data(),m.data(),k,lo.data(),hi.data(),&qs);
+
+        uint64_t answered = 0;
+        for (uint64_t i=0; i<eng->nthreads; i++) answered += eng->workers[i].queries;
+        EXPECT_EQ(answered,k);
+        for (uint64_t i=0; i<k; i++) {
+            uint64_t l,h;
+            sbtree_search_range(sbt,P[i],m[i],&l,&h,NULL);
+            ASSERT_EQ(lo[i],l) << "P = " << patterns[i];
+            ASSERT_EQ(hi[i],h) << "P = " << patterns[i];
+        }
+        for (uint64_t i=0; i<sbt->cache->nframes; i++) EXPECT_EQ(sbt->cache->frames[i].pins,0);
+        sbengine_free(eng);
+        sbtree_free(sbt);
+    }
+}
+
+TEST_F(sbtree_test , text_fetch)
+{
+    create(5000,4,1024);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,0);
+
+    /* overlapping, adjacent and far apart requests */
+    srand(3);
+    uint64_t k = 200;
+    std::vector<uint64_t> pos(k),len(k);
+    for (uint64_t i=0; i<k; i++) {
+        pos[i] = (i%3) ? rand()%T.size() : rand()%100;
+        len[i] = 1 + rand()%64;
+        if (pos[i]+len[i] > T.size()) len[i] = T.size()-pos[i];
+    }
+    std::vector<std::string> res(k);
+    std::vector<uint8_t*> buf(k);
+    for (uint64_t c=0; c<2; c++) {
+        if (c) sbtree_set_textcache(sbt,256,1024);
+        for (uint64_t i=0; i<k; i++) {
+            res[i].assign(len[i],0);
+            buf[i] = (uint8_t*) &res[i][0];
+        }
+        sbtree_qstats_t qs;
+        memset(&qs,0,sizeof(qs));
+        sbtree_text_fetch(sbt,pos.data(),len.data(),buf.data(),k,&qs);
+        for (uint64_t i=0; i<k; i++) EXPECT_EQ(res[i],T.substr(pos[i],len[i]));
+        if (!c) EXPECT_LT(qs.text_reads,k);
+    }
+
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , text_cache)
+{
+    create(30000,4,1024);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+    /* blocks smaller than the patterns and a cache which has to evict */
+    sbtree_set_textcache(sbt,8,64);
+    EXPECT_EQ(sbt->textcache->nframes,SBPAGECACHE_MIN_FRAMES);
+
+    std::vector<std::string> patterns;
+    srand(5);
+    for (uint64_t i=0; i<200; i++) {
+        uint64_t m = 1 + rand()%20;
+        patterns.push_back(T.substr(rand()%(T.size()-m),m));
+        if (i%10 == 0) patterns.push_back(sbtree_test_text(m,5,i));
+    }
+    patterns.push_back(T.substr(T.size()-3));
+    patterns.push_back(T.substr(0,50));
+    for (uint64_t i=0; i<patterns.size(); i++) check(sbt,patterns[i]);
+
+    /* a large cache serves repeated queries from memory */
+    sbtree_set_textcache(sbt,SBT_DEFAULT_TEXT_BLOCK,T.size()+SBT_DEFAULT_TEXT_BLOCK);
+    uint64_t k = patterns.size();
+    std::vector<const uint8_t*> P(k);
+    std::vector<uint64_t> m(k),lo(k),hi(k);
+    for (uint64_t i=0; i<k; i++) {
+        P[i] = (const uint8_t*) patterns[i].data();
+        m[i] = patterns[i].size();
+    }
+    sbtree_qstats_t qs;
+    sbtree_search_batch(sbt,P.data(),m.data(),k,lo.data(),hi.data(),&qs);
+    sbtree_search_batch(sbt,P.data(),m.data(),k,lo.data(),hi.data(),&qs);
+    EXPECT_EQ(qs.text_reads,0);
+    EXPECT_GT(qs.text_cached,0);
+    for (uint64_t i=0; i<k; i++) EXPECT_EQ(hi[i]-lo[i],sbtree_test_occ(T,patterns[i]).size());
+
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , async_search)
+{
+    create(30000,4,1024);
+
+    std::vector<std::string> patterns;
+    srand(13);
+    for (uint64_t i=0; i<1000; i++) {
+        uint64_t m = 1 + rand()%10;
+        patterns.push_back(T.substr(rand()%(T.size()-m),m));
+        if (i%10 == 0) patterns.push_back(sbtree_test_text(m,5,i));
+    }
+    uint64_t k = patterns.size();
+    std::vector<const uint8_t*> P(k);
+    std::vector<uint64_t> m(k),lo(k),hi(k);
+    for (uint64_t i=0; i<k; i++) {
+        P[i] = (const uint8_t*) patterns[i].data();
+        m[i] = patterns[i].size();
+    }
+
+    /* with the minimal cache queries have to wait for frames */
+    uint64_t budgets[2] = {0,SBT_DEFAULT_CACHE_SIZE};
+    for (uint64_t c=0; c<2; c++) {
+        sbtree_t* sbt = sbtree_load(index_file,text_file,0,budgets[c]);
+        sbasync_t* sa = sbasync_create(sbt,SBASYNC_DEFAULT_DEPTH);
+        sbtree_qstats_t qs;
+        sbasync_search(sa,P.data(),m.data(),k,lo.data(),hi.data(),&qs);
+        for (uint64_t i=0; i<k; i++) {
+            uint64_t l,h;
+            sbtree_search_range(sbt,P[i],m[i],&l,&h,NULL);
+            ASSERT_EQ(lo[i],l) << "P = " << patterns[i];
+            ASSERT_EQ(hi[i],h) << "P = " << patterns[i];
+        }
+        for (uint64_t i=0; i<sbt->cache->nframes; i++) EXPECT_EQ(sbt->cache->frames[i].pins,0);
+        sbasync_free(sa);
+        sbtree_free(sbt);
+    }
+
+    /* candidates are verified from the text cache. the minimal one makes queries
+       wait for text blocks, the large one holds the whole text after one search */
+    uint64_t text_budgets[2] = {SBPAGECACHE_MIN_FRAMES*512,1024*1024};
+    for (uint64_t c=0; c<2; c++) {
+        sbtree_t* sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+        sbtree_set_textcache(sbt,512,text_budgets[c]);
+        sbasync_t* sa = sbasync_create(sbt,SBASYNC_DEFAULT_DEPTH);
+        sbtree_qstats_t qs;
+        for (uint64_t round=0; round<2; round++) {
+            sbasync_search(sa,P.data(),m.data(),k,lo.data(),hi.data(),&qs);
+            for (uint64_t i=0; i<k; i++) {
+                uint64_t l,h;
+                sbtree_search_range(sbt,P[i],m[i],&l,&h,NULL);
+                ASSERT_EQ(lo[i],l) << "P = " << patterns[i];
+                ASSERT_EQ(hi[i],h) << "P = " << patterns[i];
+            }
+        }
+        EXPECT_GT(qs.text_cached,0);
+        if (c == 1) EXPECT_EQ(qs.text_reads,0);
+        for (uint64_t i=0; i<sbt->textcache->nframes; i++) EXPECT_EQ(sbt->textcache->frames[i].pins,0);
+        sbasync_free(sa);
+        sbtree_free(sbt);
+    }
+}
+TEST_F(sbtree_test , lcp_carry)
+{
+    /* a periodic text: the suffixes prefixed by a long pattern fill pages on
+       every level, so all candidates of its paths share most of it with P */
+    std::string Y = sbtree_test_text(50,4,99);
+    std::string text = sbtree_test_text(1000,4,98);
+    for (uint64_t i=0; i<3000; i++) text += Y;
+    text += sbtree_test_text(1000,4,97);
+    create_text(text,1024);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+    EXPECT_GE(sbt->height,3);
+    std::string X = text.substr(1000,8000);
+
+    std::vector<std::string> patterns;
+    patterns.push_back(X);
+    patterns.push_back(X.substr(0,6000));
+    patterns.push_back(X.substr(0,7900) + "e");
+    patterns.push_back(X.substr(0,5432) + "ab");
+    patterns.push_back(X.substr(3000) + T.substr(T.size()-1000));
+    uint64_t k = patterns.size();
+    std::vector<const uint8_t*> P(k);
+    std::vector<uint64_t> m(k),lo(k),hi(k),blo(k),bhi(k);
+    for (uint64_t i=0; i<k; i++) {
+        P[i] = (const uint8_t*) patterns[i].data();
+        m[i] = patterns[i].size();
+    }
+
+    /* a query reads about m text bytes plus a probe per level and path,
+       not m bytes on every level */
+    uint64_t probes = 2*sbt->height*SBT_TEXT_PROBE;
+    uint64_t total = 0;
+    for (uint64_t i=0; i<k; i++) {
+        sbtree_qstats_t qs;
+        memset(&qs,0,sizeof(qs));
+        sbtree_search_range(sbt,P[i],m[i],&lo[i],&hi[i],&qs);
+        EXPECT_EQ(hi[i]-lo[i],sbtree_test_occ(T,patterns[i]).size());
+        EXPECT_LE(qs.text_bytes,m[i] + probes) << "P = " << i;
+        total += m[i] + probes;
+    }
+
+    sbtree_qstats_t qs;
+    sbtree_search_batch(sbt,P.data(),m.data(),k,blo.data(),bhi.data(),&qs);
+    for (uint64_t i=0; i<k; i++) {
+        EXPECT_EQ(blo[i],lo[i]);
+        EXPECT_EQ(bhi[i],hi[i]);
+    }
+    EXPECT_LE(qs.text_bytes,total);
+
+    sbasync_t* sa = sbasync_create(sbt,SBASYNC_DEFAULT_DEPTH);
+    sbasync_search(sa,P.data(),m.data(),k,blo.data(),bhi.data(),&qs);
+    for (uint64_t i=0; i<k; i++) {
+        EXPECT_EQ(blo[i],lo[i]);
+        EXPECT_EQ(bhi[i],hi[i]);
+    }
+    EXPECT_LE(qs.text_bytes,total);
+    sbasync_free(sa);
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , writer)
+{
+    /* appends of odd sizes crossing the buffers, ending with a partial block */
+    char file[64];
+    strcpy(file,"/tmp/sbwriter_test_XXXXXX");
+    close(mkstemp(file));
+    std::string data(2*SBWRITER_BUFFER_SIZE+12345,0);
+    srand(5);
+    for (uint64_t i=0; i<data.size(); i++) data[i] = rand()%256;
+    sbwriter_t* w = sbwriter_create(file);
+    uint64_t off = 0;
+    while (off < data.size()) {
+        uint64_t len = std::min((uint64_t)(1 + rand()%100000),(uint64_t)data.size()-off);
+        if (rand()%4) sbwriter_append(w,data.data()+off,len);
+        else {
+            memset(&data[off],0,len);
+            sbwriter_zero(w,len);
+        }
+        off += len;
+        EXPECT_EQ(sbwriter_offset(w),off);
+    }
+    EXPECT_EQ(sbwriter_finish(w),data.size());
+    std::string res(data.size()+1,0);
+    int fd = open(file,O_RDONLY);
+    EXPECT_EQ(read(fd,&res[0],res.size()),(ssize_t)data.size());
+    close(fd);
+    res.resize(data.size());
+    EXPECT_TRUE(res == data);
+    unlink(file);
+
+    /* the header and the level table are zero padded up to the root page */
+    create(30000,4,512);
+    std::string idx(SBT_ROOT_OFFSET,1);
+    fd = open(index_file,O_RDONLY);
+    EXPECT_EQ(read(fd,&idx[0],idx.size()),(ssize_t)idx.size());
+    close(fd);
+    const uint64_t* header = (const uint64_t*) idx.data();
+    for (uint64_t i=(6+header[5])*sizeof(uint64_t); i<SBT_ROOT_OFFSET; i++) EXPECT_EQ(idx[i],0);
+}
+TEST_F(sbtree_test , greedy_fill)
+{
+    /* a long repeat makes the global crit bit width large while most pages
+       only need a few bits, so the pages take more than b entries */
+    std::string R = sbtree_test_text(3000,4,7);
+    T = sbtree_test_text(20000,4,4711) + R + sbtree_test_text(5000,4,13) + R;
+    strcpy(text_file,"/tmp/sbtree_test_XXXXXX");
+    int fd = mkstemp(text_file);
+    ASSERT_EQ(write(fd,T.data(),T.size()),(ssize_t)T.size());
+    close(fd);
+    strcpy(index_file,text_file);
+    strcat(index_file,".sbti");
+    sbtree_free(sbtree_create(text_file,index_file,512));
+
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+    EXPECT_GE(sbt->bits_per_pos,15ULL);
+    /* b entries of the global widths always fit next to the first entry index */
+    EXPECT_LE(critbit_serialized_size(sbt->b,sbt->bits_per_pos,sbt->bits_per_suffix,0),sbt->B-sizeof(uint64_t));
+    uint64_t entries = 0;
+    for (uint64_t i=0; i<sbt->level_pages[0]; i++) {
+        sb_diskpage_t* page = sbtree_load_node(sbt,0,i,NULL);
+        critbit_mem_t cbm;
+        critbit_mem_init(&cbm,page->data);
+        EXPECT_EQ(sbtree_page_first(sbt,page),entries);
+        if (i+1 < sbt->level_pages[0]) EXPECT_GE(cbm.g,sbt->b);
+        entries += cbm.g;
+        sbtree_free_node(sbt,page);
+    }
+    EXPECT_EQ(entries,T.size());
+    EXPECT_LT(sbt->level_pages[0],(T.size()+sbt->b-1)/sbt->b);
+
+    srand(11);
+    for (uint64_t i=0; i<300; i++) {
+        uint64_t len = 1 + rand()%12;
+        check(sbt,T.substr(rand()%(T.size()-len),len));
+    }
+    check(sbt,R.substr(100,2000));
+    check(sbt,"dddddddddddd");
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , text_store)
+{
+    create(30000,4,512);
+    char store_file[128],ext_file[128];
+    strcpy(store_file,text_file);
+    strcat(store_file,".sbtz");
+    sbtextstore_create(text_file,store_file,1000);
+    EXPECT_LT(sb_getfilesize(store_file),T.size()/2);
+
+    /* reads within and across blocks */
+    sbtextstore_t* ts = sbtextstore_open(store_file);
+    EXPECT_EQ(ts->compressed,1);
+    EXPECT_EQ(ts->n,T.size());
+    EXPECT_EQ(ts->nblocks,30ULL);
+    srand(9);
+    std::string buf(5000,0);
+    for (uint64_t i=0; i<100; i++) {
+        uint64_t pos = rand()%T.size();
+        uint64_t len = std::min((uint64_t)(rand()%5000),T.size()-pos);
+        sbtextstore_read(ts,pos,len,(uint8_t*)&buf[0]);
+        EXPECT_EQ(buf.substr(0,len),T.substr(pos,len));
+    }
+    sbtextstore_close(ts);
+    ts = sbtextstore_open(text_file);
+    EXPECT_EQ(ts->compressed,0);
+    sbtextstore_close(ts);
+
+    /* search over the store instead of the text */
+    sbtree_t* sbt = sbtree_load(index_file,store_file,0,SBT_DEFAULT_CACHE_SIZE);
+    ASSERT_TRUE(sbt->textcache != NULL);
+    EXPECT_EQ(sbt->textcache->B,1000ULL);
+    std::vector<std::string> patterns;
+    for (uint64_t i=0; i<300; i++) {
+        uint64_t len = 1 + rand()%12;
+        patterns.push_back(T.substr(rand()%(T.size()-len),len));
+    }
+    patterns.push_back(T.substr(T.size()-5));
+    for (uint64_t i=0; i<patterns.size(); i++) check(sbt,patterns[i]);
+
+    uint64_t k = patterns.size();
+    std::vector<const uint8_t*> P(k);
+    std::vector<uint64_t> m(k),lo(k),hi(k);
+    for (uint64_t i=0; i<k; i++) {
+        P[i] = (const uint8_t*) patterns[i].data();
+        m[i] = patterns[i].size();
+    }
+    sbasync_t* sa = sbasync_create(sbt,SBASYNC_DEFAULT_DEPTH);
+    sbasync_search(sa,P.data(),m.data(),k,lo.data(),hi.data(),NULL);
+    for (uint64_t i=0; i<k; i++) EXPECT_EQ(hi[i]-lo[i],sbtree_test_occ(T,patterns[i]).size());
+    sbasync_free(sa);
+    sbtree_free(sbt);
+
+    /* building from the store gives the same index */
+    for (uint64_t e=0; e<2; e++) {
+        strcpy(ext_file,index_file);
+        strcat(ext_file,".store");
+        if (e) sbtree_free(sbtree_create_external(store_file,ext_file,512,0));
+        else sbtree_free(sbtree_create(store_file,ext_file,512));
+        FILE* a = fopen(index_file,"r");
+        FILE* b = fopen(ext_file,"r");
+        std::vector<uint8_t> A,B;
+        int c;
+        while ((c = fgetc(a)) != EOF) A.push_back(c);
+        while ((c = fgetc(b)) != EOF) B.push_back(c);
+        fclose(a);
+        fclose(b);
+        EXPECT_TRUE(A == B);
+        unlink(ext_file);
+    }
+    unlink(store_file);
+}
+
+TEST_F(sbtree_test , relative_suffixes)
+{
+    /* the suffixes of a long run are adjacent in the SA and close in the text */
+    T = sbtree_test_text(20000,4,4711) + std::string(30000,'a') + sbtree_test_text(20000,4,13);
+    strcpy(text_file,"/tmp/sbtree_test_XXXXXX");
+    int fd = mkstemp(text_file);
+    ASSERT_EQ(write(fd,T.data(),T.size()),(ssize_t)T.size());
+    close(fd);
+    strcpy(index_file,text_file);
+    strcat(index_file,".sbti");
+    sbtree_free(sbtree_create(text_file,index_file,512));
+
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,SBT_DEFAULT_CACHE_SIZE);
+    uint64_t relative = 0;
+    for (uint64_t i=0; i<sbt->level_pages[0]; i++) {
+        sb_diskpage_t* page = sbtree_load_node(sbt,0,i,NULL);
+        critbit_mem_t cbm;
+        critbit_mem_init(&cbm,page->data);
+        if (cbm.suffix_base) {
+            relative++;
+            EXPECT_LT(cbm.suffix_width,sbt->bits_per_suffix);
+        }
+        sbtree_free_node(sbt,page);
+    }
+    EXPECT_GT(relative,0ULL);
+
+    check(sbt,std::string(1000,'a'));
+    check(sbt,std::string(29990,'a'));
+    check(sbt,"ba");
+    srand(17);
+    for (uint64_t i=0; i<200; i++) {
+        uint64_t len = 1 + rand()%10;
+        check(sbt,T.substr(rand()%(T.size()-len),len));
+    }
+    sbtree_free(sbt);
+}
+
+TEST_F(sbtree_test , veb_layout)
+{
+    create(60000,4,512);
+    sbtree_t* sbt = sbtree_load(index_file,text_file,0,0);
+    ASSERT_GE(sbt->height,3ULL);
+    std::vector<std::string> pages;
+    for (uint64_t l=0; l<sbt->height; l++) {
+        for (uint64_t i=0; i<sbt->level_pages[l]; i++) {
+            sb_diskpage_t* page = sbtree_load_node(sbt,l,i,NULL);
+            pages.push_back(std::string((const char*)page->data,sbt->B));
+            sbtree_free_node(sbt,page);
+        }
+    }
+    sbtree_free(sbt);
+
+    sbtree_relayout(index_file,SBT_LAYOUT_VEB);
+    sbt = sbtree_load(index_file,text_file,0,0);
+    EXPECT_EQ(sbt->layout,(uint64_t)SBT_LAYOUT_VEB);
+    /* the same pages in a different order */
+    uint64_t k = 0;
+    for (uint64_t l=0; l<sbt->height; l++) {
+        for (uint64_t i=0; i<sbt->level_pages[l]; i++) {
+            sb_diskpage_t* page = sbtree_load_node(sbt,l,i,NULL);
+            EXPECT_TRUE(pages[k++] == std::string((const char*)page->data,sbt->B));
+            sbtree_free_node(sbt,page);
+        }
+    }
+    /* the root is numbered first and the leaves follow their parent */
+    EXPECT_EQ(sbtree_page_offset(sbt,sbt->height-1,0),(uint64_t)SBT_ROOT_OFFSET+sbt->B);
+    for (uint64_t i=0; i<sbt->level_pages[1]; i++) {
+        sb_diskpage_t* page = sbtree_load_node(sbt,1,i,NULL);
+        uint64_t first = sbtree_page_first(sbt,page);
+        EXPECT_EQ(sbtree_page_offset(sbt,0,first),sbtree_page_offset(sbt,1,i)+sbt->B);
+        sbtree_free_node(sbt,page);
+    }
+    srand(3);
+    for (uint64_t i=0; i<200; i++) {
+        uint64_t len = 1 + rand()%10;
+        check(sbt,T.substr(rand()%(T.size()-len),len));
+    }
+    sbtree_free(sbt);
+
+    /* resident levels are gathered page by page */
+    sbt = sbtree_load(index_file,text_file,1ULL<<40,0);
+    EXPECT_EQ(sbt->resident_levels,sbt->height);
+    for (uint64_t i=0; i<50; i++) check(sbt,T.substr(i*17,1+i%6));
+    sbtree_free(sbt);
+
+    /* and back */
+    sbtree_relayout(index_file,SBT_LAYOUT_LEVEL);
+    sbt = sbtree_load(index_file,text_file,0,0);
+    EXPECT_EQ(sbt->page_slot,(uint64_t*)NULL);
+    for (uint64_t i=0; i<50; i++) check(sbt,T.substr(i*19,1+i%7));
+    sbtree_free(sbt);
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}